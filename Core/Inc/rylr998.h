@@ -40,6 +40,121 @@ typedef enum
 
 } RYLR_RX_command_t;
 
+/*
+ * +ERR=<code> as documented for the RYLR998
+ */
+typedef enum
+{
+	RYLR_ERR_NONE = 0,
+	RYLR_ERR_NO_CRLF = 1,				//no "enter" or 0x0D 0x0A at the end of the AT command
+	RYLR_ERR_NO_AT = 2,					//the head of the command is not "AT"
+	RYLR_ERR_UNKNOWN_CMD = 4,			//unknown command
+	RYLR_ERR_LENGTH_MISMATCH = 5,		//data to be sent does not match the actual length
+	RYLR_ERR_TX_OVER_TIMES = 10,		//TX is over times
+	RYLR_ERR_CRC = 12,					//CRC error
+	RYLR_ERR_TX_TOO_LONG = 13,			//TX data more than 240 bytes
+	RYLR_ERR_FLASH_WRITE = 14,			//failed to write flash memory
+	RYLR_ERR_UNKNOWN_FAILURE = 15,		//unknown failure
+	RYLR_ERR_TX_NOT_COMPLETED = 17,		//last TX was not completed
+	RYLR_ERR_PREAMBLE = 18,				//preamble value is not allowed
+	RYLR_ERR_RX_HEADER = 19,			//RX failed, header error
+	RYLR_ERR_SMART_MODE_TIME = 20,		//smart receiving power saving mode time not allowed
+	RYLR_ERR_MAX_CODE = RYLR_ERR_SMART_MODE_TIME
+
+} RYLR_ERR_code_t;
+
+typedef enum
+{
+	RYLR_RECOVER_REPORT = 0x00U,		//return RYLR_STATUS_ERR to the caller
+	RYLR_RECOVER_RETRY,					//send the command again after the backoff
+	RYLR_RECOVER_RESYNC,				//restart the UART reception, then send again
+	RYLR_RECOVER_RESET					//AT+RESET, wait for +READY, then send again
+
+} RYLR_recovery_t;
+
+typedef enum
+{
+	RYLR_STATUS_OK = 0x00U,
+	RYLR_STATUS_TIMEOUT,			//no answer before the deadline, retries exhausted
+	RYLR_STATUS_ERR,				//module answered +ERR=
+	RYLR_STATUS_TX_ERROR			//command could not be sent over the UART
+
+} RYLR_status_t;
+
+#define RYLR_BROADCAST_ADDRESS		0U		//AT+SEND to address 0 reaches every module of the network
+#define RYLR_MAX_PAYLOAD			240U	//bytes per AT+SEND
+
+#ifndef RYLR_TX_BUFFER_SIZE
+#define RYLR_TX_BUFFER_SIZE			260U	//"AT+SEND=65535,240," + 240 bytes + "\r\n"
+#endif
+#ifndef RYLR_LINE_BUFFER_SIZE
+#define RYLR_LINE_BUFFER_SIZE		270U	//longest line: "+RCV=65535,240," + 240 bytes + ",-128,-20\r\n"
+#endif
+#ifndef RYLR_LINE_TICKS
+#define RYLR_LINE_TICKS				8U		//arrival ticks kept for lines waiting to be parsed
+#endif
+#if (RYLR_LINE_TICKS == 0) || (RYLR_LINE_TICKS > 256) || (RYLR_LINE_TICKS & (RYLR_LINE_TICKS - 1))
+#error "RYLR_LINE_TICKS must be a power of two, up to 256 (the line counters are 8 bit)"
+#endif
+#ifndef RYLR_AIR_HEADER_BYTES
+#define RYLR_AIR_HEADER_BYTES		0U		//bytes the module adds on air in front of the data
+#endif
+#ifndef RYLR_UART_TX_TIMEOUT_MS
+#define RYLR_UART_TX_TIMEOUT_MS		10U
+#endif
+#ifndef RYLR_DEFAULT_TIMEOUT_MS
+#define RYLR_DEFAULT_TIMEOUT_MS		500U
+#endif
+#ifndef RYLR_DEFAULT_RETRIES
+#define RYLR_DEFAULT_RETRIES		3U
+#endif
+#ifndef RYLR_RESET_TIMEOUT_MS
+#define RYLR_RESET_TIMEOUT_MS		1000U
+#endif
+#ifndef RYLR_DEFAULT_BACKOFF_MS
+#define RYLR_DEFAULT_BACKOFF_MS		50U
+#endif
+#ifndef RYLR_STOP_LPTIM_LSE
+#define RYLR_STOP_LPTIM_LSE			0		//1: LPTIM1 counts the Stop time on the 32.768 kHz crystal instead of LSI
+#endif
+#ifndef RYLR_STOP_LPTIM_HZ
+#if RYLR_STOP_LPTIM_LSE
+#define RYLR_STOP_LPTIM_HZ			1024U	//LSE / 32
+#else
+#define RYLR_STOP_LPTIM_HZ			1156U	//LSI (37 kHz typical, not trimmed) / 32
+#endif
+#endif
+#ifndef RYLR_STOP_MIN_MS
+#define RYLR_STOP_MIN_MS			3U		//shorter waits use Sleep, restarting the PLL is not worth it
+#endif
+#define RYLR_STOP_MAX_MS			(0xFFFFU * 1000U / RYLR_STOP_LPTIM_HZ)	//16 bit LPTIM1
+#ifndef RYLR_CLOCK_MSI_RANGE
+#define RYLR_CLOCK_MSI_RANGE		RCC_MSIRANGE_6	//4.194 MHz while waiting, see rylr998_EnableClockScaling
+#endif
+#ifndef RYLR_I_RX_UA
+#define RYLR_I_RX_UA				16500U	//module receiving (datasheet), for the energy models
+#endif
+#ifndef RYLR_I_SLEEP_UA
+#define RYLR_I_SLEEP_UA				10U		//module asleep (AT+MODE=1, or between smart receiving windows)
+#endif
+
+typedef uint32_t (*RYLR_tick_fn_t)(void);
+
+typedef struct{
+	uint32_t timeout_ms;			//response deadline of each attempt
+	uint8_t max_retries;			//retransmissions after the first attempt
+	uint32_t backoff_ms;			//wait before the first retransmission, doubled on each retry
+}RYLR_retry_policy_t;
+
+typedef struct{
+	uint32_t commands;				//commands awaited
+	uint32_t retries;				//retransmissions
+	uint32_t timeouts;				//attempts that hit the deadline
+	uint32_t errors;				//+ERR= answers
+	uint32_t recoveries;			//resyncs and resets done before a retry
+	uint32_t rejected;				//+RCV dropped by the payload filter
+}RYLR_metrics_t;
+
 typedef struct{
 	uint8_t networkId;      		//valid range: 3-15, 18(default)
 	uint16_t address; 				//0~65535 (default 0)
@@ -57,47 +172,225 @@ typedef struct{
 	uint8_t CRFOP; 					//22: 22dBm(default) 21: 21dBm 20: 20dBm ... 01: 1dBm 00: 0dBm
 }RYLR_config_t;
 
+/*
+ * Radio settings that change at runtime, tracked per handle
+ */
+typedef struct{
+	uint8_t SF;
+	uint8_t BW;
+	uint8_t CR;
+	uint8_t ProgramedPreamble;
+	uint8_t CRFOP;
+}RYLR_phy_t;
+
+#define RYLR_PHY_PARAMETER			0x01U	//SF, BW, CR and preamble (AT+PARAMETER)
+#define RYLR_PHY_CRFOP				0x02U	//RF output power (AT+CRFOP)
+
+typedef struct{
+	const char *name;
+	RYLR_phy_t phy;
+}RYLR_profile_t;
+
+/*
+ * Boot configuration pre-encoded by RYLR_CFG_DEFINE (rylr998_cfg.h)
+ */
+typedef struct{
+	const char *commands;			//FACTORY, NETWORKID, ADDRESS, PARAMETER, MODE, IPR, BAND, CPIN, CRFOP
+	uint16_t length;
+	RYLR_phy_t phy;
+	uint8_t mode;
+}RYLR_static_config_t;
+
+/*
+ * Airtime token bucket, refilled at permille us of air per ms
+ */
+typedef struct{
+	uint16_t permille;				//allowed duty cycle, 10: 1%, 1: 0.1%, 0: not limited
+	uint32_t capacity_us;			//airtime that can be sent in one burst
+	uint32_t tokens_us;				//airtime available now
+	uint32_t last_refill;			//tick of the last refill
+	uint32_t charged_ms;			//airtime sent since the limit was set
+	uint32_t deferred;				//frames refused for lack of budget
+}RYLR_duty_t;
+
+typedef void (*RYLR_resume_fn_t)(void);
+
+/*
+ * Stop mode while waiting for the module, see rylr998_EnableStopMode
+ */
+typedef struct{
+	RYLR_resume_fn_t resume;		//restores the system clock after Stop, NULL: Sleep mode only
+	uint32_t entries;				//Stop mode entries
+	uint32_t early_wakeups;			//ended before the deadline, by a start bit or another interrupt
+	uint32_t stop_ms;				//time spent in Stop, measured by LPTIM1
+	uint32_t sleep_entries;			//waits in Sleep mode: Stop disabled, too short or UART busy
+}RYLR_stop_t;
+
+/*
+ * System clock scaling around radio activity, see rylr998_EnableClockScaling
+ */
+typedef struct{
+	RYLR_resume_fn_t fast;			//full speed clock, UART kernel clock left alone, NULL: scaling off
+	uint32_t msi_range;				//RCC_MSIRANGE_x used while waiting
+	uint8_t depth;					//rylr998_ClockFast calls not released yet
+	uint32_t slow_entries;			//switches to MSI
+	uint32_t fast_entries;			//switches back to full speed
+	uint32_t failures;				//switches to MSI the RCC refused
+}RYLR_clock_t;
+
 typedef struct{
 	uint16_t id;
 	uint8_t byte_count;
-	uint8_t data[240];
+	uint8_t data[241];				//240 bytes max + '\0'
 	int8_t rssi;
-	uint8_t snr;
+	int8_t snr;						//dB, negative below the noise floor
+	uint32_t tick;					//tick of the RX event that completed the line
 }RYLR_RX_data_t;
 
 
+typedef struct rylr998_s rylr998_t;
 
-extern RYLR_RX_data_t rx_packet;
+typedef void (*RYLR_rx_callback_t)(rylr998_t *hrylr, const RYLR_RX_data_t *packet);
+typedef uint8_t (*RYLR_tx_filter_t)(void *ctx, uint16_t address, const uint8_t *data, uint8_t length, uint8_t *out);
+typedef uint8_t (*RYLR_rx_filter_t)(void *ctx, RYLR_RX_data_t *packet);
 
+/*
+ * Line framing of the reception, +RCV payloads are skipped by length
+ */
+typedef enum
+{
+	RYLR_FRAME_IDLE = 0x00U,
+	RYLR_FRAME_HEAD,
+	RYLR_FRAME_ADDRESS,
+	RYLR_FRAME_LENGTH,
+	RYLR_FRAME_DATA,
+	RYLR_FRAME_LINE
 
+} RYLR_frame_state_t;
 
-HAL_StatusTypeDef rylr998_config(RYLR_config_t *config_handler,UART_HandleTypeDef *puartHandle,uint8_t *rx_buff,uint8_t RX_BUFFER_SIZE);
+typedef struct{
+	RYLR_frame_state_t state;
+	uint16_t count;				//header bytes matched, then payload bytes left
+}RYLR_framer_t;
+
+/*
+ * Driver state of one RYLR998, one handle per module / UART
+ */
+struct rylr998_s{
+	UART_HandleTypeDef *huart;
+	uint8_t *rx_buff;							//DMA ring in circular mode
+	uint16_t rx_size;
+	uint16_t rx_index;							//next unread position of the ring
+	uint16_t dma_index;							//ring position at the last RX event
+	RYLR_framer_t rx_framer;					//framing of the bytes seen by the RX event
+	volatile uint8_t rx_lines;					//complete lines seen by the RX event (ISR side)
+	volatile uint32_t rx_ticks[RYLR_LINE_TICKS];	//tick of each complete line, indexed by its line count
+	uint8_t rx_parsed;							//lines consumed by the parser, pending = rx_lines - rx_parsed
+	uint8_t aux_buff[RYLR_LINE_BUFFER_SIZE];	//line being parsed
+
+	uint8_t tx_buffer[RYLR_TX_BUFFER_SIZE];		//last command sent, kept for retransmission
+	uint16_t tx_length;
+	uint8_t tx_dma;
+	uint8_t tx_batch;							//commands are appended to tx_buffer instead of sent
+	uint8_t tx_batch_count;
+
+	RYLR_duty_t duty;							//charged by rylr998_sendData
+	uint32_t tx_air_us;							//time on air sent by rylr998_sendData, free running
+	uint8_t mode;								//last AT+MODE sent: 0 receive, 1 sleep, 2 smart receiving
+	uint16_t mode_rx_ms;						//smart receiving window
+	uint16_t mode_sleep_ms;						//smart receiving sleep
+	RYLR_stop_t stop;							//low power waits
+	RYLR_clock_t clock;							//system clock scaling
+
+	RYLR_phy_t phy;								//settings acknowledged by the module
+	RYLR_phy_t phy_pending;						//settings sent, committed on +OK
+	RYLR_phy_t phy_active;						//filled by rylr998_activePhy
+	uint8_t phy_valid;							//RYLR_PHY_x fields known to match the module
+	uint8_t phy_dirty;							//RYLR_PHY_x fields in phy_pending
+
+	RYLR_RX_data_t rx_packet;					//last +RCV
+	RYLR_rx_callback_t rx_callback;				//called from the parser on every +RCV
+	RYLR_tx_filter_t tx_filter;					//applied by rylr998_sendData, e.g. encryption
+	RYLR_rx_filter_t rx_filter;					//applied by the parser before rx_callback
+	uint8_t filter_overhead;					//bytes tx_filter adds
+	void *filter_ctx;
+
+	RYLR_tick_fn_t tick;
+	RYLR_metrics_t metrics;
+	RYLR_ERR_code_t last_error;
+	RYLR_recovery_t recovery[RYLR_ERR_MAX_CODE + 1];
+};
+
+
+
+extern const RYLR_retry_policy_t rylr998_default_policy;
+extern const RYLR_profile_t rylr998_profile_long_range;
+extern const RYLR_profile_t rylr998_profile_bulk;
+
+
+
+HAL_StatusTypeDef rylr998_init(rylr998_t *hrylr, UART_HandleTypeDef *puartHandle, uint8_t *rx_buff, uint16_t RX_BUFFER_SIZE);
+HAL_StatusTypeDef rylr998_config(rylr998_t *hrylr, RYLR_config_t *config_handler);
+HAL_StatusTypeDef rylr998_configStatic(rylr998_t *hrylr, const RYLR_static_config_t *config);
 
 //Tx
-HAL_StatusTypeDef rylr998_sendData(UART_HandleTypeDef *uartHandle,uint16_t address, uint8_t *data,uint8_t data_length);//uses MALLOC
-HAL_StatusTypeDef rylr998_networkId(UART_HandleTypeDef *puartHandle, uint8_t networkId);
-HAL_StatusTypeDef rylr998_setAddress(UART_HandleTypeDef *puartHandle, uint16_t address);
-HAL_StatusTypeDef rylr998_setParameter(UART_HandleTypeDef *puartHandle,uint8_t SF,uint8_t BW,uint8_t CR,uint8_t ProgramedPreamble);
-HAL_StatusTypeDef rylr998_reset(UART_HandleTypeDef *puartHandle);
-HAL_StatusTypeDef rylr998_mode(UART_HandleTypeDef *puartHandle,uint8_t mode,uint32_t rxTime,uint32_t LowSpeedTime);
-HAL_StatusTypeDef rylr998_setBaudRate(UART_HandleTypeDef *puartHandle, uint32_t baudRate);
-HAL_StatusTypeDef rylr998_setBand(UART_HandleTypeDef *puartHandle, uint32_t frequency,uint8_t memory);
-HAL_StatusTypeDef rylr998_setCPIN(UART_HandleTypeDef *puartHandle, const char *password);
-HAL_StatusTypeDef rylr998_setCRFOP(UART_HandleTypeDef *puartHandle, uint8_t CRFOP);
-HAL_StatusTypeDef rylr998_FACTORY(UART_HandleTypeDef *puartHandle);
+HAL_StatusTypeDef rylr998_sendData(rylr998_t *hrylr,uint16_t address, uint8_t *data,uint8_t data_length);//DMA, buffer owned by the handle
+HAL_StatusTypeDef rylr998_networkId(rylr998_t *hrylr, uint8_t networkId);
+HAL_StatusTypeDef rylr998_setAddress(rylr998_t *hrylr, uint16_t address);
+HAL_StatusTypeDef rylr998_setParameter(rylr998_t *hrylr,uint8_t SF,uint8_t BW,uint8_t CR,uint8_t ProgramedPreamble);
+HAL_StatusTypeDef rylr998_reset(rylr998_t *hrylr);
+HAL_StatusTypeDef rylr998_mode(rylr998_t *hrylr,uint8_t mode,uint32_t rxTime,uint32_t LowSpeedTime);
+HAL_StatusTypeDef rylr998_setBaudRate(rylr998_t *hrylr, uint32_t baudRate);
+HAL_StatusTypeDef rylr998_setBand(rylr998_t *hrylr, uint32_t frequency,uint8_t memory);
+HAL_StatusTypeDef rylr998_setCPIN(rylr998_t *hrylr, const char *password);
+HAL_StatusTypeDef rylr998_setCRFOP(rylr998_t *hrylr, uint8_t CRFOP);
+HAL_StatusTypeDef rylr998_FACTORY(rylr998_t *hrylr);
+uint32_t rylr998_timeOnAir(const RYLR_phy_t *phy, uint8_t data_length);
+const RYLR_phy_t *rylr998_activePhy(rylr998_t *hrylr);
 //TODO AT+UID?
 //TODO AT+VER?
 //TODO Any ? command e.g AT+ADDRESS?, using rylr998_FACTORY implementation should be straightforward
 
 
 //Rx
-RYLR_RX_command_t rylr998_prase_reciver(uint8_t *pBuff,uint8_t RX_BUFFER_SIZE);
+void rylr998_RxEventCallback(rylr998_t *hrylr, uint16_t Size);
+void rylr998_SetRxCallback(rylr998_t *hrylr, RYLR_rx_callback_t callback);
+void rylr998_SetPayloadFilter(rylr998_t *hrylr, RYLR_tx_filter_t tx, RYLR_rx_filter_t rx, uint8_t overhead, void *ctx);
+RYLR_RX_command_t rylr998_prase_reciver(rylr998_t *hrylr);
 RYLR_RX_command_t rylr998_ResponseFind(uint8_t *rxBuffer);
 
 
-void rylr998_SetInterruptFlag(void);
-uint8_t rylr998_GetInterruptFlag(void);
-void rylr998_ClearInterruptFlag(void);
+//Timeouts and retries
+void rylr998_SetTickSource(rylr998_t *hrylr, RYLR_tick_fn_t tick);
+RYLR_status_t rylr998_AwaitResponse(rylr998_t *hrylr, RYLR_RX_command_t expected, const RYLR_retry_policy_t *policy);
+const RYLR_metrics_t *rylr998_GetMetrics(rylr998_t *hrylr);
+void rylr998_ResetMetrics(rylr998_t *hrylr);
+
+//PHY profiles
+RYLR_status_t rylr998_applyProfile(rylr998_t *hrylr, const RYLR_profile_t *profile, uint32_t *latency_ms);
+
+//Duty cycle
+HAL_StatusTypeDef rylr998_SetDutyCycle(rylr998_t *hrylr, uint16_t permille, uint32_t window_ms);
+uint32_t rylr998_DutyRemaining(rylr998_t *hrylr);
+uint32_t rylr998_DutyWaitMs(rylr998_t *hrylr, uint8_t data_length);
+
+//Low power
+HAL_StatusTypeDef rylr998_EnableStopMode(rylr998_t *hrylr, RYLR_resume_fn_t resume);
+void rylr998_Idle(rylr998_t *hrylr, uint32_t max_ms);
+HAL_StatusTypeDef rylr998_EnableClockScaling(rylr998_t *hrylr, RYLR_resume_fn_t fast, uint32_t msi_range);
+void rylr998_ClockFast(rylr998_t *hrylr);
+void rylr998_ClockRelease(rylr998_t *hrylr);
+HAL_StatusTypeDef rylr998_UpdateBaudRate(rylr998_t *hrylr);
+
+//Error recovery
+HAL_StatusTypeDef rylr998_SetRecoveryPolicy(rylr998_t *hrylr, RYLR_ERR_code_t code, RYLR_recovery_t action);
+RYLR_ERR_code_t rylr998_GetLastError(rylr998_t *hrylr);
+HAL_StatusTypeDef rylr998_resync(rylr998_t *hrylr);
+
+
+void rylr998_SetInterruptFlag(rylr998_t *hrylr);
+uint8_t rylr998_GetInterruptFlag(rylr998_t *hrylr);
+void rylr998_ClearInterruptFlag(rylr998_t *hrylr);
 
 
 #endif /* INC_RYLR998_H_ */
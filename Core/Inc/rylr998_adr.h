@@ -0,0 +1,75 @@
+/*
+ * rylr998_adr.h
+ *
+ *  Adaptive data rate from the RSSI/SNR of received packets.
+ *
+ *  Every +RCV updates a smoothed SNR of its sender. The recommendation is
+ *  the SF/BW with the shortest time on air whose demodulation floor stays
+ *  RYLR_ADR_MARGIN_DB below the SNR of the weakest peer heard recently.
+ *  SNR is kept normalized to 125 kHz (+3 dB of noise per BW doubling), so
+ *  samples taken before a BW change stay usable.
+ *
+ *  Both ends of a link must use the same SF/BW: with auto apply on, the
+ *  node that changes first has to tell its peers (e.g. a gateway pushing
+ *  the new setting) or they will stop hearing each other.
+ */
+
+#ifndef INC_RYLR998_ADR_H_
+#define INC_RYLR998_ADR_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_ADR_PEERS
+#define RYLR_ADR_PEERS				4U
+#endif
+#ifndef RYLR_ADR_MARGIN_DB
+#define RYLR_ADR_MARGIN_DB			5		//dB kept above the demodulation floor
+#endif
+#ifndef RYLR_ADR_MIN_SAMPLES
+#define RYLR_ADR_MIN_SAMPLES		4U		//packets from a peer before it is trusted
+#endif
+#ifndef RYLR_ADR_MAX_AGE_MS
+#define RYLR_ADR_MAX_AGE_MS			600000U	//peers silent for longer are not considered
+#endif
+#ifndef RYLR_ADR_HOLD_MS
+#define RYLR_ADR_HOLD_MS			60000U	//minimum time between two automatic changes
+#endif
+#ifndef RYLR_ADR_REF_LENGTH
+#define RYLR_ADR_REF_LENGTH			32U		//payload used to rank the settings by time on air
+#endif
+
+
+typedef struct{
+	uint16_t id;
+	uint8_t samples;						//saturates at 255
+	int8_t rssi;							//last RSSI, dBm
+	int16_t snr_q4;							//smoothed SNR at 125 kHz, 1/16 dB
+	uint32_t last;							//tick of the last packet
+}RYLR_adr_peer_t;
+
+typedef struct{
+	uint32_t samples;
+	uint32_t changes;						//settings applied
+	uint32_t failures;						//settings the module refused or did not answer
+}RYLR_adr_stats_t;
+
+typedef struct{
+	rylr998_t *hrylr;
+	int8_t margin_db;
+	uint8_t auto_apply;
+	uint32_t last_change;
+	RYLR_adr_peer_t peer[RYLR_ADR_PEERS];
+	RYLR_adr_stats_t stats;
+}rylr998_adr_t;
+
+
+void rylr998_adrInit(rylr998_adr_t *adr, rylr998_t *hrylr, int8_t margin_db, uint8_t auto_apply);
+void rylr998_adrInput(rylr998_adr_t *adr, const RYLR_RX_data_t *packet);
+uint8_t rylr998_adrRecommend(rylr998_adr_t *adr, RYLR_phy_t *phy);
+RYLR_status_t rylr998_adrProcess(rylr998_adr_t *adr);
+const RYLR_adr_peer_t *rylr998_adrPeer(rylr998_adr_t *adr, uint16_t id);
+int16_t rylr998_adrFloorQ4(uint8_t SF);
+
+
+#endif /* INC_RYLR998_ADR_H_ */
@@ -0,0 +1,158 @@
+/*
+ * rylr998_bulk.h
+ *
+ *  Bulk transfer of images (firmware, logs) with block bitmaps.
+ *
+ *  The sender streams numbered blocks and, after every RYLR_BULK_WINDOW
+ *  blocks, polls the receiver with the highest block sent so far. The
+ *  receiver answers with the missing blocks below it as run-length
+ *  encoded ranges, so only the holes are sent again. Blocks are written
+ *  to flash a page at a time (FLASH_PAGE_SIZE) from a one page buffer,
+ *  by rylr998_bulkRxProcess: the receive callback never programs flash.
+ *  A block of the next page arriving before that is dropped and comes
+ *  back as a hole.
+ *
+ *  Pushing: the sender calls rylr998_bulkTxStart. Pulling: the receiver
+ *  sends rylr998_bulkRequest and the other side starts the transfer from
+ *  its request callback.
+ *
+ *  START:   [RYLR_BULK_START][xfer][size, 4 bytes LE]
+ *  BLOCK:   [RYLR_BULK_BLOCK][xfer][index L][index H][data...]
+ *  POLL:    [RYLR_BULK_POLL][xfer][high L][high H]
+ *  STATUS:  [RYLR_BULK_STATUS][xfer][complete][(first L, first H, count) ...]
+ *  REQUEST: [RYLR_BULK_REQUEST][xfer]
+ */
+
+#ifndef INC_RYLR998_BULK_H_
+#define INC_RYLR998_BULK_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_BULK_BLOCK_SIZE
+#define RYLR_BULK_BLOCK_SIZE		64U		//bytes per block, a multiple of 4 dividing FLASH_PAGE_SIZE
+#endif
+#ifndef RYLR_BULK_BLOCKS_MAX
+#define RYLR_BULK_BLOCKS_MAX		256U	//16 KB with 64 byte blocks
+#endif
+#ifndef RYLR_BULK_WINDOW
+#define RYLR_BULK_WINDOW			16U		//blocks between two polls
+#endif
+#ifndef RYLR_BULK_STATUS_RUNS
+#define RYLR_BULK_STATUS_RUNS		16U		//missing ranges per STATUS
+#endif
+#ifndef RYLR_BULK_POLL_TIMEOUT_MS
+#define RYLR_BULK_POLL_TIMEOUT_MS	3000U	//STATUS wait, the first one covers the flash erase
+#endif
+#ifndef RYLR_BULK_MAX_POLLS
+#define RYLR_BULK_MAX_POLLS			5U		//unanswered polls before giving up
+#endif
+#ifndef RYLR_BULK_TURNAROUND_MS
+#define RYLR_BULK_TURNAROUND_MS		30U
+#endif
+
+#if (RYLR_BULK_BLOCK_SIZE % 4U) != 0 || (FLASH_PAGE_SIZE % RYLR_BULK_BLOCK_SIZE) != 0 || \
+	(FLASH_PAGE_SIZE / RYLR_BULK_BLOCK_SIZE) > 8U
+#error "RYLR_BULK_BLOCK_SIZE must be a multiple of 4 dividing FLASH_PAGE_SIZE, at most 8 blocks per page"
+#endif
+
+#define RYLR_BULK_START				0xE1U
+#define RYLR_BULK_BLOCK				0xE2U
+#define RYLR_BULK_POLL				0xE3U
+#define RYLR_BULK_STATUS			0xE4U
+#define RYLR_BULK_REQUEST			0xE5U
+#define RYLR_BULK_BLOCK_HEADER		4U
+
+
+typedef enum
+{
+	RYLR_BULK_IDLE = 0x00U,
+	RYLR_BULK_SEND_START,
+	RYLR_BULK_STREAM,
+	RYLR_BULK_SEND_POLL,
+	RYLR_BULK_WAIT_STATUS,
+	RYLR_BULK_DONE,
+	RYLR_BULK_FAILED
+
+} RYLR_bulk_state_t;
+
+typedef struct rylr998_bulk_tx_s rylr998_bulk_tx_t;
+typedef struct rylr998_bulk_rx_s rylr998_bulk_rx_t;
+
+typedef void (*RYLR_bulk_request_t)(rylr998_bulk_tx_t *tx, uint16_t peer, uint8_t xfer);
+typedef void (*RYLR_bulk_done_t)(rylr998_bulk_rx_t *rx, uint8_t xfer, uint32_t size);
+
+typedef struct{
+	uint32_t blocks_sent;						//first transmissions
+	uint32_t retransmissions;
+	uint32_t polls;
+	uint32_t elapsed_ms;						//START to the complete STATUS
+}RYLR_bulk_tx_stats_t;
+
+struct rylr998_bulk_tx_s{
+	rylr998_t *hrylr;
+	RYLR_bulk_state_t state;
+	uint16_t peer;
+	uint8_t xfer;
+	const uint8_t *image;
+	uint32_t size;
+	uint16_t blocks;
+	uint16_t high;								//blocks below were sent at least once
+	uint8_t since_poll;
+	uint8_t polls_left;
+	uint32_t deadline;
+	uint32_t radio_free;
+	uint32_t start;
+	uint8_t pending[RYLR_BULK_BLOCKS_MAX / 8U];	//bit set: block to (re)send
+	RYLR_bulk_request_t request;
+	RYLR_bulk_tx_stats_t stats;
+};
+
+typedef struct{
+	uint32_t blocks;							//new blocks received
+	uint32_t duplicates;
+	uint32_t deferred;							//dropped while the page buffer waited for flash
+	uint32_t page_writes;
+	uint32_t flash_errors;
+	uint32_t status_sent;
+}RYLR_bulk_rx_stats_t;
+
+struct rylr998_bulk_rx_s{
+	rylr998_t *hrylr;
+	uint16_t peer;
+	uint8_t xfer;
+	uint8_t active;
+	uint8_t erase_pending;
+	uint8_t flush_pending;						//page buffer to program from rylr998_bulkRxProcess
+	uint8_t reply_pending;
+	uint8_t complete;
+	uint32_t base;								//flash address of the image, page aligned
+	uint32_t capacity;
+	uint32_t size;
+	uint16_t blocks;
+	uint16_t poll_high;
+	uint8_t got[RYLR_BULK_BLOCKS_MAX / 8U];
+	int16_t page;								//page in the buffer, -1 if none
+	uint8_t page_mask;							//blocks of the page in the buffer
+	uint8_t page_buff[FLASH_PAGE_SIZE];
+	RYLR_bulk_done_t done;
+	RYLR_bulk_rx_stats_t stats;
+};
+
+
+//Sender
+void rylr998_bulkTxInit(rylr998_bulk_tx_t *tx, rylr998_t *hrylr, RYLR_bulk_request_t request);
+HAL_StatusTypeDef rylr998_bulkTxStart(rylr998_bulk_tx_t *tx, uint16_t peer, uint8_t xfer, const uint8_t *image, uint32_t size);
+uint8_t rylr998_bulkTxInput(rylr998_bulk_tx_t *tx, const RYLR_RX_data_t *packet);
+void rylr998_bulkTxProcess(rylr998_bulk_tx_t *tx);
+uint32_t rylr998_bulkEstimateMs(const RYLR_phy_t *phy, uint32_t size);
+
+//Receiver
+void rylr998_bulkRxInit(rylr998_bulk_rx_t *rx, rylr998_t *hrylr, uint16_t peer, uint32_t base, uint32_t capacity,
+						RYLR_bulk_done_t done);
+HAL_StatusTypeDef rylr998_bulkRequest(rylr998_bulk_rx_t *rx, uint8_t xfer);
+uint8_t rylr998_bulkRxInput(rylr998_bulk_rx_t *rx, const RYLR_RX_data_t *packet);
+void rylr998_bulkRxProcess(rylr998_bulk_rx_t *rx);
+
+
+#endif /* INC_RYLR998_BULK_H_ */
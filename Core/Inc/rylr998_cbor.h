@@ -0,0 +1,87 @@
+/*
+ * rylr998_cbor.h
+ *
+ *  Compact payload encoding, a subset of CBOR (RFC 8949).
+ *
+ *  Supported: unsigned and negative integers up to 32 bits, single and
+ *  half precision floats (a float is sent as half when that is exact),
+ *  byte and text strings, arrays and maps of definite length, false,
+ *  true and null. Indefinite lengths, tags, 64 bit integers and doubles
+ *  are not, the decoder reports them as RYLR_CBOR_ERROR.
+ *
+ *  The encoder writes into the caller's frame buffer, the one passed to
+ *  rylr998_sendData. The decoder pulls one item at a time out of the
+ *  received packet, strings point into it, nothing is copied.
+ *
+ *  Every encoder also counts the length of the same items written as the
+ *  "key=value," text the application sent before (integers in decimal,
+ *  floats with 2 decimals, strings as hex), for comparison with the
+ *  CBOR length.
+ */
+
+#ifndef INC_RYLR998_CBOR_H_
+#define INC_RYLR998_CBOR_H_
+
+#include "rylr998.h"
+
+
+typedef enum
+{
+	RYLR_CBOR_UINT = 0x00U,
+	RYLR_CBOR_NEGINT,
+	RYLR_CBOR_BYTES,
+	RYLR_CBOR_TEXT,
+	RYLR_CBOR_ARRAY,						//count: number of items that follow
+	RYLR_CBOR_MAP,							//count: number of key/value pairs that follow
+	RYLR_CBOR_FLOAT,
+	RYLR_CBOR_SIMPLE,						//u: 20 false, 21 true, 22 null
+	RYLR_CBOR_END,							//no more data
+	RYLR_CBOR_ERROR							//truncated or unsupported
+
+} RYLR_cbor_type_t;
+
+typedef struct{
+	RYLR_cbor_type_t type;
+	union{
+		uint32_t u;							//UINT, SIMPLE, ARRAY and MAP count
+		int32_t i;							//NEGINT
+		float f;							//FLOAT
+		struct{
+			const uint8_t *ptr;				//into the decoded buffer
+			uint8_t length;
+		}str;								//BYTES, TEXT
+	};
+}RYLR_cbor_item_t;
+
+typedef struct{
+	uint8_t *buffer;
+	uint8_t size;
+	uint8_t length;							//bytes written
+	uint8_t overflow;						//an item did not fit, the message is unusable
+	uint16_t ascii_length;					//the same items as "key=value," text
+}RYLR_cbor_enc_t;
+
+typedef struct{
+	const uint8_t *buffer;
+	uint8_t length;
+	uint8_t pos;
+}RYLR_cbor_dec_t;
+
+
+void rylr998_cborEncInit(RYLR_cbor_enc_t *enc, uint8_t *buffer, uint8_t size);
+void rylr998_cborPutUint(RYLR_cbor_enc_t *enc, uint32_t value);
+void rylr998_cborPutInt(RYLR_cbor_enc_t *enc, int32_t value);
+void rylr998_cborPutFloat(RYLR_cbor_enc_t *enc, float value);
+void rylr998_cborPutBytes(RYLR_cbor_enc_t *enc, const uint8_t *data, uint8_t length);
+void rylr998_cborPutText(RYLR_cbor_enc_t *enc, const char *text);
+void rylr998_cborPutBool(RYLR_cbor_enc_t *enc, uint8_t value);
+void rylr998_cborPutArray(RYLR_cbor_enc_t *enc, uint8_t count);
+void rylr998_cborPutMap(RYLR_cbor_enc_t *enc, uint8_t pairs);
+HAL_StatusTypeDef rylr998_cborEncEnd(RYLR_cbor_enc_t *enc, uint8_t *length);
+
+void rylr998_cborDecInit(RYLR_cbor_dec_t *dec, const uint8_t *buffer, uint8_t length);
+RYLR_cbor_type_t rylr998_cborNext(RYLR_cbor_dec_t *dec, RYLR_cbor_item_t *item);
+HAL_StatusTypeDef rylr998_cborFind(const uint8_t *buffer, uint8_t length, uint32_t key, RYLR_cbor_item_t *item);
+
+
+#endif /* INC_RYLR998_CBOR_H_ */
@@ -0,0 +1,78 @@
+/*
+ * rylr998_cfg.h
+ *
+ *  Compile-time checked RYLR998 configuration.
+ *
+ *  RYLR_CFG_DEFINE rejects invalid combinations with _Static_assert and
+ *  encodes the whole boot command sequence as one string in flash, so
+ *  rylr998_configStatic only has to send it and wait for the answers.
+ *  Every argument must be a literal (or a macro expanding to one), the
+ *  values are stringified into the commands.
+ *
+ *  RYLR_CFG_DEFINE(lora_cfg,
+ *                  18,          NETWORKID  3-15 or 18
+ *                  1,           ADDRESS    0-65535
+ *                  9, 7, 1, 12, SF, BW, CR, preamble
+ *                  0,           MODE       0 (transceiver) or 1 (sleep)
+ *                  115200,      IPR        1200-115200
+ *                  915000000,   BAND       862000000-1020000000
+ *                  1,           1: save the band in the module flash
+ *                  "FFFFFFFF",  CPIN       8 hex chars
+ *                  22);         CRFOP      0-22, 0-14 with RYLR_CE_COMPLIANCE
+ */
+
+#ifndef INC_RYLR998_CFG_H_
+#define INC_RYLR998_CFG_H_
+
+#include "rylr998.h"
+
+
+#define RYLR_CFG_STR_(x)			#x
+#define RYLR_CFG_STR(x)				RYLR_CFG_STR_(x)
+
+#define RYLR_CFG_BAND_MEM_0			""
+#define RYLR_CFG_BAND_MEM_1			",M"
+#define RYLR_CFG_BAND_MEM_(m)		RYLR_CFG_BAND_MEM_##m
+#define RYLR_CFG_BAND_MEM(m)		RYLR_CFG_BAND_MEM_(m)
+
+#ifdef RYLR_CE_COMPLIANCE
+#define RYLR_CFG_CRFOP_MAX			14		//CE certification
+#else
+#define RYLR_CFG_CRFOP_MAX			22
+#endif
+
+
+#define RYLR_CFG_DEFINE(name, NETWORKID, ADDRESS, SF, BW, CR, PREAMBLE, MODE, IPR, BAND, BAND_MEM, CPIN, CRFOP)		\
+	_Static_assert(((NETWORKID) >= 3 && (NETWORKID) <= 15) || (NETWORKID) == 18,										\
+				   #name ": NETWORKID must be 3-15 or 18");																\
+	_Static_assert((ADDRESS) >= 0 && (ADDRESS) <= 65535, #name ": ADDRESS must be 0-65535");								\
+	_Static_assert((BW) >= 7 && (BW) <= 9, #name ": BW must be 7 (125 kHz), 8 (250 kHz) or 9 (500 kHz)");				\
+	_Static_assert((SF) >= 7 && (SF) <= (BW) + 2, #name ": SF7-SF9 at 125 kHz, SF7-SF10 at 250 kHz, SF7-SF11 at 500 kHz");	\
+	_Static_assert((CR) >= 1 && (CR) <= 4, #name ": CR must be 1-4");													\
+	_Static_assert((NETWORKID) == 18 ? ((PREAMBLE) >= 4 && (PREAMBLE) <= 24) : (PREAMBLE) == 12,							\
+				   #name ": preamble must be 4-24 with NETWORKID 18, 12 otherwise");										\
+	_Static_assert((MODE) == 0 || (MODE) == 1, #name ": MODE 2 needs its times, use rylr998_mode");						\
+	_Static_assert((IPR) >= 1200 && (IPR) <= 115200, #name ": IPR must be 1200-115200");									\
+	_Static_assert((BAND) >= 862000000 && (BAND) <= 1020000000, #name ": BAND must be 862-1020 MHz");						\
+	_Static_assert((BAND_MEM) == 0 || (BAND_MEM) == 1, #name ": BAND_MEM must be 0 or 1");								\
+	_Static_assert(sizeof(CPIN) == 9, #name ": CPIN must be 8 characters");												\
+	_Static_assert((CRFOP) >= 0 && (CRFOP) <= RYLR_CFG_CRFOP_MAX, #name ": CRFOP above the allowed output power");		\
+	static const char name##_commands[] =																				\
+		"AT+FACTORY\r\n"																								\
+		"AT+NETWORKID=" RYLR_CFG_STR(NETWORKID) "\r\n"																	\
+		"AT+ADDRESS=" RYLR_CFG_STR(ADDRESS) "\r\n"																		\
+		"AT+PARAMETER=" RYLR_CFG_STR(SF) "," RYLR_CFG_STR(BW) "," RYLR_CFG_STR(CR) "," RYLR_CFG_STR(PREAMBLE) "\r\n"	\
+		"AT+MODE=" RYLR_CFG_STR(MODE) "\r\n"																			\
+		"AT+IPR=" RYLR_CFG_STR(IPR) "\r\n"																				\
+		"AT+BAND=" RYLR_CFG_STR(BAND) RYLR_CFG_BAND_MEM(BAND_MEM) "\r\n"												\
+		"AT+CPIN=" CPIN "\r\n"																							\
+		"AT+CRFOP=" RYLR_CFG_STR(CRFOP) "\r\n";																			\
+	static const RYLR_static_config_t name = {																			\
+		.commands = name##_commands,																					\
+		.length = sizeof(name##_commands) - 1,																			\
+		.phy = { (SF), (BW), (CR), (PREAMBLE), (CRFOP) },	/* RYLR_phy_t order */									\
+		.mode = (MODE),																							\
+	}
+
+
+#endif /* INC_RYLR998_CFG_H_ */
@@ -0,0 +1,58 @@
+/*
+ * rylr998_dedup.h
+ *
+ *  Duplicate suppression for received packets.
+ *
+ *  A direct mapped table keyed by the +RCV address and a sequence number
+ *  carried in the payload. Lookup and insert are one hash and one compare,
+ *  RAM is RYLR_DEDUP_ENTRIES * 8 bytes. Entries older than max_age_ms are
+ *  ignored, so a sender restarting its sequence is not dropped forever.
+ *  A collision evicts the older entry: a duplicate may get through, a new
+ *  packet is never dropped.
+ */
+
+#ifndef INC_RYLR998_DEDUP_H_
+#define INC_RYLR998_DEDUP_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_DEDUP_ENTRIES
+#define RYLR_DEDUP_ENTRIES			16U		//power of 2
+#endif
+#if (RYLR_DEDUP_ENTRIES & (RYLR_DEDUP_ENTRIES - 1U)) != 0
+#error "RYLR_DEDUP_ENTRIES must be a power of 2"
+#endif
+#ifndef RYLR_DEDUP_MAX_AGE_MS
+#define RYLR_DEDUP_MAX_AGE_MS		30000U
+#endif
+
+
+typedef struct{
+	uint16_t id;
+	uint8_t seq;
+	uint8_t valid;
+	uint32_t stamp;							//tick of the first reception
+}RYLR_dedup_entry_t;
+
+typedef struct{
+	uint32_t lookups;
+	uint32_t hits;							//duplicates dropped, hit rate = hits / lookups
+	uint32_t evictions;						//live entries overwritten by a collision
+}RYLR_dedup_stats_t;
+
+typedef struct{
+	RYLR_tick_fn_t tick;
+	uint32_t max_age_ms;
+	RYLR_dedup_entry_t entry[RYLR_DEDUP_ENTRIES];
+	RYLR_dedup_stats_t stats;
+}rylr998_dedup_t;
+
+
+void rylr998_dedupInit(rylr998_dedup_t *dedup, RYLR_tick_fn_t tick, uint32_t max_age_ms);
+uint8_t rylr998_dedupCheck(rylr998_dedup_t *dedup, uint16_t id, uint8_t seq);
+void rylr998_dedupClear(rylr998_dedup_t *dedup);
+uint8_t rylr998_dedupHitRate(const rylr998_dedup_t *dedup);
+
+
+#endif /* INC_RYLR998_DEDUP_H_ */
@@ -0,0 +1,67 @@
+/*
+ * rylr998_energy.h
+ *
+ *  Charge drawn by the module and the MCU, accumulated per state.
+ *
+ *  TX:    time on air of every rylr998_sendData frame times the TX current
+ *         at the CRFOP in use (RYLR_ENERGY_TX_TABLE, 0 to 22 dBm).
+ *  RX:    the rest of the time at the receive current in AT+MODE=0, the
+ *         windows of AT+MODE=2, and the frames received while sleeping
+ *         between them (rylr998_energyInput).
+ *  Sleep: AT+MODE=1, and the sleep part of AT+MODE=2.
+ *  MCU:   time in Stop (handle stop_ms) at RYLR_ENERGY_I_MCU_STOP_UA, the
+ *         rest at RYLR_ENERGY_I_MCU_RUN_UA (Sleep mode counts as run).
+ *
+ *  Counters are uAh plus a remainder in nAs, nothing 64 bit. The model
+ *  currents come from the datasheets, measure them on the board and
+ *  override the macros for real budgets.
+ */
+
+#ifndef INC_RYLR998_ENERGY_H_
+#define INC_RYLR998_ENERGY_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_ENERGY_I_MCU_RUN_UA
+#define RYLR_ENERGY_I_MCU_RUN_UA	6000U	//STM32L031 at 32 MHz, range 1
+#endif
+#ifndef RYLR_ENERGY_I_MCU_STOP_UA
+#define RYLR_ENERGY_I_MCU_STOP_UA	1U		//Stop with LSI and LPTIM1 running
+#endif
+#ifndef RYLR_ENERGY_TX_TABLE
+//TX current in mA at 0, 2, 4 ... 22 dBm, interpolated in between
+#define RYLR_ENERGY_TX_TABLE		{ 24, 26, 28, 30, 32, 36, 40, 50, 65, 85, 110, 140 }
+#endif
+
+#define RYLR_ENERGY_NAS_PER_UAH		3600000UL
+
+
+typedef struct{
+	uint32_t uah;
+	uint32_t nas;							//remainder, below one uAh
+}RYLR_charge_t;
+
+typedef struct{
+	rylr998_t *hrylr;
+	uint32_t last_tick;
+	uint32_t last_air_us;					//hrylr->tx_air_us already charged
+	uint32_t last_stop_ms;					//hrylr->stop.stop_ms already charged
+	RYLR_charge_t tx;
+	RYLR_charge_t rx;
+	RYLR_charge_t sleep;
+	RYLR_charge_t mcu;
+}rylr998_energy_t;
+
+
+void rylr998_energyInit(rylr998_energy_t *en, rylr998_t *hrylr);
+void rylr998_energyInput(rylr998_energy_t *en, const RYLR_RX_data_t *packet);
+void rylr998_energyProcess(rylr998_energy_t *en);
+uint32_t rylr998_energyTotalUah(const rylr998_energy_t *en);
+uint32_t rylr998_energyTxCurrent(uint8_t crfop);
+uint32_t rylr998_energyModuleCurrent(rylr998_t *hrylr);
+uint32_t rylr998_energyFrameCost(rylr998_t *hrylr, uint8_t data_length);
+uint32_t rylr998_energyAverageUa(rylr998_t *hrylr, uint8_t data_length, uint32_t period_ms);
+
+
+#endif /* INC_RYLR998_ENERGY_H_ */
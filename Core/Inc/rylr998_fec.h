@@ -0,0 +1,73 @@
+/*
+ * rylr998_fec.h
+ *
+ *  Erasure coding of fragment groups (systematic Reed-Solomon, Cauchy matrix over GF(2^8)).
+ *
+ *  A group is k data fragments of the same length followed by m parity
+ *  fragments. Any k of the k+m fragments rebuild the group, so up to m
+ *  losses per group are repaired without a request to the sender.
+ *  Arithmetic is bitwise (no log tables): nothing in flash or RAM beyond
+ *  the receive buffer, a few hundred cycles per byte and parity row.
+ *
+ *  FRAME: [RYLR_FEC_FRAME][group][index][k][m][fragment...]
+ *         index < k: data fragment, index >= k: parity row index - k
+ */
+
+#ifndef INC_RYLR998_FEC_H_
+#define INC_RYLR998_FEC_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_FEC_K_MAX
+#define RYLR_FEC_K_MAX				8U		//data fragments per group
+#endif
+#ifndef RYLR_FEC_M_MAX
+#define RYLR_FEC_M_MAX				4U		//parity fragments per group
+#endif
+#ifndef RYLR_FEC_FRAGMENT_MAX
+#define RYLR_FEC_FRAGMENT_MAX		32U		//bytes per fragment
+#endif
+#if RYLR_FEC_K_MAX + RYLR_FEC_M_MAX > 16
+#error "RYLR_FEC_K_MAX + RYLR_FEC_M_MAX is limited by the 16 bit fragment mask"
+#endif
+
+#define RYLR_FEC_FRAME				0xD1U
+#define RYLR_FEC_HEADER_SIZE		5U
+
+
+typedef struct rylr998_fec_rx_s rylr998_fec_rx_t;
+
+typedef void (*RYLR_fec_deliver_t)(rylr998_fec_rx_t *rx, uint8_t group, const uint8_t *data, uint8_t k, uint8_t length);
+
+typedef struct{
+	uint32_t groups;						//delivered complete
+	uint32_t groups_repaired;				//of which needed parity
+	uint32_t groups_lost;					//fewer than k fragments received
+	uint32_t fragments_rebuilt;
+}RYLR_fec_stats_t;
+
+struct rylr998_fec_rx_s{
+	uint16_t peer;
+	uint8_t group;
+	uint8_t k;
+	uint8_t m;
+	uint8_t length;
+	uint8_t active;							//a group is being collected
+	uint8_t done;							//the group was delivered, ignore the rest of it
+	uint16_t have;							//bit i: fragment i received
+	uint8_t data[RYLR_FEC_K_MAX * RYLR_FEC_FRAGMENT_MAX];		//data fragments, in order
+	uint8_t parity[RYLR_FEC_M_MAX * RYLR_FEC_FRAGMENT_MAX];
+	RYLR_fec_deliver_t deliver;
+	RYLR_fec_stats_t stats;
+};
+
+
+void rylr998_fecEncode(const uint8_t *data, uint8_t k, uint8_t length, uint8_t row, uint8_t *parity);
+HAL_StatusTypeDef rylr998_fecSendGroup(rylr998_t *hrylr, uint16_t dest, uint8_t group,
+									   const uint8_t *data, uint8_t k, uint8_t m, uint8_t length);
+void rylr998_fecInit(rylr998_fec_rx_t *rx, uint16_t peer, RYLR_fec_deliver_t deliver);
+uint8_t rylr998_fecInput(rylr998_fec_rx_t *rx, const RYLR_RX_data_t *packet);
+
+
+#endif /* INC_RYLR998_FEC_H_ */
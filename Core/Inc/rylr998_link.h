@@ -0,0 +1,67 @@
+/*
+ * rylr998_link.h
+ *
+ *  Per-peer link quality table.
+ *
+ *  Open addressing hash on the 16 bit +RCV address with linear probing
+ *  limited to RYLR_LINK_PROBE slots, so every update and lookup costs at
+ *  most RYLR_LINK_PROBE compares. Entries are never removed, only
+ *  replaced: when the probe window is full the peer heard least recently
+ *  in it gives its place to the new one.
+ *
+ *  RSSI and SNR are averaged with a 1/8 weight in 1/16 dB. The delivery
+ *  ratio (255 = 100%) is averaged the same way, from the gaps of an in-band
+ *  sequence number (rylr998_linkSeq) and from the ACK outcome of the
+ *  frames sent to the peer (rylr998_linkTxResult).
+ */
+
+#ifndef INC_RYLR998_LINK_H_
+#define INC_RYLR998_LINK_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_LINK_CAPACITY
+#define RYLR_LINK_CAPACITY			8U		//power of 2, up to 256
+#endif
+#if (RYLR_LINK_CAPACITY & (RYLR_LINK_CAPACITY - 1U)) != 0 || RYLR_LINK_CAPACITY > 256
+#error "RYLR_LINK_CAPACITY must be a power of 2 up to 256"
+#endif
+#ifndef RYLR_LINK_PROBE
+#define RYLR_LINK_PROBE				4U		//slots probed from the hash
+#endif
+#ifndef RYLR_LINK_MAX_GAP
+#define RYLR_LINK_MAX_GAP			16U		//lost frames counted into the delivery ratio per gap
+#endif
+
+
+typedef struct{
+	uint16_t address;
+	uint8_t used;
+	uint8_t pdr;							//delivery ratio, 255 = 100%
+	int16_t rssi_q4;						//averaged RSSI, 1/16 dBm
+	int16_t snr_q4;							//averaged SNR, 1/16 dB
+	uint8_t last_seq;
+	uint8_t seq_valid;
+	uint32_t last_seen;						//tick of the last frame
+	uint32_t rx_frames;
+	uint32_t rx_lost;						//sequence gaps
+	uint32_t tx_frames;
+	uint32_t tx_acked;
+}RYLR_link_entry_t;
+
+typedef struct{
+	RYLR_tick_fn_t tick;
+	RYLR_link_entry_t entry[RYLR_LINK_CAPACITY];
+	uint32_t evictions;
+}rylr998_link_t;
+
+
+void rylr998_linkInit(rylr998_link_t *links, RYLR_tick_fn_t tick);
+RYLR_link_entry_t *rylr998_linkInput(rylr998_link_t *links, const RYLR_RX_data_t *packet);
+void rylr998_linkSeq(rylr998_link_t *links, uint16_t address, uint8_t seq);
+void rylr998_linkTxResult(rylr998_link_t *links, uint16_t address, uint8_t acked);
+const RYLR_link_entry_t *rylr998_linkFind(const rylr998_link_t *links, uint16_t address);
+
+
+#endif /* INC_RYLR998_LINK_H_ */
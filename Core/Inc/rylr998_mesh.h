@@ -0,0 +1,109 @@
+/*
+ * rylr998_mesh.h
+ *
+ *  Multi-hop forwarding toward a gateway.
+ *
+ *  Every mesh frame advertises the sender's cost to the gateway. A node
+ *  adds the cost of the link it heard the frame on (from the SNR of the
+ *  +RCV) and keeps the neighbor with the lowest total as its parent.
+ *  Frames for a neighbor go straight to it, anything else goes to the
+ *  parent. The gateway advertises 0; nodes without traffic to send keep
+ *  the routes alive with broadcast hellos every RYLR_MESH_HELLO_MS.
+ *
+ *  Frames carry a hop limit and (origin, seq) for duplicate suppression.
+ *  Forwarded frames wait in a small queue of their own and go out from
+ *  rylr998_meshProcess, so they never hold up rylr998_meshSend.
+ *
+ *  FRAME: [RYLR_MESH_FRAME][ttl][seq][origin L][origin H][dest L][dest H][cost][payload...]
+ */
+
+#ifndef INC_RYLR998_MESH_H_
+#define INC_RYLR998_MESH_H_
+
+#include "rylr998.h"
+#include "rylr998_dedup.h"
+
+
+#ifndef RYLR_MESH_NEIGHBORS
+#define RYLR_MESH_NEIGHBORS			4U
+#endif
+#ifndef RYLR_MESH_FWD_DEPTH
+#define RYLR_MESH_FWD_DEPTH			2U		//frames waiting to be forwarded
+#endif
+#ifndef RYLR_MESH_PAYLOAD_MAX
+#define RYLR_MESH_PAYLOAD_MAX		48U
+#endif
+#ifndef RYLR_MESH_TTL
+#define RYLR_MESH_TTL				4U		//hops a frame may take
+#endif
+#ifndef RYLR_MESH_ROUTE_AGE_MS
+#define RYLR_MESH_ROUTE_AGE_MS		300000U	//neighbors not heard for longer are not used
+#endif
+#ifndef RYLR_MESH_HELLO_MS
+#define RYLR_MESH_HELLO_MS			60000U	//0 to disable the hellos
+#endif
+#ifndef RYLR_MESH_GOOD_SNR
+#define RYLR_MESH_GOOD_SNR			10		//dB, links at or above cost 1
+#endif
+
+#define RYLR_MESH_FRAME				0xC1U
+#define RYLR_MESH_HEADER_SIZE		8U
+#define RYLR_MESH_NO_ROUTE			0xFFU
+
+
+typedef struct rylr998_mesh_s rylr998_mesh_t;
+
+typedef void (*RYLR_mesh_deliver_t)(rylr998_mesh_t *mesh, uint16_t origin, const uint8_t *data, uint8_t length);
+
+typedef struct{
+	uint16_t address;
+	uint8_t link_cost;						//1 + dB of SNR below RYLR_MESH_GOOD_SNR
+	uint8_t cost;							//to the gateway through this neighbor
+	uint32_t last;							//tick of the last frame heard
+}RYLR_mesh_neighbor_t;
+
+typedef struct{
+	uint16_t next_hop;
+	uint8_t length;
+	uint8_t frame[RYLR_MESH_HEADER_SIZE + RYLR_MESH_PAYLOAD_MAX];
+}RYLR_mesh_fwd_t;
+
+typedef struct{
+	uint32_t sent;							//own frames
+	uint32_t delivered;						//frames for this node
+	uint32_t forwarded;
+	uint32_t duplicates;
+	uint32_t ttl_expired;
+	uint32_t no_route;
+	uint32_t queue_full;					//frames to forward dropped
+}RYLR_mesh_stats_t;
+
+struct rylr998_mesh_s{
+	rylr998_t *hrylr;
+	uint16_t address;
+	uint16_t gateway;
+	uint8_t seq;
+	uint32_t radio_free;					//tick when the last frame left the air
+	uint32_t last_hello;
+
+	RYLR_mesh_neighbor_t neighbor[RYLR_MESH_NEIGHBORS];
+	RYLR_mesh_fwd_t fwd[RYLR_MESH_FWD_DEPTH];
+	uint8_t fwd_head;
+	uint8_t fwd_count;
+	rylr998_dedup_t dedup;
+
+	RYLR_mesh_deliver_t deliver;
+	RYLR_mesh_stats_t stats;
+};
+
+
+void rylr998_meshInit(rylr998_mesh_t *mesh, rylr998_t *hrylr, uint16_t address, uint16_t gateway,
+					  RYLR_mesh_deliver_t deliver);
+HAL_StatusTypeDef rylr998_meshSend(rylr998_mesh_t *mesh, uint16_t dest, const uint8_t *data, uint8_t length);
+uint8_t rylr998_meshInput(rylr998_mesh_t *mesh, const RYLR_RX_data_t *packet);
+void rylr998_meshProcess(rylr998_mesh_t *mesh);
+uint8_t rylr998_meshCost(rylr998_mesh_t *mesh);
+const RYLR_mesh_neighbor_t *rylr998_meshParent(rylr998_mesh_t *mesh);
+
+
+#endif /* INC_RYLR998_MESH_H_ */
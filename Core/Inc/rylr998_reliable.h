@@ -0,0 +1,126 @@
+/*
+ * rylr998_reliable.h
+ *
+ *  Reliable delivery on top of rylr998_sendData and the +RCV parser.
+ *
+ *  Frames carry an 8 bit sequence number. The receiver answers with a
+ *  cumulative ACK (next sequence expected) plus a bitmap of the frames
+ *  received beyond it, so the sender only retransmits the holes. Up to
+ *  `window` frames are in flight at once. Retransmission timers are
+ *  derived from the time on air of the data and ACK frames.
+ *
+ *  Frames are delivered once each as they arrive, not reordered, which
+ *  keeps the receiver free of buffers: bulk data has to carry its own
+ *  offset (or use the sequence number given to the deliver callback).
+ *
+ *  Every DATA frame also carries the sender's window base: a frame dropped
+ *  after RYLR_REL_MAX_RETRIES is skipped by the receiver instead of being
+ *  waited for forever.
+ *
+ *  The ACK also echoes the SNR of the last DATA frame, which the sender
+ *  can feed to its transmit power control (rylr998_relSetFeedback).
+ *
+ *  DATA: [RYLR_REL_DATA][seq][oldest seq not acknowledged or dropped][payload...]
+ *  ACK:  [RYLR_REL_ACK][next expected seq][bit i: seq next+1+i received][SNR, dB]
+ */
+
+#ifndef INC_RYLR998_RELIABLE_H_
+#define INC_RYLR998_RELIABLE_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_REL_WINDOW_MAX
+#define RYLR_REL_WINDOW_MAX			8U		//frames in flight, the SACK bitmap covers 8
+#endif
+#if RYLR_REL_WINDOW_MAX > 8
+#error "RYLR_REL_WINDOW_MAX is limited by the 8 bit SACK bitmap"
+#endif
+#ifndef RYLR_REL_PAYLOAD_MAX
+#define RYLR_REL_PAYLOAD_MAX		64U		//bytes per frame kept for retransmission (max 237)
+#endif
+#ifndef RYLR_REL_TURNAROUND_MS
+#define RYLR_REL_TURNAROUND_MS		30U		//AT+SEND over the UART plus the module switching to TX
+#endif
+#ifndef RYLR_REL_MAX_RETRIES
+#define RYLR_REL_MAX_RETRIES		5U
+#endif
+
+#define RYLR_REL_DATA				0xA1U
+#define RYLR_REL_ACK				0xA2U
+#define RYLR_REL_HEADER_SIZE		3U
+#define RYLR_REL_ACK_SIZE			4U
+#define RYLR_REL_ACK_MIN_SIZE		3U		//ACK without the SNR
+
+
+typedef struct rylr998_rel_s rylr998_rel_t;
+
+typedef void (*RYLR_rel_deliver_t)(rylr998_rel_t *rel, uint8_t seq, const uint8_t *data, uint8_t length);
+typedef void (*RYLR_rel_sent_t)(rylr998_rel_t *rel, uint8_t seq, uint8_t acked);	//acked=0: retries exhausted
+typedef void (*RYLR_rel_feedback_t)(rylr998_rel_t *rel, int8_t snr);				//SNR the peer measured
+
+typedef enum
+{
+	RYLR_REL_SLOT_FREE = 0x00U,
+	RYLR_REL_SLOT_QUEUED,						//waiting for its first transmission
+	RYLR_REL_SLOT_INFLIGHT						//sent, waiting for the ACK
+
+} RYLR_rel_slot_state_t;
+
+typedef struct{
+	RYLR_rel_slot_state_t state;
+	uint8_t length;
+	uint8_t retries;
+	uint32_t deadline;							//tick of the retransmission
+	uint8_t data[RYLR_REL_PAYLOAD_MAX];
+}RYLR_rel_slot_t;
+
+typedef struct{
+	uint32_t frames_sent;						//first transmissions
+	uint32_t retransmissions;
+	uint32_t frames_acked;
+	uint32_t bytes_acked;						//payload bytes, goodput = bytes_acked / elapsed time
+	uint32_t frames_failed;						//retries exhausted
+	uint32_t frames_delivered;					//received and passed to the application
+	uint32_t duplicates;						//received again, only re-acknowledged
+	uint32_t frames_skipped;					//dropped by the sender, never delivered
+	uint32_t acks_sent;
+	uint32_t acks_received;
+}RYLR_rel_stats_t;
+
+struct rylr998_rel_s{
+	rylr998_t *hrylr;
+	uint16_t peer;
+	uint8_t window;								//1..RYLR_REL_WINDOW_MAX
+	uint8_t max_retries;
+
+	// Sender
+	uint8_t snd_una;							//oldest sequence not acknowledged
+	uint8_t snd_nxt;							//sequence of the next frame queued
+	RYLR_rel_slot_t slot[RYLR_REL_WINDOW_MAX];	//indexed by seq % RYLR_REL_WINDOW_MAX
+	uint32_t radio_free;						//tick when the last frame left the air
+
+	// Receiver
+	uint8_t rcv_nxt;							//next sequence expected in order
+	uint8_t rcv_mask;							//bit i: rcv_nxt + i already received
+	uint8_t ack_pending;						//frames received since the last ACK
+	uint32_t ack_deadline;
+	int8_t rcv_snr;								//SNR of the last DATA frame, echoed in the ACK
+
+	RYLR_rel_deliver_t deliver;
+	RYLR_rel_sent_t sent;
+	RYLR_rel_feedback_t feedback;
+	RYLR_rel_stats_t stats;
+};
+
+
+void rylr998_relInit(rylr998_rel_t *rel, rylr998_t *hrylr, uint16_t peer, uint8_t window,
+					 RYLR_rel_deliver_t deliver, RYLR_rel_sent_t sent);
+HAL_StatusTypeDef rylr998_relSend(rylr998_rel_t *rel, const uint8_t *data, uint8_t length, uint8_t *seq);
+uint8_t rylr998_relInput(rylr998_rel_t *rel, const RYLR_RX_data_t *packet);
+void rylr998_relProcess(rylr998_rel_t *rel);
+uint8_t rylr998_relInFlight(const rylr998_rel_t *rel);
+void rylr998_relSetFeedback(rylr998_rel_t *rel, RYLR_rel_feedback_t feedback);
+
+
+#endif /* INC_RYLR998_RELIABLE_H_ */
@@ -0,0 +1,91 @@
+/*
+ * rylr998_sec.h
+ *
+ *  Payload encryption and authentication, AES-128 in CCM mode (RFC 3610).
+ *
+ *  Installed as the handle's payload filter: every rylr998_sendData payload
+ *  is sealed, every +RCV is opened before the receive callback, so the
+ *  other layers run unchanged on top of it. Packets that fail the tag or
+ *  replay check never reach the application.
+ *
+ *  The nonce is the sender address and a 32 bit frame counter. The counter
+ *  is reserved in data EEPROM by blocks of RYLR_SEC_COUNTER_STEP, so a
+ *  reset never reuses a nonce (at most one block is skipped). Receivers
+ *  keep the highest counter and a 32 frame window for RYLR_SEC_PEERS
+ *  senders. An entry is never given to another sender, that would accept
+ *  the old frames of the one dropped again: once the table is full, new
+ *  senders are refused (stats.peers_refused) until rylr998_secForget frees
+ *  a slot. Size RYLR_SEC_PEERS for every node that talks to this one.
+ *
+ *  The windows live in RAM: after a reset of the receiver, the first frame
+ *  heard from each sender sets its window, a frame recorded before the reset
+ *  is accepted once if it is replayed first.
+ *
+ *  AES is byte oriented, encrypt only (CCM never decrypts a block) and
+ *  costs 2 blocks per 16 payload bytes plus 3. rylr998_secBenchmark gives
+ *  the cycle count of a 64 byte frame on the target.
+ *
+ *  FRAME: [RYLR_SEC_FRAME][counter, 4 bytes LE][ciphertext][tag, RYLR_SEC_TAG_SIZE]
+ *  The 5 header bytes are authenticated, not encrypted.
+ */
+
+#ifndef INC_RYLR998_SEC_H_
+#define INC_RYLR998_SEC_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_SEC_TAG_SIZE
+#define RYLR_SEC_TAG_SIZE			4U		//truncated CBC-MAC: 4, 6, 8, ... 16 bytes
+#endif
+#if (RYLR_SEC_TAG_SIZE < 4) || (RYLR_SEC_TAG_SIZE > 16) || (RYLR_SEC_TAG_SIZE & 1)
+#error "RYLR_SEC_TAG_SIZE must be even, 4 to 16 (CCM)"
+#endif
+#ifndef RYLR_SEC_PEERS
+#define RYLR_SEC_PEERS				4U		//senders tracked by the replay window
+#endif
+#ifndef RYLR_SEC_COUNTER_STEP
+#define RYLR_SEC_COUNTER_STEP		256U	//frames per EEPROM write
+#endif
+#ifndef RYLR_SEC_EEPROM_ADDR
+#define RYLR_SEC_EEPROM_ADDR		DATA_EEPROM_BASE	//word holding the reserved counter, 0 = no persistence
+#endif
+
+#define RYLR_SEC_FRAME				0xF1U
+#define RYLR_SEC_HEADER_SIZE		5U
+#define RYLR_SEC_OVERHEAD			(RYLR_SEC_HEADER_SIZE + RYLR_SEC_TAG_SIZE)
+#define RYLR_SEC_REPLAY_WINDOW		32U		//counters behind the highest one still accepted once
+
+
+typedef struct{
+	uint16_t address;
+	uint32_t top;							//highest counter authenticated
+	uint32_t mask;							//bit i: counter top - i received, 0: free entry
+}RYLR_sec_peer_t;
+
+typedef struct{
+	uint32_t sealed;
+	uint32_t opened;
+	uint32_t auth_failed;					//bad tag, or not a sealed frame
+	uint32_t replayed;						//counter already seen or behind the window
+	uint32_t peers_refused;					//frames from new senders with the table full
+}RYLR_sec_stats_t;
+
+typedef struct{
+	rylr998_t *hrylr;
+	uint16_t address;						//own address, part of the nonce
+	uint8_t round_key[176];					//AES-128 expanded key
+	uint32_t tx_counter;					//next counter sent
+	uint32_t tx_reserved;					//first counter not covered by the EEPROM
+	RYLR_sec_peer_t peer[RYLR_SEC_PEERS];
+	RYLR_sec_stats_t stats;
+}rylr998_sec_t;
+
+
+HAL_StatusTypeDef rylr998_secInit(rylr998_sec_t *sec, rylr998_t *hrylr, const uint8_t key[16], uint16_t address);
+void rylr998_secAttach(rylr998_sec_t *sec);
+void rylr998_secForget(rylr998_sec_t *sec, uint16_t address);
+HAL_StatusTypeDef rylr998_secBenchmark(rylr998_sec_t *sec, uint32_t *seal_cycles, uint32_t *open_cycles);
+
+
+#endif /* INC_RYLR998_SEC_H_ */
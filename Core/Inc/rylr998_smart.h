@@ -0,0 +1,77 @@
+/*
+ * rylr998_smart.h
+ *
+ *  Tuner of the smart receiving mode (AT+MODE=2,rxTime,LowSpeedTime).
+ *
+ *  In smart receiving the module listens for rxTime, then sleeps for
+ *  LowSpeedTime. A downlink frame sent while it sleeps waits for the next
+ *  window (sender retries or a preamble covering the sleep), so the worst
+ *  case latency is about LowSpeedTime + rxTime.
+ *
+ *  The tuner keeps the window just long enough to catch a preamble, or to
+ *  span the gaps inside a burst of frames when bursts are seen, and gives
+ *  the rest of the latency target to the sleep: the modeled current,
+ *  (rx * I_RX + sleep * I_SLEEP) / (rx + sleep), falls with every ms of
+ *  sleep. When frames arrive about once per cycle or more, the module
+ *  would rarely sleep and every frame would wait, so it stays in
+ *  continuous receive (AT+MODE=0) instead.
+ *
+ *  Inter-arrival times come from every +RCV. rylr998_smartProcess
+ *  re-evaluates every RYLR_SMART_EVAL_MS and sends AT+MODE again only
+ *  when the mode changes or a time moves by more than
+ *  RYLR_SMART_HYSTERESIS percent.
+ */
+
+#ifndef INC_RYLR998_SMART_H_
+#define INC_RYLR998_SMART_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_SMART_EVAL_MS
+#define RYLR_SMART_EVAL_MS			60000U
+#endif
+#ifndef RYLR_SMART_MIN_SAMPLES
+#define RYLR_SMART_MIN_SAMPLES		8U		//arrivals before the traffic is taken into account
+#endif
+#ifndef RYLR_SMART_HYSTERESIS
+#define RYLR_SMART_HYSTERESIS		25U		//percent
+#endif
+
+#define RYLR_SMART_TIME_MIN			30U		//AT+MODE=2 limits, ms
+#define RYLR_SMART_TIME_MAX			60000U
+
+
+typedef struct{
+	uint8_t mode;							//0: continuous receive, 2: smart receiving
+	uint16_t rx_ms;
+	uint16_t sleep_ms;
+	uint32_t current_ua;					//modeled average current of the module
+}RYLR_smart_setting_t;
+
+typedef struct{
+	uint32_t arrivals;
+	uint32_t changes;						//AT+MODE sent and acknowledged
+	uint32_t failures;
+}RYLR_smart_stats_t;
+
+typedef struct{
+	rylr998_t *hrylr;
+	uint32_t latency_ms;					//downlink latency allowed, worst case
+	uint32_t last_arrival;					//tick of the last +RCV
+	uint32_t gap_ms;						//inter-arrival time, average
+	uint32_t burst_gap_ms;					//average of the gaps under gap_ms / 4, 0: no bursts
+	uint16_t samples;						//inter-arrival times seen, saturates
+	uint32_t last_eval;
+	RYLR_smart_setting_t applied;
+	RYLR_smart_stats_t stats;
+}rylr998_smart_t;
+
+
+void rylr998_smartInit(rylr998_smart_t *sm, rylr998_t *hrylr, uint32_t latency_ms);
+void rylr998_smartInput(rylr998_smart_t *sm, const RYLR_RX_data_t *packet);
+void rylr998_smartRecommend(rylr998_smart_t *sm, RYLR_smart_setting_t *setting);
+RYLR_status_t rylr998_smartProcess(rylr998_smart_t *sm);
+
+
+#endif /* INC_RYLR998_SMART_H_ */
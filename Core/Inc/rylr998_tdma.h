@@ -0,0 +1,98 @@
+/*
+ * rylr998_tdma.h
+ *
+ *  TDMA access synchronized by gateway beacons.
+ *
+ *  The gateway broadcasts a beacon every superframe. Slot 0 carries the
+ *  beacon, node n transmits in slot 1 + (address % slots). The slot is
+ *  long enough for the largest frame at the gateway's SF/BW plus a guard
+ *  time, and nodes learn it from the beacon.
+ *
+ *  Nodes take the superframe start from the beacon reception, corrected by
+ *  the beacon time on air and the UART time of the +RCV line, and start
+ *  AT+SEND early by the UART-to-air latency measured on their own frames.
+ *  The transmission is timed by a one-shot hardware timer armed through
+ *  the arm hook (e.g. TIM21, calling rylr998_tdmaTimerElapsed from its
+ *  interrupt); without the hook the tick is used. The interrupt only
+ *  records that the slot started: when the slot is less than
+ *  RYLR_TDMA_WAIT_MS away, rylr998_tdmaProcess waits for it in Sleep mode,
+ *  then sends and collects the +OK itself, so the handle is only ever
+ *  used from the main loop.
+ *
+ *  BEACON: [RYLR_TDMA_BEACON][seq][slots][slot_ms low][slot_ms high]
+ */
+
+#ifndef INC_RYLR998_TDMA_H_
+#define INC_RYLR998_TDMA_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_TDMA_PAYLOAD_MAX
+#define RYLR_TDMA_PAYLOAD_MAX		64U		//largest frame queued, also sizes the slot
+#endif
+#ifndef RYLR_TDMA_GUARD_MS
+#define RYLR_TDMA_GUARD_MS			20U		//clock drift and latency jitter between two slots
+#endif
+#ifndef RYLR_TDMA_TX_LATENCY_MS
+#define RYLR_TDMA_TX_LATENCY_MS		15U		//AT+SEND to air, until the first measurement
+#endif
+#ifndef RYLR_TDMA_WAIT_MS
+#define RYLR_TDMA_WAIT_MS			RYLR_TDMA_GUARD_MS	//rylr998_tdmaProcess blocks this long before the slot
+#endif
+#ifndef RYLR_TDMA_MAX_MISSED
+#define RYLR_TDMA_MAX_MISSED		3U		//superframes extrapolated without a beacon
+#endif
+
+#define RYLR_TDMA_BEACON			0xB1U
+#define RYLR_TDMA_BEACON_SIZE		5U
+
+
+typedef void (*RYLR_tdma_arm_fn_t)(uint32_t delay_us);
+
+typedef struct{
+	uint32_t beacons;						//sent by the gateway or received by the node
+	uint32_t missed;						//superframes without a beacon
+	uint32_t frames_sent;
+	uint32_t failures;						//AT+SEND refused or not answered, retried next superframe
+	uint32_t late;							//slots skipped because the frame was queued too late
+}RYLR_tdma_stats_t;
+
+typedef struct{
+	rylr998_t *hrylr;
+	uint16_t gateway;
+	uint16_t address;
+	RYLR_tdma_arm_fn_t arm;
+
+	// Superframe
+	uint8_t slots;							//node slots after the beacon slot
+	uint16_t slot_ms;
+	uint8_t synced;
+	uint8_t missed;
+	uint8_t beacon_seq;
+	uint32_t frame_start;					//tick the current superframe went on air
+	uint16_t tx_latency_ms;					//AT+SEND to air, averaged
+
+	// Frame waiting for the slot
+	uint8_t pending;
+	uint8_t armed;							//slot scheduled at fire_tick
+	uint32_t fire_tick;
+	volatile uint8_t fired;					//set by rylr998_tdmaTimerElapsed
+	uint16_t dest;
+	uint8_t length;
+	uint8_t data[RYLR_TDMA_PAYLOAD_MAX];
+
+	RYLR_tdma_stats_t stats;
+}rylr998_tdma_t;
+
+
+void rylr998_tdmaInit(rylr998_tdma_t *tdma, rylr998_t *hrylr, uint16_t gateway, uint16_t address, RYLR_tdma_arm_fn_t arm);
+HAL_StatusTypeDef rylr998_tdmaSetFrame(rylr998_tdma_t *tdma, uint8_t slots);
+uint16_t rylr998_tdmaSlotMs(const RYLR_phy_t *phy, uint8_t max_payload);
+uint8_t rylr998_tdmaInput(rylr998_tdma_t *tdma, const RYLR_RX_data_t *packet);
+HAL_StatusTypeDef rylr998_tdmaSend(rylr998_tdma_t *tdma, uint16_t dest, const uint8_t *data, uint8_t length);
+void rylr998_tdmaProcess(rylr998_tdma_t *tdma);
+void rylr998_tdmaTimerElapsed(rylr998_tdma_t *tdma);
+
+
+#endif /* INC_RYLR998_TDMA_H_ */
@@ -0,0 +1,74 @@
+/*
+ * rylr998_time.h
+ *
+ *  Network time from over-the-air sync frames.
+ *
+ *  The master stamps each SYNC frame with its tick at the moment the frame
+ *  goes on air (tick of AT+SEND plus its measured UART-to-air latency).
+ *  Nodes rebuild the same instant on their clock from the reception:
+ *  tick of the +RCV line, minus its UART time, minus the frame time on
+ *  air. The difference is the clock offset; two syncs give the drift of
+ *  the local tick against the master, applied between syncs for up to
+ *  RYLR_TIME_HOLDOVER_MS.
+ *
+ *  SYNC: [RYLR_TIME_SYNC][seq][master tick, 4 bytes LE]
+ */
+
+#ifndef INC_RYLR998_TIME_H_
+#define INC_RYLR998_TIME_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_TIME_SYNC_MS
+#define RYLR_TIME_SYNC_MS			30000U	//master: period of the SYNC frames
+#endif
+#ifndef RYLR_TIME_HOLDOVER_MS
+#define RYLR_TIME_HOLDOVER_MS		600000U	//node: time kept without SYNC
+#endif
+#ifndef RYLR_TIME_MAX_PPM
+#define RYLR_TIME_MAX_PPM			20000	//HSI16 is trimmed to +-1%, anything beyond is a bad sample
+#endif
+#ifndef RYLR_TIME_TX_LATENCY_MS
+#define RYLR_TIME_TX_LATENCY_MS		15U		//AT+SEND to air, until the first measurement
+#endif
+
+#define RYLR_TIME_SYNC				0xB2U
+#define RYLR_TIME_SYNC_SIZE			6U
+
+
+typedef struct{
+	uint32_t syncs;							//sent by the master or received by the node
+	int32_t last_error_ms;					//node: network time predicted minus received at the last SYNC
+	uint32_t max_error_ms;					//node: largest |last_error_ms| while synced
+}RYLR_time_stats_t;
+
+typedef struct{
+	rylr998_t *hrylr;
+	uint16_t master;
+	uint16_t address;
+	uint8_t seq;
+
+	// Master
+	uint32_t last_sync;
+	uint16_t tx_latency_ms;					//AT+SEND to air, averaged
+
+	// Node
+	uint8_t synced;
+	uint8_t samples;
+	int32_t offset_ms;						//network time - local tick at ref_local
+	int32_t drift_ppm;						//master clock speed relative to the local tick
+	uint32_t ref_local;						//local tick of the last SYNC on air
+	uint32_t ref_remote;					//network time of the last SYNC on air
+
+	RYLR_time_stats_t stats;
+}rylr998_time_t;
+
+
+void rylr998_timeInit(rylr998_time_t *ts, rylr998_t *hrylr, uint16_t master, uint16_t address);
+uint8_t rylr998_timeInput(rylr998_time_t *ts, const RYLR_RX_data_t *packet);
+void rylr998_timeProcess(rylr998_time_t *ts);
+HAL_StatusTypeDef rylr998_timeNow(rylr998_time_t *ts, uint32_t *network_ms);
+
+
+#endif /* INC_RYLR998_TIME_H_ */
@@ -0,0 +1,82 @@
+/*
+ * rylr998_tpc.h
+ *
+ *  Closed loop transmit power control from the SNR the peer measures.
+ *
+ *  The receiver echoes the SNR of our frames (rylr998_reliable ACKs, see
+ *  rylr998_relSetFeedback). The excess is that SNR minus the demodulation
+ *  floor of the current SF minus the target margin:
+ *
+ *    excess < 0                      power raised at once by the missing dB
+ *    0 <= excess <= hysteresis       kept
+ *    excess > hysteresis             lowered to the middle of that band,
+ *                                    after RYLR_TPC_MIN_SAMPLES reports at
+ *                                    the current power and RYLR_TPC_HOLD_MS
+ *
+ *  A frame dropped after all its retries (rylr998_tpcLoss) goes back to
+ *  the maximum power. The smoothed SNR is shifted by every change, so the
+ *  next decision does not wait for it to converge again.
+ *
+ *  The maximum is capped at RYLR_TPC_MAX_DBM, 14 dBm by default: the CE
+ *  limit of 25 mW ERP in the 868 MHz band. Raise it to 22 where allowed.
+ *  The LoRa SNR saturates around +10 dB on strong links, the excess is
+ *  then underestimated and the power stays higher than needed, never lower.
+ */
+
+#ifndef INC_RYLR998_TPC_H_
+#define INC_RYLR998_TPC_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_TPC_MAX_DBM
+#define RYLR_TPC_MAX_DBM			14U		//CE cap (EU868), 22 where allowed (e.g. US915)
+#endif
+#ifndef RYLR_TPC_MIN_DBM
+#define RYLR_TPC_MIN_DBM			0U
+#endif
+#ifndef RYLR_TPC_MARGIN_DB
+#define RYLR_TPC_MARGIN_DB			6		//dB kept above the demodulation floor
+#endif
+#ifndef RYLR_TPC_HYSTERESIS_DB
+#define RYLR_TPC_HYSTERESIS_DB		4		//width of the band where the power is kept
+#endif
+#ifndef RYLR_TPC_MIN_SAMPLES
+#define RYLR_TPC_MIN_SAMPLES		3U		//reports at the current power before lowering it
+#endif
+#ifndef RYLR_TPC_HOLD_MS
+#define RYLR_TPC_HOLD_MS			30000U	//minimum time between two decreases
+#endif
+#if RYLR_TPC_MAX_DBM > 22
+#error "RYLR_TPC_MAX_DBM: the module transmits 22 dBm at most"
+#endif
+
+
+typedef struct{
+	uint32_t reports;
+	uint32_t decreases;
+	uint32_t increases;
+	uint32_t losses;						//frames dropped, back to the maximum
+	uint32_t failures;						//powers the module refused or did not answer
+}RYLR_tpc_stats_t;
+
+typedef struct{
+	rylr998_t *hrylr;
+	int8_t margin_db;
+	uint8_t max_dbm;
+	uint8_t samples;						//reports since the last change, saturates at 255
+	uint8_t loss;							//a frame was dropped, go to max_dbm
+	int16_t snr_q4;							//smoothed SNR reported by the peer, 1/16 dB
+	uint32_t last_decrease;
+	RYLR_tpc_stats_t stats;
+}rylr998_tpc_t;
+
+
+void rylr998_tpcInit(rylr998_tpc_t *tpc, rylr998_t *hrylr, int8_t margin_db, uint8_t max_dbm);
+void rylr998_tpcReport(rylr998_tpc_t *tpc, int8_t snr);
+void rylr998_tpcLoss(rylr998_tpc_t *tpc);
+uint8_t rylr998_tpcRecommend(rylr998_tpc_t *tpc);
+RYLR_status_t rylr998_tpcProcess(rylr998_tpc_t *tpc);
+
+
+#endif /* INC_RYLR998_TPC_H_ */
@@ -0,0 +1,93 @@
+/*
+ * rylr998_ts.h
+ *
+ *  Time series compression for periodic telemetry, after Gorilla (VLDB 2015).
+ *
+ *  Samples are (timestamp in ms, value) pairs of one series. The first is
+ *  stored raw in the header, the others as bit fields:
+ *
+ *  timestamp, delta of delta:  '0'               same interval
+ *                              '10'   + 7 bits   -63..64
+ *                              '110'  + 9 bits   -255..256
+ *                              '1110' + 12 bits  -2047..2048
+ *                              '1111' + 32 bits
+ *  float value, XOR with the previous one:
+ *                              '0'               same value
+ *                              '10'   + bits     inside the previous meaningful bits
+ *                              '11'   + 5 bits leading zeros + 5 bits length - 1 + bits
+ *  integer value, zigzag delta:
+ *                              '0'               same value
+ *                              '10'   + 4 bits, '110' + 8 bits, '1110' + 16 bits, '1111' + 32 bits
+ *
+ *  A sample costs 2 bits (fixed period, same value) to about 30 bits
+ *  (jittered period, noisy float) against 8 bytes raw. Quantized values
+ *  (integers, floats rounded to the sensor resolution) compress best.
+ *  The encoder refuses the sample that no longer fits, the frame is then
+ *  sent and the sample starts the next one.
+ *
+ *  FRAME: [RYLR_TS_FRAME][mode][count, 2 bytes LE][t0, 4 bytes LE][v0, 4 bytes LE][bits, MSB first]
+ */
+
+#ifndef INC_RYLR998_TS_H_
+#define INC_RYLR998_TS_H_
+
+#include "rylr998.h"
+
+
+#define RYLR_TS_FRAME				0x91U
+#define RYLR_TS_HEADER_SIZE			12U
+#define RYLR_TS_RAW_SAMPLE_SIZE		8U		//timestamp and value, for the compression ratio
+
+
+typedef enum
+{
+	RYLR_TS_FLOAT = 0x00U,					//XOR of the IEEE 754 bits
+	RYLR_TS_INT								//zigzag delta of int32
+
+} RYLR_ts_mode_t;
+
+typedef union{
+	float f;
+	int32_t i;
+}RYLR_ts_value_t;
+
+typedef struct{
+	uint8_t *buffer;
+	uint16_t size_bits;
+	uint16_t pos;							//bit position
+	uint8_t overflow;
+}RYLR_ts_bits_t;
+
+typedef struct{
+	RYLR_ts_bits_t bits;
+	RYLR_ts_mode_t mode;
+	uint16_t count;							//samples in the frame
+	uint32_t last_time;
+	int32_t last_delta;
+	uint32_t last_value;					//bits of the float, or the int
+	uint8_t leading;						//float: meaningful window of the last XOR
+	uint8_t trailing;
+}RYLR_ts_enc_t;
+
+typedef struct{
+	RYLR_ts_bits_t bits;
+	RYLR_ts_mode_t mode;
+	uint16_t count;							//samples in the frame
+	uint16_t index;							//next sample returned
+	uint32_t last_time;
+	int32_t last_delta;
+	uint32_t last_value;
+	uint8_t leading;
+	uint8_t trailing;
+}RYLR_ts_dec_t;
+
+
+void rylr998_tsEncInit(RYLR_ts_enc_t *enc, uint8_t *buffer, uint8_t size, RYLR_ts_mode_t mode);
+HAL_StatusTypeDef rylr998_tsAppend(RYLR_ts_enc_t *enc, uint32_t time_ms, RYLR_ts_value_t value);
+HAL_StatusTypeDef rylr998_tsEncEnd(RYLR_ts_enc_t *enc, uint8_t *length);
+
+HAL_StatusTypeDef rylr998_tsDecInit(RYLR_ts_dec_t *dec, const uint8_t *buffer, uint8_t length);
+HAL_StatusTypeDef rylr998_tsNext(RYLR_ts_dec_t *dec, uint32_t *time_ms, RYLR_ts_value_t *value);
+
+
+#endif /* INC_RYLR998_TS_H_ */
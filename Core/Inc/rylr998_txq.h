@@ -0,0 +1,144 @@
+/*
+ * rylr998_txq.h
+ *
+ *  Transmit queue for contention based (ALOHA) access.
+ *
+ *  Every frame starts after a random jitter so nodes woken by the same
+ *  event do not collide on their first attempt. Frames that expect an
+ *  application ACK are sent again when it does not arrive, after a binary
+ *  exponential backoff counted in frame airtimes: attempt n waits a random
+ *  0..2^n-1 slots. Each destination is limited to one frame per
+ *  RYLR_TXQ_DEST_INTERVAL_MS so a single busy peer cannot take the channel.
+ *
+ *  Frames belong to a class. The next frame is taken from the highest
+ *  class that has one due (strict), or by weighted round robin with
+ *  RYLR_TXQ_WEIGHTS so bulk still progresses under steady control traffic.
+ *  Either way a control frame goes out at the next frame boundary, ahead
+ *  of any bulk fragment already queued. RYLR_TXQ_RESERVED entries are kept
+ *  free for control frames, and control frames skip the destination limit
+ *  and most of the jitter.
+ */
+
+#ifndef INC_RYLR998_TXQ_H_
+#define INC_RYLR998_TXQ_H_
+
+#include "rylr998.h"
+
+
+#ifndef RYLR_TXQ_DEPTH
+#define RYLR_TXQ_DEPTH				4U
+#endif
+#ifndef RYLR_TXQ_PAYLOAD_MAX
+#define RYLR_TXQ_PAYLOAD_MAX		64U
+#endif
+#ifndef RYLR_TXQ_JITTER_MS
+#define RYLR_TXQ_JITTER_MS			500U	//random delay of the first attempt
+#endif
+#ifndef RYLR_TXQ_ACK_TIMEOUT_MS
+#define RYLR_TXQ_ACK_TIMEOUT_MS		1000U	//wait for the ACK after the frame left the air
+#endif
+#ifndef RYLR_TXQ_MAX_ATTEMPTS
+#define RYLR_TXQ_MAX_ATTEMPTS		6U
+#endif
+#ifndef RYLR_TXQ_BACKOFF_MAX_EXP
+#define RYLR_TXQ_BACKOFF_MAX_EXP	5U		//contention window stops growing at 2^5 slots
+#endif
+#ifndef RYLR_TXQ_RESERVED
+#define RYLR_TXQ_RESERVED			1U		//entries only control frames may take
+#endif
+#if RYLR_TXQ_RESERVED >= RYLR_TXQ_DEPTH
+#error "RYLR_TXQ_RESERVED must leave entries for the other classes"
+#endif
+#ifndef RYLR_TXQ_WEIGHTS
+#define RYLR_TXQ_WEIGHTS			{ 4U, 2U, 1U }	//frames per round of each class, weighted scheduling
+#endif
+#ifndef RYLR_TXQ_DESTS
+#define RYLR_TXQ_DESTS				4U		//destinations tracked by the rate limit
+#endif
+#ifndef RYLR_TXQ_DEST_INTERVAL_MS
+#define RYLR_TXQ_DEST_INTERVAL_MS	1000U
+#endif
+
+
+typedef struct rylr998_txq_s rylr998_txq_t;
+
+typedef void (*RYLR_txq_done_t)(rylr998_txq_t *txq, uint8_t token, uint8_t acked);	//acked=0: attempts exhausted
+
+typedef enum
+{
+	RYLR_TXQ_CONTROL = 0x00U,					//alarms and commands
+	RYLR_TXQ_NORMAL,
+	RYLR_TXQ_BULK,								//fragments of uploads
+	RYLR_TXQ_CLASSES
+
+} RYLR_txq_class_t;
+
+typedef enum
+{
+	RYLR_TXQ_FREE = 0x00U,
+	RYLR_TXQ_READY,								//waiting for not_before
+	RYLR_TXQ_WAIT_ACK							//sent, waiting for rylr998_txqAck
+
+} RYLR_txq_state_t;
+
+typedef struct{
+	RYLR_txq_state_t state;
+	RYLR_txq_class_t cls;
+	uint8_t token;
+	uint8_t need_ack;
+	uint8_t attempts;
+	uint16_t dest;
+	uint8_t length;
+	uint32_t order;								//FIFO among the frames ready
+	uint32_t queued;							//tick of rylr998_txqSend
+	uint32_t not_before;						//tick of the next attempt, or of the ACK timeout
+	uint8_t data[RYLR_TXQ_PAYLOAD_MAX];
+}RYLR_txq_entry_t;
+
+typedef struct{
+	uint16_t dest;
+	uint8_t used;
+	uint32_t last_tx;
+}RYLR_txq_dest_t;
+
+typedef struct{
+	uint32_t frames_sent;						//first attempts
+	uint32_t retries;
+	uint32_t acked;
+	uint32_t dropped;							//attempts exhausted
+	uint32_t rate_limited;						//attempts postponed by the destination limit
+	uint32_t full;								//frames refused, queue full
+	struct{
+		uint32_t frames;						//first attempts of the class
+		uint32_t delay_ms;						//sum of the queueing delays, mean = delay_ms / frames
+		uint32_t delay_max_ms;
+	}cls[RYLR_TXQ_CLASSES];
+}RYLR_txq_stats_t;
+
+struct rylr998_txq_s{
+	rylr998_t *hrylr;
+	uint32_t rng;								//xorshift32 state
+	uint32_t order;
+	uint8_t next_token;
+	uint32_t radio_free;						//tick when the last frame left the air
+	uint8_t weighted;							//0: strict priority, 1: weighted round robin
+	uint8_t credit[RYLR_TXQ_CLASSES];			//frames left in the round, weighted scheduling
+	RYLR_txq_entry_t entry[RYLR_TXQ_DEPTH];
+	RYLR_txq_dest_t dest[RYLR_TXQ_DESTS];
+	RYLR_txq_done_t done;
+	RYLR_txq_stats_t stats;
+};
+
+
+void rylr998_txqInit(rylr998_txq_t *txq, rylr998_t *hrylr, RYLR_txq_done_t done);
+void rylr998_txqSetScheduling(rylr998_txq_t *txq, uint8_t weighted);
+HAL_StatusTypeDef rylr998_txqSend(rylr998_txq_t *txq, uint16_t dest, const uint8_t *data, uint8_t length,
+								  uint8_t need_ack, uint8_t *token);
+HAL_StatusTypeDef rylr998_txqSendClass(rylr998_txq_t *txq, RYLR_txq_class_t cls, uint16_t dest, const uint8_t *data,
+									   uint8_t length, uint8_t need_ack, uint8_t *token);
+void rylr998_txqAck(rylr998_txq_t *txq, uint8_t token);
+void rylr998_txqProcess(rylr998_txq_t *txq);
+uint8_t rylr998_txqPending(const rylr998_txq_t *txq);
+
+
+#endif /* INC_RYLR998_TXQ_H_ */
@@ -25,6 +25,7 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "rylr998.h"
+#include "rylr998_cfg.h"
 #include <string.h>
 
 /* USER CODE END Includes */
@@ -36,6 +37,8 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+//Define to drive a second RYLR998 on USART2 (PA9/PA15, the VCP pins on the Nucleo-32)
+//#define RYLR_SECOND_RADIO
 
 /* USER CODE END PD */
 
@@ -53,6 +56,7 @@
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 /* USER CODE BEGIN PFP */
+void SystemClock_Restore(void);
 
 /* USER CODE END PFP */
 
@@ -72,20 +76,29 @@ void LEDBlink(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, uint32_t delay_ms) {
 
 #define RX_BUFFER_SIZE 255
 uint8_t rx_buff[RX_BUFFER_SIZE];  // Reception buffer
+rylr998_t lora;                   // RYLR998 on LPUART1
+
+//Configuration parameters: NETWORKID, ADDRESS, SF, BW, CR, preamble, MODE, IPR, BAND, save band, CPIN, CRFOP
+RYLR_CFG_DEFINE(lora_cfg, 18, 1, 9, 7, 1, 12, 0, 115200, 915000000, 1, "FFFFFFFF", 22);
+
+#ifdef RYLR_SECOND_RADIO
+RYLR_CFG_DEFINE(lora2_cfg, 18, 2, 9, 7, 1, 12, 0, 115200, 915000000, 1, "FFFFFFFF", 22);
+uint8_t rx_buff2[RX_BUFFER_SIZE];
+rylr998_t lora2;                  // RYLR998 on USART2
+#endif
 
 
 
 void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size) {
-    // Check if the event is an idle line event
-
-	if((huart == &hlpuart1)){
-		//if (HAL_UARTEx_GetRxEventType(huart) == HAL_UART_RXEVENT_IDLE ||HAL_UARTEx_GetRxEventType(huart) == HAL_UART_RXEVENT_HT) {
-		//For some reason, the RXevent IDLE tends to not work right
-			if (rx_buff[Size-1]=='\n'){
-			rylr998_SetInterruptFlag();
-			}
-			HAL_UARTEx_ReceiveToIdle_DMA(huart, rx_buff, RX_BUFFER_SIZE);
+    // Each radio only looks at its own UART
+	if(huart == lora.huart){
+		rylr998_RxEventCallback(&lora, Size);
 	}
+#ifdef RYLR_SECOND_RADIO
+	else if(huart == lora2.huart){
+		rylr998_RxEventCallback(&lora2, Size);
+	}
+#endif
 }
 
 
@@ -129,51 +142,60 @@ int main(void)
 
 
 	//Start RX IRQ
-	HAL_UARTEx_ReceiveToIdle_DMA(&hlpuart1, rx_buff, RX_BUFFER_SIZE);
-
-
-	//Configuration parameters
-	RYLR_config_t config_handler;
-	config_handler.networkId =18;
-	config_handler.address =1;
-	config_handler.SF=9;
-	config_handler.BW=7;
-	config_handler.CR=1;
-	config_handler.ProgramedPreamble=12;
-	config_handler.mode=0;
-	config_handler.rxTime=0;
-	config_handler.LowSpeedTime=0;
-	config_handler.baudRate=115200;
-	config_handler.frequency=915000000;
-	config_handler.memory=1;
-	strcpy(config_handler.password, "FFFFFFFF");
-	config_handler.CRFOP=22;
-
-	//Start the configuration
-	if (rylr998_config(&config_handler,&hlpuart1,rx_buff, RX_BUFFER_SIZE)==HAL_OK){
+	rylr998_init(&lora, &hlpuart1, rx_buff, RX_BUFFER_SIZE);
+#ifdef RYLR_SECOND_RADIO
+	rylr998_init(&lora2, &huart2, rx_buff2, RX_BUFFER_SIZE);
+#endif
+
+
+	//Start the configuration, lora_cfg is checked and encoded at compile time
+	if (rylr998_configStatic(&lora, &lora_cfg)==HAL_OK){
 		//CFG was successful
 	}else{
-		//any errors on RX will end up in a while internal loop
+		//HAL_TIMEOUT: the module stopped answering, HAL_ERROR: a command was rejected
+		//rylr998_GetMetrics() tells how many retries were needed
 	}
 
+#ifdef RYLR_SECOND_RADIO
+	rylr998_configStatic(&lora2, &lora2_cfg);
+#endif
+
+#ifndef RYLR_SECOND_RADIO
+	//Wait for the module in Stop mode, SystemClock_Restore restarts the PLL after each wakeup and keeps LPUART1 on HSI16
+	rylr998_EnableStopMode(&lora, SystemClock_Restore);
+	//Run from MSI between bursts, back to 32 MHz for the payload filters and the receive callback
+	rylr998_EnableClockScaling(&lora, SystemClock_Restore, RYLR_CLOCK_MSI_RANGE);
+#endif
+
 
 
   while (1)
   {
+	  //Sleep until a module sends a line, then parse it
+#ifdef RYLR_SECOND_RADIO
+	  if(!rylr998_GetInterruptFlag(&lora2)){
+		  rylr998_Idle(&lora, RYLR_STOP_MAX_MS);		//Sleep mode only here, a line on USART2 wakes it too
+	  }
+#else
+	  rylr998_Idle(&lora, RYLR_STOP_MAX_MS);
+#endif
+	  if(rylr998_GetInterruptFlag(&lora)){
+		  rylr998_prase_reciver(&lora);
+	  }
+#ifdef RYLR_SECOND_RADIO
+	  if(rylr998_GetInterruptFlag(&lora2)){
+		  rylr998_prase_reciver(&lora2);
+	  }
+#endif
 
 	  /* EXAMPLE TO SEND DATA
 	  uint8_t data_to_send[]= "Hi";
-	   	if(rylr998_sendData(&hlpuart1,0,(uint8_t*)&data_to_send,strlen((char*)data_to_send))==HAL_OK){ //Confirm that UART transfer was successful
-	   	while(1){
-			  if(rylr998_GetInterruptFlag()){           //Check if the IRQ is completed
-				  if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_OK){
+	   	if(rylr998_sendData(&lora,0,(uint8_t*)&data_to_send,strlen((char*)data_to_send))==HAL_OK){ //Confirm that UART transfer was successful
+			  if(rylr998_AwaitResponse(&lora,RYLR_OK,NULL)==RYLR_STATUS_OK){   //+OK within the deadline, resent on timeout
 						//  LEDBlink(GPIOB, GPIO_PIN_3, 500);
 						//  LEDBlink(GPIOB, GPIO_PIN_3, 500);
 						//  LEDBlink(GPIOB, GPIO_PIN_3, 500);
-						  break;
-				  }
 			  }
-	   	}
 }else{
 */
 }
@@ -184,10 +206,29 @@ int main(void)
   * @retval None
   */
 void SystemClock_Config(void)
+{
+  RCC_PeriphCLKInitTypeDef PeriphClkInit = {0};
+
+  SystemClock_Restore();
+
+  PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_USART2|RCC_PERIPHCLK_LPUART1;
+  PeriphClkInit.Usart2ClockSelection = RCC_USART2CLKSOURCE_PCLK1;
+  PeriphClkInit.Lpuart1ClockSelection = RCC_LPUART1CLKSOURCE_PCLK1;
+  if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
+
+/**
+  * @brief Oscillators and bus clocks only, the UART kernel clocks are left as they are.
+  *        Also called after Stop and after the MSI periods, where the UART runs from HSI16.
+  * @retval None
+  */
+void SystemClock_Restore(void)
 {
   RCC_OscInitTypeDef RCC_OscInitStruct = {0};
   RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
-  RCC_PeriphCLKInitTypeDef PeriphClkInit = {0};
 
   /** Configure the main internal regulator output voltage
   */
@@ -221,13 +262,6 @@ void SystemClock_Config(void)
   {
     Error_Handler();
   }
-  PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_USART2|RCC_PERIPHCLK_LPUART1;
-  PeriphClkInit.Usart2ClockSelection = RCC_USART2CLKSOURCE_PCLK1;
-  PeriphClkInit.Lpuart1ClockSelection = RCC_LPUART1CLKSOURCE_PCLK1;
-  if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK)
-  {
-    Error_Handler();
-  }
 }
 
 /* USER CODE BEGIN 4 */
@@ -11,160 +11,1087 @@
 #include <stdlib.h>
 
 
+const RYLR_retry_policy_t rylr998_default_policy = {
+	.timeout_ms  = RYLR_DEFAULT_TIMEOUT_MS,
+	.max_retries = RYLR_DEFAULT_RETRIES,
+	.backoff_ms  = RYLR_DEFAULT_BACKOFF_MS,
+};
+
+// What rylr998_AwaitResponse does for each +ERR= code, copied into every handle
+static const RYLR_recovery_t rylr998_default_recovery[RYLR_ERR_MAX_CODE + 1] = {
+	[RYLR_ERR_NO_CRLF]			= RYLR_RECOVER_RESYNC,		//garbled on the wire
+	[RYLR_ERR_NO_AT]			= RYLR_RECOVER_RESYNC,
+	[RYLR_ERR_UNKNOWN_CMD]		= RYLR_RECOVER_REPORT,		//resending will not help
+	[RYLR_ERR_LENGTH_MISMATCH]	= RYLR_RECOVER_RESYNC,
+	[RYLR_ERR_TX_OVER_TIMES]	= RYLR_RECOVER_RETRY,		//radio busy
+	[RYLR_ERR_CRC]				= RYLR_RECOVER_REPORT,
+	[RYLR_ERR_TX_TOO_LONG]		= RYLR_RECOVER_REPORT,
+	[RYLR_ERR_FLASH_WRITE]		= RYLR_RECOVER_RESET,
+	[RYLR_ERR_UNKNOWN_FAILURE]	= RYLR_RECOVER_RESET,
+	[RYLR_ERR_TX_NOT_COMPLETED]	= RYLR_RECOVER_RETRY,
+	[RYLR_ERR_PREAMBLE]			= RYLR_RECOVER_REPORT,
+	[RYLR_ERR_RX_HEADER]		= RYLR_RECOVER_REPORT,
+	[RYLR_ERR_SMART_MODE_TIME]	= RYLR_RECOVER_REPORT,
+};
+
+
+// Module state after AT+FACTORY
+static const RYLR_phy_t rylr998_factory_phy = {
+	.SF = 9, .BW = 7, .CR = 1, .ProgramedPreamble = 12, .CRFOP = 22,
+};
+
+// PHY profiles, kept in flash
+const RYLR_profile_t rylr998_profile_long_range = {
+	.name = "long_range",
+	.phy = { .SF = 9, .BW = 7, .CR = 1, .ProgramedPreamble = 12, .CRFOP = 22 },	//SF9 / 125 kHz
+};
+
+const RYLR_profile_t rylr998_profile_bulk = {
+	.name = "bulk",
+	.phy = { .SF = 7, .BW = 9, .CR = 1, .ProgramedPreamble = 12, .CRFOP = 22 },	//SF7 / 500 kHz, highest data rate
+};
+
+
 /**
- * @brief  Sends data to a specific address on the RYLR998 module using the AT command.
- * @param  config_handler: Pointer to the config handler
- * @param  puartHandle: Pointer to the UART handle used for communication.
- * @param  rx_buff: Pointer to the data buffer
- * @param  RX_BUFFER_SIZE, size of the data buffer
- * @retval HAL_StatusTypeDef: HAL_OK if UART transmission is successful
+ * @brief  Initializes a RYLR998 handle and starts the DMA reception of its UART.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  puartHandle: UART the module is wired to, its RX DMA must be in circular mode.
+ * @param  rx_buff: Pointer to the DMA reception buffer, owned by this handle from now on
+ * @param  RX_BUFFER_SIZE: size of the DMA reception buffer
+ * @retval HAL_StatusTypeDef: result of starting the reception
  */
+HAL_StatusTypeDef rylr998_init(rylr998_t *hrylr, UART_HandleTypeDef *puartHandle, uint8_t *rx_buff, uint16_t RX_BUFFER_SIZE){
 
-HAL_StatusTypeDef rylr998_config(RYLR_config_t *config_handler,UART_HandleTypeDef *puartHandle,uint8_t *rx_buff,uint8_t RX_BUFFER_SIZE){
+	memset(hrylr, 0, sizeof(*hrylr));
+	hrylr->huart = puartHandle;
+	hrylr->rx_buff = rx_buff;
+	hrylr->rx_size = RX_BUFFER_SIZE;
+	hrylr->tick = HAL_GetTick;
+	memcpy(hrylr->recovery, rylr998_default_recovery, sizeof(hrylr->recovery));
 
-	if(rylr998_FACTORY(puartHandle)==HAL_OK){
-		while(1){
-				if(rylr998_GetInterruptFlag()){
-						if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_FACTORY){
-							break;
-						}
-					}
-				}
+	return HAL_UARTEx_ReceiveToIdle_DMA(puartHandle, rx_buff, RX_BUFFER_SIZE);
+}
+
+
+/**
+ * @brief  Sends bytes over the UART, blocking or with DMA.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  cmd: Bytes to send, must stay valid until the DMA is done.
+ * @param  length: Number of bytes to send.
+ * @param  dma: 1 to send with DMA, 0 to block until the last byte is out.
+ * @retval HAL_StatusTypeDef: HAL_BUSY if a previous DMA transfer is still running.
+ */
+static HAL_StatusTypeDef rylr998_uart_send(rylr998_t *hrylr, const uint8_t *cmd, uint16_t length, uint8_t dma){
+
+	UART_HandleTypeDef *puartHandle = hrylr->huart;
+
+	if(puartHandle->gState != HAL_UART_STATE_READY){
+		return HAL_BUSY;
+	}
+	if(dma){
+		return HAL_UART_Transmit_DMA(puartHandle, (uint8_t*)cmd, length);
+	}
+	// 10 bits per byte on the wire, plus the margin the driver always used
+	uint32_t timeout = (length * 10000U) / puartHandle->Init.BaudRate + RYLR_UART_TX_TIMEOUT_MS;
+	return HAL_UART_Transmit(puartHandle, (uint8_t*)cmd, length, timeout);
+}
+
+
+/**
+ * @brief  Copies a command into the retransmission buffer and sends it over the UART.
+ *         While a batch is open the command is appended to the buffer instead.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  cmd: Command bytes, may already point to the retransmission buffer.
+ * @param  length: Number of bytes to send.
+ * @param  dma: 1 to send with DMA, 0 to block until the last byte is out.
+ * @retval HAL_StatusTypeDef: HAL_BUSY if a previous DMA transfer is still running.
+ */
+static HAL_StatusTypeDef rylr998_transmit(rylr998_t *hrylr, const uint8_t *cmd, uint16_t length, uint8_t dma){
+
+	if(hrylr->tx_batch){
+		// Queued behind the previous commands, sent by the batch owner in one transfer
+		if(hrylr->tx_length + length > sizeof(hrylr->tx_buffer)){
+			return HAL_ERROR;
+		}
+		memcpy(hrylr->tx_buffer + hrylr->tx_length, cmd, length);
+		hrylr->tx_length += length;
+		hrylr->tx_batch_count++;
+		return HAL_OK;
+	}
+	if(hrylr->huart->gState != HAL_UART_STATE_READY){
+		return HAL_BUSY;
+	}
+	if(length > sizeof(hrylr->tx_buffer)){
+		return HAL_ERROR;
+	}
+	if(cmd != hrylr->tx_buffer){
+		memcpy(hrylr->tx_buffer, cmd, length);
+	}
+	hrylr->tx_length = length;
+	hrylr->tx_dma = dma;
+
+	return rylr998_uart_send(hrylr, hrylr->tx_buffer, length, dma);
+}
+
+
+/**
+ * @brief  Returns the PHY settings being changed by the command just sent, committed on its +OK.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  fields: RYLR_PHY_PARAMETER and/or RYLR_PHY_CRFOP
+ * @retval Pointer to the pending settings
+ */
+static RYLR_phy_t *rylr998_phy_edit(rylr998_t *hrylr, uint8_t fields){
+	if(!hrylr->phy_dirty){
+		hrylr->phy_pending = hrylr->phy;
+	}
+	hrylr->phy_dirty |= fields;
+	return &hrylr->phy_pending;
+}
+
+
+/**
+ * @brief  Commits or drops the pending PHY settings once the command outcome is known.
+ *         After a failure the affected fields are unknown and will be sent again.
+ */
+static void rylr998_phy_settle(rylr998_t *hrylr, RYLR_status_t status){
+	if(status == RYLR_STATUS_OK){
+		hrylr->phy = hrylr->phy_pending;
+		hrylr->phy_valid |= hrylr->phy_dirty;
+	}else{
+		hrylr->phy_valid &= ~hrylr->phy_dirty;
+	}
+	hrylr->phy_dirty = 0;
+}
+
+
+/**
+ * @brief  Replaces the millisecond clock used for response deadlines (HAL_GetTick by default).
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  tick: Function returning a free running millisecond counter, NULL restores HAL_GetTick.
+ */
+void rylr998_SetTickSource(rylr998_t *hrylr, RYLR_tick_fn_t tick){
+	hrylr->tick = (tick != NULL) ? tick : HAL_GetTick;
+}
+
+
+/**
+ * @brief  Parses the lines until the expected response, a +ERR= or the deadline, idling in between.
+ * @retval RYLR_status_t: RYLR_STATUS_OK, RYLR_STATUS_ERR or RYLR_STATUS_TIMEOUT
+ */
+static RYLR_status_t rylr998_wait(rylr998_t *hrylr, RYLR_RX_command_t expected, uint32_t timeout_ms){
+
+	uint32_t start = hrylr->tick();
+
+	while((hrylr->tick() - start) < timeout_ms){
+		if(rylr998_GetInterruptFlag(hrylr)){
+			RYLR_RX_command_t cmd = rylr998_prase_reciver(hrylr);
+			if(cmd == expected){
+				return RYLR_STATUS_OK;
 			}
-		//NETWORKID
-		if(rylr998_networkId(puartHandle,config_handler->networkId)==HAL_OK){
-			while(1){
-				if(rylr998_GetInterruptFlag()){
-					if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_OK){
-						break;
-					}
-				}
+			if(cmd == RYLR_ERR){
+				return RYLR_STATUS_ERR;
 			}
+		}else{
+			rylr998_Idle(hrylr, timeout_ms - (hrylr->tick() - start));
 		}
-		//ADDRESS
-		if(rylr998_setAddress(puartHandle,config_handler->address)==HAL_OK){  //ADDRESS of the device =1
-		while(1){
-				if(rylr998_GetInterruptFlag()){
-					if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_OK){
-						break;
-					}
-				}
+	}
+	return RYLR_STATUS_TIMEOUT;
+}
+
+
+/**
+ * @brief  Restarts the DMA reception from the start of the buffer, dropping any partial line.
+ *         Also recovers the reception after a UART error (overrun, framing) stopped it.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @retval HAL_StatusTypeDef: result of restarting the reception
+ */
+HAL_StatusTypeDef rylr998_resync(rylr998_t *hrylr){
+
+	UART_HandleTypeDef *puartHandle = hrylr->huart;
+
+	HAL_UART_AbortReceive(puartHandle);
+	__HAL_UART_CLEAR_FLAG(puartHandle, UART_CLEAR_OREF | UART_CLEAR_NEF | UART_CLEAR_PEF | UART_CLEAR_FEF);
+
+	memset(hrylr->rx_buff, 0, hrylr->rx_size);
+	hrylr->rx_index = 0;
+	hrylr->dma_index = 0;
+	hrylr->rx_framer.state = RYLR_FRAME_IDLE;
+	rylr998_ClearInterruptFlag(hrylr);
+
+	return HAL_UARTEx_ReceiveToIdle_DMA(puartHandle, hrylr->rx_buff, hrylr->rx_size);
+}
+
+
+/**
+ * @brief  Selects what rylr998_AwaitResponse does when the module answers with a given +ERR= code.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  code: error code reported by the module
+ * @param  action: RYLR_RECOVER_REPORT, RYLR_RECOVER_RETRY, RYLR_RECOVER_RESYNC or RYLR_RECOVER_RESET
+ * @retval HAL_StatusTypeDef: HAL_ERROR if the code is out of range
+ */
+HAL_StatusTypeDef rylr998_SetRecoveryPolicy(rylr998_t *hrylr, RYLR_ERR_code_t code, RYLR_recovery_t action){
+
+	if(code > RYLR_ERR_MAX_CODE){
+		return HAL_ERROR;
+	}
+	hrylr->recovery[code] = action;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Returns the code of the last +ERR= received
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @retval RYLR_ERR_code_t: RYLR_ERR_NONE if no error was received yet
+ */
+RYLR_ERR_code_t rylr998_GetLastError(rylr998_t *hrylr){
+	return hrylr->last_error;
+}
+
+
+/**
+ * @brief  Applies a recovery action before the command is sent again.
+ * @retval HAL_StatusTypeDef: HAL_OK if the command can be retransmitted
+ */
+static HAL_StatusTypeDef rylr998_recover(rylr998_t *hrylr, RYLR_recovery_t action){
+	switch(action){
+		case RYLR_RECOVER_RESYNC:
+			return rylr998_resync(hrylr);
+
+		case RYLR_RECOVER_RESET:
+			// Same command as rylr998_reset, sent around the retransmission buffer so the pending command survives
+			if(rylr998_uart_send(hrylr, (const uint8_t*)"AT+RESET\r\n", 10, 0) != HAL_OK){
+				return HAL_ERROR;
 			}
+			return (rylr998_wait(hrylr, RYLR_RDY, RYLR_RESET_TIMEOUT_MS) == RYLR_STATUS_OK) ? HAL_OK : HAL_ERROR;
+
+		default:
+			return HAL_OK;
+	}
+}
+
+
+/**
+ * @brief  Waits for count responses to the last transfer, retransmitting it on timeout.
+ * @retval RYLR_status_t: see rylr998_AwaitResponse
+ */
+static RYLR_status_t rylr998_await(rylr998_t *hrylr, RYLR_RX_command_t expected, uint8_t count, const RYLR_retry_policy_t *policy){
+
+	if(policy == NULL){
+		policy = &rylr998_default_policy;
+	}
+	hrylr->metrics.commands += count;
+
+	uint32_t backoff = policy->backoff_ms;
+	uint8_t attempt = 0;
+	uint8_t remaining = count;
+
+	while(1){
+		RYLR_recovery_t action = RYLR_RECOVER_RETRY;
+		RYLR_status_t status;
+
+		do{
+			status = rylr998_wait(hrylr, expected, policy->timeout_ms);
+		}while(status == RYLR_STATUS_OK && --remaining > 0);
+
+		if(status == RYLR_STATUS_OK){
+			return status;
 		}
-		//PARAMETERS
-		if(rylr998_setParameter(puartHandle,config_handler->SF,config_handler->BW,config_handler->CR,config_handler->ProgramedPreamble)==HAL_OK){ //SF = 9, BW= 125kHz, CR=1,Programed Preamble = 12 (MAX RANGE CONFIG, also the default factory settings)
-		while(1){
-				if(rylr998_GetInterruptFlag()){
-					if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_OK){
-						break;
-					}
-				}
+		if(status == RYLR_STATUS_ERR){
+			hrylr->metrics.errors++;
+			action = hrylr->recovery[hrylr->last_error <= RYLR_ERR_MAX_CODE ? hrylr->last_error : RYLR_ERR_UNKNOWN_FAILURE];
+			if(action == RYLR_RECOVER_REPORT){
+				return status;
 			}
-		}
-		//MODE
-		if(rylr998_mode(puartHandle,config_handler->mode,config_handler->rxTime,config_handler->LowSpeedTime)==HAL_OK){  //MODE 1, normal
-		while(1){
-				if(rylr998_GetInterruptFlag()){
-					if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_OK){
-						break;
-					}
-				}
+		}else{
+			hrylr->metrics.timeouts++;
+			if(hrylr->huart->RxState != HAL_UART_STATE_BUSY_RX){
+				action = RYLR_RECOVER_RESYNC;
 			}
 		}
-		//BAUD RATE
-		if(rylr998_setBaudRate(puartHandle,config_handler->baudRate)==HAL_OK){
-		while(1){
-			if(rylr998_GetInterruptFlag()){
-					if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_IPR){
-						break;
-					}
-				}
-			}
+
+		if(attempt >= policy->max_retries){
+			return status;
 		}
-		//FREQ Band on FLASH
-		if(rylr998_setBand(puartHandle,config_handler->frequency,config_handler->memory)==HAL_OK){ //Saves it on flash
-		while(1){
-			if(rylr998_GetInterruptFlag()){
-					if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_OK){
-						break;
-					}
-				}
-			}
+		attempt++;
+		hrylr->metrics.retries++;
+
+		// Back off before resending, a late answer still counts
+		if(remaining == 1 && rylr998_wait(hrylr, expected, backoff) == RYLR_STATUS_OK){
+			return RYLR_STATUS_OK;
 		}
-		//PASSWORD
-
-		if(rylr998_setCPIN(puartHandle,config_handler->password)==HAL_OK){
-		while(1){
-			if(rylr998_GetInterruptFlag()){
-					if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_OK){
-						break;
-					}
-				}
-			}
+		backoff <<= 1;
+
+		if(rylr998_recover(hrylr, action) != HAL_OK){
+			return RYLR_STATUS_TX_ERROR;
 		}
-		//RF Output Power must be set to less than AT+CRFOP=14 to comply CE certification.
-		if(rylr998_setCRFOP(puartHandle,config_handler->CRFOP)==HAL_OK){
-		while(1){
-			if(rylr998_GetInterruptFlag()){
-					if(rylr998_prase_reciver(rx_buff,RX_BUFFER_SIZE)==RYLR_OK){
-						break;
-					}
-				}
-			}
+		if(action != RYLR_RECOVER_RETRY){
+			hrylr->metrics.recoveries++;
+		}
+		// The whole transfer goes again, the commands are idempotent
+		remaining = count;
+		if(rylr998_transmit(hrylr, hrylr->tx_buffer, hrylr->tx_length, hrylr->tx_dma) != HAL_OK){
+			return RYLR_STATUS_TX_ERROR;
 		}
+	}
+}
+
+
+/**
+ * @brief  Waits for the response to the last command sent, retransmitting it on timeout.
+ *         The wait before each retransmission starts at backoff_ms and doubles on every retry.
+ *         Lines that do not match (e.g. a +RCV arriving meanwhile) are parsed and skipped.
+ *         A +ERR= answer is handled as set with rylr998_SetRecoveryPolicy, every recovery
+ *         uses one of the retries. A timeout with the reception stopped by a UART error resyncs it.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  expected: response that completes the command (RYLR_OK, RYLR_IPR, RYLR_FACTORY...)
+ * @param  policy: deadline and retries, NULL uses rylr998_default_policy
+ * @retval RYLR_status_t: RYLR_STATUS_OK, RYLR_STATUS_TIMEOUT once the retries are spent,
+ *         RYLR_STATUS_ERR if the module answered +ERR= (code in rylr998_GetLastError),
+ *         RYLR_STATUS_TX_ERROR if the UART failed or the recovery did not succeed.
+ */
+RYLR_status_t rylr998_AwaitResponse(rylr998_t *hrylr, RYLR_RX_command_t expected, const RYLR_retry_policy_t *policy){
+
+	RYLR_status_t status = rylr998_await(hrylr, expected, 1, policy);
+	rylr998_phy_settle(hrylr, status);
+	return status;
+}
+
+
+/**
+ * @brief  Switches the module to a PHY profile, sending only the commands whose settings differ
+ *         from the ones last acknowledged. The commands go out back to back in one UART transfer
+ *         and their +OK are collected afterwards. The peer has to switch to the same profile.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  profile: profile to apply, e.g. rylr998_profile_long_range
+ * @param  latency_ms: if not NULL, time from the call to the last +OK
+ * @retval RYLR_status_t: as rylr998_AwaitResponse, RYLR_STATUS_TX_ERROR if a setting is invalid
+ */
+RYLR_status_t rylr998_applyProfile(rylr998_t *hrylr, const RYLR_profile_t *profile, uint32_t *latency_ms){
+
+	uint32_t start = hrylr->tick();
+	RYLR_status_t status = RYLR_STATUS_OK;
+	HAL_StatusTypeDef ret = HAL_OK;
+
+	if(hrylr->huart->gState != HAL_UART_STATE_READY){
+		return RYLR_STATUS_TX_ERROR;	//tx_buffer still owned by the DMA
+	}
+
+	hrylr->tx_batch = 1;
+	hrylr->tx_batch_count = 0;
+	hrylr->tx_length = 0;
+
+	if(!(hrylr->phy_valid & RYLR_PHY_PARAMETER) ||
+	   hrylr->phy.SF != profile->phy.SF || hrylr->phy.BW != profile->phy.BW ||
+	   hrylr->phy.CR != profile->phy.CR || hrylr->phy.ProgramedPreamble != profile->phy.ProgramedPreamble){
+		ret = rylr998_setParameter(hrylr, profile->phy.SF, profile->phy.BW, profile->phy.CR, profile->phy.ProgramedPreamble);
+	}
+	if(ret == HAL_OK && (!(hrylr->phy_valid & RYLR_PHY_CRFOP) || hrylr->phy.CRFOP != profile->phy.CRFOP)){
+		ret = rylr998_setCRFOP(hrylr, profile->phy.CRFOP);
+	}
+
+	hrylr->tx_batch = 0;
+
+	if(ret != HAL_OK){
+		hrylr->phy_dirty = 0;
+		return RYLR_STATUS_TX_ERROR;
+	}
+	if(hrylr->tx_batch_count > 0){
+		hrylr->tx_dma = 0;
+		if(rylr998_uart_send(hrylr, hrylr->tx_buffer, hrylr->tx_length, 0) != HAL_OK){
+			status = RYLR_STATUS_TX_ERROR;
+		}else{
+			status = rylr998_await(hrylr, RYLR_OK, hrylr->tx_batch_count, NULL);
+		}
+		rylr998_phy_settle(hrylr, status);
+	}
+
+	if(latency_ms != NULL){
+		*latency_ms = hrylr->tick() - start;
+	}
+	return status;
+}
+
+
+/**
+ * @brief  Returns the command counters collected by rylr998_AwaitResponse
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @retval Pointer to the metrics
+ */
+const RYLR_metrics_t *rylr998_GetMetrics(rylr998_t *hrylr){
+	return &hrylr->metrics;
+}
+
+
+/**
+ * @brief  Clears the command counters
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ */
+void rylr998_ResetMetrics(rylr998_t *hrylr){
+	memset(&hrylr->metrics, 0, sizeof(hrylr->metrics));
+}
+
+
+/**
+ * @brief  Configures the RYLR998 module, waiting for the answer of every command.
+ * @param  hrylr: Pointer to the RYLR998 handle, already initialized with rylr998_init
+ * @param  config_handler: Pointer to the config handler
+ * @retval HAL_StatusTypeDef: HAL_OK if every command was acknowledged, HAL_TIMEOUT if the module
+ *         stopped answering, HAL_ERROR if a command was rejected or could not be sent
+ */
+
+HAL_StatusTypeDef rylr998_config(rylr998_t *hrylr, RYLR_config_t *config_handler){
+
+	RYLR_status_t status = RYLR_STATUS_OK;
+
+	//Each step only runs if the previous one was acknowledged
+#define RYLR_CONFIG_STEP(send, expected)																\
+	if(status == RYLR_STATUS_OK){																		\
+		status = ((send) == HAL_OK) ? rylr998_AwaitResponse(hrylr, (expected), NULL) : RYLR_STATUS_TX_ERROR;	\
+	}
+
+	RYLR_CONFIG_STEP(rylr998_FACTORY(hrylr), RYLR_FACTORY);
+	//NETWORKID
+	RYLR_CONFIG_STEP(rylr998_networkId(hrylr,config_handler->networkId), RYLR_OK);
+	//ADDRESS
+	RYLR_CONFIG_STEP(rylr998_setAddress(hrylr,config_handler->address), RYLR_OK);
+	//PARAMETERS
+	RYLR_CONFIG_STEP(rylr998_setParameter(hrylr,config_handler->SF,config_handler->BW,config_handler->CR,config_handler->ProgramedPreamble), RYLR_OK);
+	//MODE
+	RYLR_CONFIG_STEP(rylr998_mode(hrylr,config_handler->mode,config_handler->rxTime,config_handler->LowSpeedTime), RYLR_OK);
+	//BAUD RATE
+	RYLR_CONFIG_STEP(rylr998_setBaudRate(hrylr,config_handler->baudRate), RYLR_IPR);
+	//FREQ Band on FLASH
+	RYLR_CONFIG_STEP(rylr998_setBand(hrylr,config_handler->frequency,config_handler->memory), RYLR_OK);
+	//PASSWORD
+	RYLR_CONFIG_STEP(rylr998_setCPIN(hrylr,config_handler->password), RYLR_OK);
+	//RF Output Power must be set to less than AT+CRFOP=14 to comply CE certification.
+	RYLR_CONFIG_STEP(rylr998_setCRFOP(hrylr,config_handler->CRFOP), RYLR_OK);
+
+#undef RYLR_CONFIG_STEP
+
+	if(status == RYLR_STATUS_OK){
+		return HAL_OK;
+	}
+	return (status == RYLR_STATUS_TIMEOUT) ? HAL_TIMEOUT : HAL_ERROR;
+}
+
+
+
+/**
+ * @brief  Configures the RYLR998 module from a RYLR_CFG_DEFINE configuration. The commands were
+ *         checked and formatted at compile time, each line is sent as is and its answer awaited.
+ * @param  hrylr: Pointer to the RYLR998 handle, already initialized with rylr998_init
+ * @param  config: configuration defined with RYLR_CFG_DEFINE
+ * @retval HAL_StatusTypeDef: as rylr998_config
+ */
+HAL_StatusTypeDef rylr998_configStatic(rylr998_t *hrylr, const RYLR_static_config_t *config){
+
+	// Answer of each line of RYLR_static_config_t.commands, in order
+	static const RYLR_RX_command_t expected[] = {
+		RYLR_FACTORY, RYLR_OK, RYLR_OK, RYLR_OK, RYLR_OK, RYLR_IPR, RYLR_OK, RYLR_OK, RYLR_OK,
+	};
+	const char *line = config->commands;
+	const char *end = config->commands + config->length;
+	RYLR_status_t status = RYLR_STATUS_OK;
+
+	for(uint8_t i = 0; i < sizeof(expected) / sizeof(expected[0]) && line < end && status == RYLR_STATUS_OK; i++){
+		const char *eol = memchr(line, '\n', end - line);
+		uint16_t length = (eol != NULL) ? (eol - line + 1) : (end - line);
+
+		status = (rylr998_transmit(hrylr, (const uint8_t*)line, length, 0) == HAL_OK) ?
+				 rylr998_AwaitResponse(hrylr, expected[i], NULL) : RYLR_STATUS_TX_ERROR;
+		line += length;
+	}
+
+	if(status == RYLR_STATUS_OK){
+		hrylr->phy = config->phy;
+		hrylr->phy_valid = RYLR_PHY_PARAMETER | RYLR_PHY_CRFOP;
+		hrylr->mode = config->mode;
 		return HAL_OK;
+	}
+	hrylr->phy_valid = 0;
+	return (status == RYLR_STATUS_TIMEOUT) ? HAL_TIMEOUT : HAL_ERROR;
 }
 
 
 
+/**
+ * @brief  Settings the module transmits with: the acknowledged ones, the factory ones for the fields not
+ *         acknowledged yet (AT+PARAMETER, AT+CRFOP). Use it for airtime and power, never hrylr->phy directly.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @retval Pointer to the settings, valid until the next call
+ */
+const RYLR_phy_t *rylr998_activePhy(rylr998_t *hrylr){
+
+	RYLR_phy_t *active = &hrylr->phy_active;
+
+	*active = rylr998_factory_phy;
+	if(hrylr->phy_valid & RYLR_PHY_PARAMETER){
+		active->SF = hrylr->phy.SF;
+		active->BW = hrylr->phy.BW;
+		active->CR = hrylr->phy.CR;
+		active->ProgramedPreamble = hrylr->phy.ProgramedPreamble;
+	}
+	if(hrylr->phy_valid & RYLR_PHY_CRFOP){
+		active->CRFOP = hrylr->phy.CRFOP;
+	}
+	return active;
+}
+
+
 /**
  * @brief  Sends data to a specific address on the RYLR998 module using the AT command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  address: The destination address for the data.
  * @param  data: Pointer to the data to be sent.
  * @param  data_length: Length of the data to be sent.
- * @retval HAL_StatusTypeDef: HAL_OK if UART transmission is successful, HAL_ERROR if failed.
+ * @retval HAL_StatusTypeDef: HAL_OK if UART transmission is successful, HAL_BUSY if the previous frame
+ *         is still being sent or the duty cycle budget is spent, HAL_ERROR if failed.
  */
-HAL_StatusTypeDef rylr998_sendData(UART_HandleTypeDef *puartHandle, uint16_t address, uint8_t *data, uint8_t data_length) {
-    HAL_StatusTypeDef ret = HAL_ERROR;
-    uint16_t packetSize = snprintf(NULL, 0, "AT+SEND=%u,%u,", address, data_length) + data_length + 2;  // +2 for \r\n
+HAL_StatusTypeDef rylr998_sendData(rylr998_t *hrylr, uint16_t address, uint8_t *data, uint8_t data_length) {
+    HAL_StatusTypeDef ret;
+    uint32_t airtime = 0;
+    uint16_t frame_length = data_length;
+
+    // The frame is built in place, the DMA reads it after this function returns
+    if (hrylr->huart->gState != HAL_UART_STATE_READY) {
+        return HAL_BUSY;
+    }
 
-    // Allocate buffer dynamically
-    uint8_t *uartTxBuffer = (uint8_t *)malloc(packetSize);
-    if (uartTxBuffer == NULL) {
-        return HAL_ERROR;  // Allocation failed
+    // What goes on air, payload filter (e.g. encryption) included
+    if (hrylr->tx_filter != NULL) {
+        frame_length += hrylr->filter_overhead;
+    }
+    if (frame_length > RYLR_MAX_PAYLOAD) {
+        return HAL_ERROR;
+    }
+
+    airtime = rylr998_timeOnAir(rylr998_activePhy(hrylr), frame_length);
+
+    // Duty cycle: the frame must fit in the remaining airtime
+    if (hrylr->duty.permille != 0) {
+        if (airtime > hrylr->duty.capacity_us) {
+            return HAL_ERROR;  // Never fits, even with a full budget
+        }
+        if (airtime > rylr998_DutyRemaining(hrylr)) {
+            hrylr->duty.deferred++;
+            return HAL_BUSY;
+        }
     }
 
     // Construct the AT command
-    uint16_t offset = snprintf((char*)uartTxBuffer, packetSize, "AT+SEND=%u,%u,", address, data_length);
+    int offset = snprintf((char*)hrylr->tx_buffer, sizeof(hrylr->tx_buffer), "AT+SEND=%u,%u,", address, frame_length);
+    if (offset <= 0 || offset + frame_length + 2 > sizeof(hrylr->tx_buffer)) {
+        return HAL_ERROR;
+    }
 
     // Append data
-    memcpy(uartTxBuffer + offset, data, data_length);
-    offset += data_length;
+    if (hrylr->tx_filter != NULL) {
+        rylr998_ClockFast(hrylr);
+        uint8_t filtered = hrylr->tx_filter(hrylr->filter_ctx, address, data, data_length, hrylr->tx_buffer + offset);
+        rylr998_ClockRelease(hrylr);
+        if (!filtered) {
+            return HAL_ERROR;
+        }
+    } else {
+        memcpy(hrylr->tx_buffer + offset, data, data_length);
+    }
+    offset += frame_length;
 
     // Append command terminator
-    uartTxBuffer[offset++] = '\r';
-    uartTxBuffer[offset++] = '\n';
+    hrylr->tx_buffer[offset++] = '\r';
+    hrylr->tx_buffer[offset++] = '\n';
 
     // Transmit command over UART
-    ret = HAL_UART_Transmit_DMA(puartHandle, uartTxBuffer, offset);
-
-    // Free allocated memory
-    free(uartTxBuffer);
+    ret = rylr998_transmit(hrylr, hrylr->tx_buffer, offset, 1);
 
+    if (ret == HAL_OK) {
+        hrylr->tx_air_us += airtime;
+        if (hrylr->duty.permille != 0) {
+            hrylr->duty.tokens_us -= airtime;
+            hrylr->duty.charged_ms += (airtime + 999U) / 1000U;
+        }
+    }
     return ret;
 }
 
 
 
+
+
+
+/**
+ * @brief  Computes the LoRa time on air of one frame (Semtech SX126x formula, explicit header, CRC on).
+ * @param  phy: radio settings, e.g. rylr998_activePhy(hrylr), BW 7 to 9 and SF 5 to 11
+ * @param  data_length: bytes given to rylr998_sendData
+ * @retval time on air in microseconds
+ */
+uint32_t rylr998_timeOnAir(const RYLR_phy_t *phy, uint8_t data_length){
+
+	uint32_t bw_hz = 125000U << (phy->BW - 7);				//7: 125 kHz, 8: 250 kHz, 9: 500 kHz
+	uint32_t t_sym = ((1000000U << phy->SF) + bw_hz / 2) / bw_hz;	//symbol time in us
+	uint8_t de = (t_sym > 16000U) ? 1 : 0;					//low data rate optimization
+	int32_t payload_bits = 8 * (data_length + RYLR_AIR_HEADER_BYTES) - 4 * phy->SF + 28 + 16;
+	int32_t per_block = 4 * (phy->SF - 2 * de);
+	uint32_t n_payload = 8;
+
+	if(payload_bits > 0){
+		n_payload += ((payload_bits + per_block - 1) / per_block) * (phy->CR + 4);
+	}
+	// (preamble + 4.25) symbols, then the payload symbols
+	return ((phy->ProgramedPreamble * 4U + 17U) * t_sym) / 4U + n_payload * t_sym;
+}
+
+
+
+/**
+ * @brief  Limits the airtime of rylr998_sendData with a token bucket (e.g. EU868: 1% or 0.1% per hour).
+ *         Every frame is charged its time on air with the active SF/BW/CR/preamble; a frame that does not
+ *         fit the remaining budget is refused with HAL_BUSY. The bucket starts full.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  permille: allowed duty cycle in 1/1000 (10: 1%, 1: 0.1%), 0 removes the limit
+ * @param  window_ms: period the duty cycle is measured over, sets the largest burst (window_ms * permille us)
+ * @retval HAL_StatusTypeDef: HAL_ERROR if permille > 1000 or the burst does not fit 32 bits
+ */
+HAL_StatusTypeDef rylr998_SetDutyCycle(rylr998_t *hrylr, uint16_t permille, uint32_t window_ms){
+
+	if(permille > 1000U || (permille != 0 && window_ms > UINT32_MAX / permille)){
+		return HAL_ERROR;
+	}
+	hrylr->duty.permille = permille;
+	hrylr->duty.capacity_us = window_ms * permille;
+	hrylr->duty.tokens_us = hrylr->duty.capacity_us;
+	hrylr->duty.last_refill = hrylr->tick();
+	hrylr->duty.charged_ms = 0;
+	hrylr->duty.deferred = 0;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Returns the airtime that can be sent now.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @retval microseconds of airtime, UINT32_MAX if not limited
+ */
+uint32_t rylr998_DutyRemaining(rylr998_t *hrylr){
+
+	RYLR_duty_t *duty = &hrylr->duty;
+	uint32_t now = hrylr->tick();
+	uint32_t elapsed = now - duty->last_refill;
+
+	if(duty->permille == 0){
+		return UINT32_MAX;
+	}
+	if(elapsed >= (duty->capacity_us - duty->tokens_us) / duty->permille + 1U){
+		duty->tokens_us = duty->capacity_us;
+	}else{
+		duty->tokens_us += elapsed * duty->permille;
+	}
+	duty->last_refill = now;
+	return duty->tokens_us;
+}
+
+
+/**
+ * @brief  Returns how long until a frame fits the duty cycle budget.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  data_length: bytes that will be given to rylr998_sendData
+ * @retval milliseconds to wait, 0 if it can be sent now, UINT32_MAX if it never fits
+ */
+uint32_t rylr998_DutyWaitMs(rylr998_t *hrylr, uint8_t data_length){
+
+	uint32_t remaining = rylr998_DutyRemaining(hrylr);
+	uint32_t airtime;
+
+	if(hrylr->duty.permille == 0){
+		return 0;
+	}
+	airtime = rylr998_timeOnAir(rylr998_activePhy(hrylr), data_length + hrylr->filter_overhead);
+	if(airtime > hrylr->duty.capacity_us){
+		return UINT32_MAX;
+	}
+	if(airtime <= remaining){
+		return 0;
+	}
+	return (airtime - remaining + hrylr->duty.permille - 1U) / hrylr->duty.permille;
+}
+
+
+/**
+ * @brief  Moves the UART kernel clock to HSI16, HAL_UART_Init derives the baud rate register from it.
+ *         The reception is stopped, restart it with rylr998_resync.
+ */
+static HAL_StatusTypeDef rylr998_uart_hsi(rylr998_t *hrylr){
+
+	UART_HandleTypeDef *huart = hrylr->huart;
+	RCC_PeriphCLKInitTypeDef clock = {0};
+	UART_ClockSourceTypeDef source;
+
+	HAL_UART_Abort(huart);
+	UART_GETCLOCKSOURCE(huart, source);
+	if(source == UART_CLOCKSOURCE_HSI){
+		return HAL_OK;		//already there, keep the Stop mode wakeup settings
+	}
+
+	if(huart->Instance == LPUART1){
+		clock.PeriphClockSelection = RCC_PERIPHCLK_LPUART1;
+		clock.Lpuart1ClockSelection = RCC_LPUART1CLKSOURCE_HSI;
+	}else if(huart->Instance == USART2){
+		clock.PeriphClockSelection = RCC_PERIPHCLK_USART2;
+		clock.Usart2ClockSelection = RCC_USART2CLKSOURCE_HSI;
+	}else{
+		return HAL_ERROR;
+	}
+
+	if(HAL_RCCEx_PeriphCLKConfig(&clock) != HAL_OK || HAL_UART_Init(huart) != HAL_OK){
+		return HAL_ERROR;
+	}
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Lets the MCU wait for the module in Stop mode instead of polling at full speed.
+ *         The UART is moved to HSI16, which it can request in Stop, and wakes the MCU on the start bit of
+ *         the next line. LPUART1 (or USART2) keeps the baud rate whatever the system clock. LPTIM1 ends
+ *         the Stop at the deadline and gives the time slept, added to the HAL tick.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  resume: restores the system clock after Stop, NULL to wait in Sleep mode only. It must leave the
+ *         UART kernel clock alone (no HAL_RCCEx_PeriphCLKConfig), back on PCLK the baud rate would be wrong.
+ * @retval HAL_StatusTypeDef: HAL_ERROR if the UART cannot wake from Stop or fails to restart
+ */
+HAL_StatusTypeDef rylr998_EnableStopMode(rylr998_t *hrylr, RYLR_resume_fn_t resume){
+
+	UART_HandleTypeDef *huart = hrylr->huart;
+	UART_WakeUpTypeDef wakeup = {0};
+
+	hrylr->stop.resume = NULL;
+	if(resume == NULL){
+		return HAL_OK;
+	}
+	wakeup.WakeUpEvent = UART_WAKEUP_ON_STARTBIT;
+
+	if(rylr998_uart_hsi(hrylr) != HAL_OK ||
+	   HAL_UARTEx_StopModeWakeUpSourceConfig(huart, wakeup) != HAL_OK ||
+	   HAL_UARTEx_EnableClockStopMode(huart) != HAL_OK){
+		return HAL_ERROR;
+	}
+
+	// Wake up on HSI16 without waiting for VREFINT: the first byte arrives one character time after the start bit
+	__HAL_RCC_PWR_CLK_ENABLE();
+	__HAL_RCC_WAKEUPSTOP_CLK_CONFIG(RCC_STOP_WAKEUPCLOCK_HSI);
+	HAL_PWREx_EnableUltraLowPower();
+	HAL_PWREx_EnableFastWakeUp();
+
+	// LPTIM1 counts the Stop time, there is no HAL driver for it in this project
+#if RYLR_STOP_LPTIM_LSE
+	__HAL_RCC_LPTIM1_CONFIG(RCC_LPTIM1CLKSOURCE_LSE);
+#else
+	__HAL_RCC_LSI_ENABLE();
+	while(__HAL_RCC_GET_FLAG(RCC_FLAG_LSIRDY) == 0U){
+	}
+	__HAL_RCC_LPTIM1_CONFIG(RCC_LPTIM1CLKSOURCE_LSI);
+#endif
+	__HAL_RCC_LPTIM1_CLK_ENABLE();
+	LPTIM1->CR = 0;
+	LPTIM1->CFGR = LPTIM_CFGR_PRESC_2 | LPTIM_CFGR_PRESC_0;	//clock / 32
+	LPTIM1->IER = LPTIM_IER_ARRMIE;
+
+	hrylr->stop.resume = resume;
+	return rylr998_resync(hrylr);
+}
+
+
+/**
+ * @brief  Derives the baud rate register again from the UART kernel clock, as HAL_UART_Init does.
+ *         Needed after a change of the clock the UART runs from (PCLK or SYSCLK), nothing is written
+ *         when the value stays the same (HSI16, LSE). The reception carries on.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @retval HAL_StatusTypeDef: HAL_ERROR if the baud rate cannot be reached from the kernel clock
+ */
+HAL_StatusTypeDef rylr998_UpdateBaudRate(rylr998_t *hrylr){
+
+	UART_HandleTypeDef *huart = hrylr->huart;
+	uint32_t baud = huart->Init.BaudRate;
+	UART_ClockSourceTypeDef source;
+	uint32_t fck, div, brr;
+
+	UART_GETCLOCKSOURCE(huart, source);
+	switch(source){
+		case UART_CLOCKSOURCE_PCLK1:	fck = HAL_RCC_GetPCLK1Freq(); break;
+		case UART_CLOCKSOURCE_PCLK2:	fck = HAL_RCC_GetPCLK2Freq(); break;
+		case UART_CLOCKSOURCE_SYSCLK:	fck = HAL_RCC_GetSysClockFreq(); break;
+		case UART_CLOCKSOURCE_LSE:		fck = LSE_VALUE; break;
+		case UART_CLOCKSOURCE_HSI:
+			fck = (__HAL_RCC_GET_FLAG(RCC_FLAG_HSIDIV) != 0U) ? (HSI_VALUE >> 2U) : HSI_VALUE;
+			break;
+		default:
+			return HAL_ERROR;
+	}
+
+	// Same limits as UART_SetConfig
+	if(UART_INSTANCE_LOWPOWER(huart)){
+		if(fck < 3U * baud || fck / 4096U > baud){
+			return HAL_ERROR;
+		}
+		brr = (uint32_t)UART_DIV_LPUART(fck, baud);
+		if(brr < 0x300U || brr > 0xFFFFFU){
+			return HAL_ERROR;
+		}
+	}else{
+		div = (huart->Init.OverSampling == UART_OVERSAMPLING_8) ? UART_DIV_SAMPLING8(fck, baud) :
+																  UART_DIV_SAMPLING16(fck, baud);
+		if(div < 0x10U || div > 0xFFFFU){
+			return HAL_ERROR;
+		}
+		brr = (huart->Init.OverSampling == UART_OVERSAMPLING_8) ? ((div & 0xFFF0U) | ((div & 0x000FU) >> 1U)) : div;
+	}
+
+	if(huart->Instance->BRR != brr){
+		// BRR is only written with the UART disabled, the DMA keeps its position
+		__HAL_UART_DISABLE(huart);
+		huart->Instance->BRR = brr;
+		__HAL_UART_ENABLE(huart);
+	}
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Runs a system clock configuration function, then fits the baud rate to the UART kernel clock.
+ *         The function must not select the kernel clock itself, the UART would run at the wrong baud rate
+ *         until the baud rate register is written again.
+ */
+static void rylr998_clock_run(rylr998_t *hrylr, RYLR_resume_fn_t configure){
+
+	configure();
+	rylr998_UpdateBaudRate(hrylr);
+}
+
+
+/**
+ * @brief  Runs the system from MSI and stops the PLL. HAL_RCC_ClockConfig sets the flash latency and SysTick.
+ */
+static void rylr998_clock_slow(rylr998_t *hrylr){
+
+	RYLR_clock_t *clock = &hrylr->clock;
+	RCC_OscInitTypeDef osc = {0};
+	RCC_ClkInitTypeDef clk = {0};
+
+	osc.OscillatorType = RCC_OSCILLATORTYPE_MSI;
+	osc.MSIState = RCC_MSI_ON;
+	osc.MSICalibrationValue = RCC_MSICALIBRATION_DEFAULT;
+	osc.MSIClockRange = clock->msi_range;
+	osc.PLL.PLLState = RCC_PLL_NONE;
+
+	clk.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+	clk.SYSCLKSource = RCC_SYSCLKSOURCE_MSI;
+	clk.AHBCLKDivider = RCC_SYSCLK_DIV1;
+	clk.APB1CLKDivider = RCC_HCLK_DIV1;
+	clk.APB2CLKDivider = RCC_HCLK_DIV1;
+
+	if(HAL_RCC_OscConfig(&osc) != HAL_OK || HAL_RCC_ClockConfig(&clk, FLASH_LATENCY_0) != HAL_OK){
+		clock->failures++;
+		return;
+	}
+
+	// The fast clock starts it again
+	osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+	osc.PLL.PLLState = RCC_PLL_OFF;
+	HAL_RCC_OscConfig(&osc);
+
+	clock->slow_entries++;
+	rylr998_UpdateBaudRate(hrylr);
+}
+
+
+/**
+ * @brief  Lets the MCU run from MSI while it waits for the module (responses, airtime) and go back to the
+ *         full speed clock only for the work done between rylr998_ClockFast and rylr998_ClockRelease:
+ *         payload filters (encryption) and the receive callback are bracketed by the driver.
+ *         The drop to MSI is deferred to the next rylr998_Idle, so back to back bursts switch once.
+ *         The UART is moved to HSI16 and keeps its baud rate whatever the system clock.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  fast: sets the full speed clock without touching the UART kernel clock (no HAL_RCCEx_PeriphCLKConfig),
+ *         NULL to stop scaling and stay at full speed
+ * @param  msi_range: RCC_MSIRANGE_x used while waiting, RCC_MSIRANGE_5 (2.1 MHz) or above keeps up with the
+ *         DMA at 115200 baud. RYLR_CLOCK_MSI_RANGE by default.
+ * @retval HAL_StatusTypeDef: HAL_ERROR if the range is not valid or the UART fails to restart
+ */
+HAL_StatusTypeDef rylr998_EnableClockScaling(rylr998_t *hrylr, RYLR_resume_fn_t fast, uint32_t msi_range){
+
+	RYLR_clock_t *clock = &hrylr->clock;
+
+	if(fast == NULL){
+		if(clock->fast != NULL && __HAL_RCC_GET_SYSCLK_SOURCE() == RCC_SYSCLKSOURCE_STATUS_MSI){
+			rylr998_clock_run(hrylr, clock->fast);
+		}
+		clock->fast = NULL;
+		return HAL_OK;
+	}
+	if(!IS_RCC_MSI_CLOCK_RANGE(msi_range)){
+		return HAL_ERROR;
+	}
+
+	if(rylr998_uart_hsi(hrylr) != HAL_OK){
+		return HAL_ERROR;
+	}
+	clock->fast = fast;
+	clock->msi_range = msi_range;
+	clock->depth = 0;
+	return rylr998_resync(hrylr);
+}
+
+
+/**
+ * @brief  Starts a burst of work at full speed (parsing, crypto, compression). Calls nest, every one
+ *         must be matched by rylr998_ClockRelease. Does nothing when scaling is off.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ */
+void rylr998_ClockFast(rylr998_t *hrylr){
+
+	RYLR_clock_t *clock = &hrylr->clock;
+
+	if(clock->fast == NULL){
+		return;
+	}
+	if(clock->depth < UINT8_MAX){
+		clock->depth++;
+	}
+	if(__HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_PLLCLK){
+		rylr998_clock_run(hrylr, clock->fast);
+		clock->fast_entries++;
+	}
+}
+
+
+/**
+ * @brief  Ends a burst started by rylr998_ClockFast. The clock stays fast until the next rylr998_Idle.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ */
+void rylr998_ClockRelease(rylr998_t *hrylr){
+	if(hrylr->clock.depth > 0){
+		hrylr->clock.depth--;
+	}
+}
+
+
+/**
+ * @brief  Returns whether the UART is quiet: nothing being sent or received, every byte received framed
+ */
+static uint8_t rylr998_uart_quiet(rylr998_t *hrylr){
+
+	UART_HandleTypeDef *huart = hrylr->huart;
+	uint16_t dma_pos = (hrylr->rx_size - __HAL_DMA_GET_COUNTER(huart->hdmarx)) % hrylr->rx_size;
+
+	return huart->gState == HAL_UART_STATE_READY && __HAL_UART_GET_FLAG(huart, UART_FLAG_TC) &&
+		   !__HAL_UART_GET_FLAG(huart, UART_FLAG_BUSY) && dma_pos == hrylr->dma_index &&
+		   hrylr->rx_framer.state == RYLR_FRAME_IDLE;
+}
+
+
+/**
+ * @brief  Sleeps until the module sends something or max_ms elapse, whichever comes first.
+ *         Returns at once if lines are waiting to be parsed. Uses Stop mode when rylr998_EnableStopMode
+ *         was called and the UART is quiet, Sleep mode otherwise (any interrupt, SysTick included, wakes it).
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  max_ms: longest wait, Stop mode is limited to RYLR_STOP_MAX_MS per call
+ */
+void rylr998_Idle(rylr998_t *hrylr, uint32_t max_ms){
+
+	RYLR_stop_t *stop = &hrylr->stop;
+	uint32_t ticks, count;
+
+	if(max_ms == 0 || rylr998_GetInterruptFlag(hrylr)){
+		return;
+	}
+	// Wait on MSI unless a burst holds the full speed clock
+	if(hrylr->clock.fast != NULL && hrylr->clock.depth == 0 &&
+	   __HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_MSI){
+		rylr998_clock_slow(hrylr);
+	}
+	if(max_ms > RYLR_STOP_MAX_MS){
+		max_ms = RYLR_STOP_MAX_MS;
+	}
+	ticks = (max_ms * RYLR_STOP_LPTIM_HZ) / 1000U;
+
+	if(stop->resume == NULL || max_ms < RYLR_STOP_MIN_MS || ticks < 2U || !rylr998_uart_quiet(hrylr)){
+		stop->sleep_entries++;
+		HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+		return;
+	}
+
+	// Arm the deadline: ARR is written with the timer enabled, then one shot
+	LPTIM1->CR = LPTIM_CR_ENABLE;
+	LPTIM1->ICR = LPTIM_ICR_ARRMCF | LPTIM_ICR_ARROKCF;
+	LPTIM1->ARR = ticks;
+	while((LPTIM1->ISR & LPTIM_ISR_ARROK) == 0U){
+	}
+	LPTIM1->ICR = LPTIM_ICR_ARROKCF;
+	LPTIM1->CR = LPTIM_CR_ENABLE | LPTIM_CR_SNGSTRT;
+
+	// Interrupts stay masked across Stop: pending ones still end the WFI, they are taken after the clock is back
+	__disable_irq();
+	if(rylr998_GetInterruptFlag(hrylr) || !rylr998_uart_quiet(hrylr)){
+		__enable_irq();
+		LPTIM1->CR = 0;
+		return;		//a line came in while arming
+	}
+	HAL_UARTEx_EnableStopMode(hrylr->huart);
+	// The start bit only ends the WFI through the wakeup interrupt, UESM alone keeps the MCU in Stop
+	__HAL_UART_CLEAR_FLAG(hrylr->huart, UART_CLEAR_WUF);
+	__HAL_UART_ENABLE_IT(hrylr->huart, UART_IT_WUF);
+	NVIC_EnableIRQ((hrylr->huart->Instance == LPUART1) ? LPUART1_IRQn : USART2_IRQn);
+	NVIC_ClearPendingIRQ(LPTIM1_IRQn);
+	NVIC_EnableIRQ(LPTIM1_IRQn);		//only to end the WFI, disabled again before it can be taken
+	HAL_SuspendTick();
+
+	HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+
+	NVIC_DisableIRQ(LPTIM1_IRQn);
+	if(LPTIM1->ISR & LPTIM_ISR_ARRM){
+		count = ticks;
+	}else{
+		// Asynchronous counter: read until two reads agree
+		do{
+			count = LPTIM1->CNT;
+		}while(count != LPTIM1->CNT);
+		stop->early_wakeups++;
+	}
+	LPTIM1->CR = 0;
+	NVIC_ClearPendingIRQ(LPTIM1_IRQn);
+	__HAL_UART_DISABLE_IT(hrylr->huart, UART_IT_WUF);
+	__HAL_UART_CLEAR_FLAG(hrylr->huart, UART_CLEAR_WUF);
+	HAL_UARTEx_DisableStopMode(hrylr->huart);
+
+	// SysTick was stopped, catch the HAL tick up
+	uint32_t slept_ms = (count * 1000U) / RYLR_STOP_LPTIM_HZ;
+	for(uint32_t i = 0; i < slept_ms; i++){
+		HAL_IncTick();
+	}
+	stop->stop_ms += slept_ms;
+	stop->entries++;
+
+	HAL_ResumeTick();
+	__enable_irq();
+	// Woken up on HSI16: back to MSI while scaling allows it, to the full speed clock otherwise
+	if(hrylr->clock.fast != NULL && hrylr->clock.depth == 0){
+		rylr998_clock_slow(hrylr);
+	}else{
+		rylr998_clock_run(hrylr, stop->resume);
+	}
+}
+
+
 /**
  * @brief  Sets the network ID for the RYLR998 module using the AT command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  networkId: The network ID to be set (valid range: 3-15, 18).
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if validation fails or memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_networkId(UART_HandleTypeDef *puartHandle, uint8_t networkId) {
+HAL_StatusTypeDef rylr998_networkId(rylr998_t *hrylr, uint8_t networkId) {
     HAL_StatusTypeDef ret = HAL_ERROR;
     char uartTxBuffer[20] = {0};  // Enough for "AT+NETWORKID=XX\r\n"
 
@@ -178,7 +1105,7 @@ HAL_StatusTypeDef rylr998_networkId(UART_HandleTypeDef *puartHandle, uint8_t net
         }
 
         // Transmit the AT command over UART
-        ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+        ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
     }
 
     return ret;
@@ -186,12 +1113,12 @@ HAL_StatusTypeDef rylr998_networkId(UART_HandleTypeDef *puartHandle, uint8_t net
 
 /**
  * @brief  Sets the address for the RYLR998 module using the AT command. Saves in the FLASH
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  address: The address to be set on the RYLR998 module.
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_setAddress(UART_HandleTypeDef *puartHandle, uint16_t address){
+HAL_StatusTypeDef rylr998_setAddress(rylr998_t *hrylr, uint16_t address){
 	    HAL_StatusTypeDef ret = HAL_ERROR;
 	    char uartTxBuffer[20] = {0};  // Enough size for "AT+ADDRESS=XXXXX\n"
 
@@ -203,14 +1130,14 @@ HAL_StatusTypeDef rylr998_setAddress(UART_HandleTypeDef *puartHandle, uint16_t a
 	    }
 
 	    // Transmit the AT command over UART
-	    ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+	    ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
 
 	    return ret;
 }
 
 /**
  * @brief  Sets the RYLR998 module's parameters using the AT command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  SF: Spreading Factor (valid range: 5-11).
  * @param  BW: Bandwidth (valid range: 7-9).
  * @param  CR: Coding Rate (valid range: 1-4).
@@ -218,7 +1145,7 @@ HAL_StatusTypeDef rylr998_setAddress(UART_HandleTypeDef *puartHandle, uint16_t a
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if validation fails or memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_setParameter(UART_HandleTypeDef *puartHandle, uint8_t SF, uint8_t BW, uint8_t CR, uint8_t ProgramedPreamble) {
+HAL_StatusTypeDef rylr998_setParameter(rylr998_t *hrylr, uint8_t SF, uint8_t BW, uint8_t CR, uint8_t ProgramedPreamble) {
     HAL_StatusTypeDef ret = HAL_ERROR;
     char uartTxBuffer[25] = {0};  // Enough size for "AT+PARAMETER=%u,%u,%u,%u\r\n"
 
@@ -245,7 +1172,15 @@ HAL_StatusTypeDef rylr998_setParameter(UART_HandleTypeDef *puartHandle, uint8_t
     }
 
     // Transmit the command over UART
-    ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+    ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
+
+    if (ret == HAL_OK) {
+        RYLR_phy_t *phy = rylr998_phy_edit(hrylr, RYLR_PHY_PARAMETER);
+        phy->SF = SF;
+        phy->BW = BW;
+        phy->CR = CR;
+        phy->ProgramedPreamble = ProgramedPreamble;
+    }
 
     return ret;
 }
@@ -253,11 +1188,11 @@ HAL_StatusTypeDef rylr998_setParameter(UART_HandleTypeDef *puartHandle, uint8_t
 
 /**
  * @brief  Resets the RYLR998 module using the AT+RESET command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @retval HAL_StatusTypeDef: HAL_OK if the reset command is successfully transmitted, HAL_ERROR if memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_reset(UART_HandleTypeDef *puartHandle) {
+HAL_StatusTypeDef rylr998_reset(rylr998_t *hrylr) {
 	  HAL_StatusTypeDef ret = HAL_ERROR;
 	    char uartTxBuffer[11] = {0};  // Enough size for "AT+RESET\r\n"
 
@@ -270,7 +1205,7 @@ HAL_StatusTypeDef rylr998_reset(UART_HandleTypeDef *puartHandle) {
 	    }
 
 	    // Transmit the AT command over UART
-	    ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+	    ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
 
 	    return ret;
 }
@@ -278,14 +1213,14 @@ HAL_StatusTypeDef rylr998_reset(UART_HandleTypeDef *puartHandle) {
 
 /**
  * @brief  Sets the RYLR998 module's operating mode using the AT command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  mode: The mode to be set (valid values: 0, 1, or 2).
  * @param  rxTime: The receive time in milliseconds (valid range: 30-60000).
  * @param  LowSpeedTime: The low-speed time in milliseconds (valid range: 30-60000).
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if validation fails or memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_mode(UART_HandleTypeDef *puartHandle, uint8_t mode, uint32_t rxTime, uint32_t LowSpeedTime) {
+HAL_StatusTypeDef rylr998_mode(rylr998_t *hrylr, uint8_t mode, uint32_t rxTime, uint32_t LowSpeedTime) {
     HAL_StatusTypeDef ret = HAL_ERROR;
     char uartTxBuffer[30] = {0};  //
 
@@ -317,18 +1252,23 @@ HAL_StatusTypeDef rylr998_mode(UART_HandleTypeDef *puartHandle, uint8_t mode, ui
               return HAL_ERROR;  // snprintf error or buffer overflow prevention
           }
 
-     ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+     ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
+     if (ret == HAL_OK) {
+         hrylr->mode = mode;
+         hrylr->mode_rx_ms = (mode == 2) ? (uint16_t)rxTime : 0;
+         hrylr->mode_sleep_ms = (mode == 2) ? (uint16_t)LowSpeedTime : 0;
+     }
      return ret;
 }
 
 /**
  * @brief  Sets the baud rate for the RYLR998 module using the AT command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  baudRate: The baud rate to be set (valid range: 1200-115200).
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if the baud rate is invalid or memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_setBaudRate(UART_HandleTypeDef *puartHandle, uint32_t baudRate) {
+HAL_StatusTypeDef rylr998_setBaudRate(rylr998_t *hrylr, uint32_t baudRate) {
     HAL_StatusTypeDef ret = HAL_ERROR;
     char uartTxBuffer[16] = {0};
 
@@ -343,7 +1283,7 @@ HAL_StatusTypeDef rylr998_setBaudRate(UART_HandleTypeDef *puartHandle, uint32_t
 		return HAL_ERROR;  // snprintf error or overflow prevention
 	}
 
-	ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+	ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
 
 	return ret;
 }
@@ -351,12 +1291,12 @@ HAL_StatusTypeDef rylr998_setBaudRate(UART_HandleTypeDef *puartHandle, uint32_t
 
 /**
  * @brief  Sets the frequency band for the RYLR998 module using the AT command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  frequency: The frequency to be set (valid range: 862000000-1020000000 Hz).
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if the frequency is invalid or memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_setBand(UART_HandleTypeDef *puartHandle, uint32_t frequency,uint8_t memory) {
+HAL_StatusTypeDef rylr998_setBand(rylr998_t *hrylr, uint32_t frequency,uint8_t memory) {
     HAL_StatusTypeDef ret = HAL_ERROR;
     char uartTxBuffer[22] = {0};
     int packetSize=0;
@@ -378,7 +1318,7 @@ HAL_StatusTypeDef rylr998_setBand(UART_HandleTypeDef *puartHandle, uint32_t freq
 	}
 
 	// Transmit the AT command over UART
-	ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+	ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
 
 	return ret;
 }
@@ -387,12 +1327,12 @@ HAL_StatusTypeDef rylr998_setBand(UART_HandleTypeDef *puartHandle, uint32_t freq
 
 /**
  * @brief  Sets the PIN for the RYLR998 module using the AT command
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  password: Pointer to the 8-character password to be set,  from 00000000 to FFFFFFFF
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if the password length is invalid or memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_setCPIN(UART_HandleTypeDef *puartHandle, const char *password) {
+HAL_StatusTypeDef rylr998_setCPIN(rylr998_t *hrylr, const char *password) {
     HAL_StatusTypeDef ret = HAL_ERROR;
     char uartTxBuffer[24] = {0};  // Aumenté el tamaño para mayor seguridad
 
@@ -410,7 +1350,7 @@ HAL_StatusTypeDef rylr998_setCPIN(UART_HandleTypeDef *puartHandle, const char *p
     }
 
     // Enviar el comando AT por UART
-    ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 100);
+    ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
 
     return ret;
 }
@@ -418,12 +1358,12 @@ HAL_StatusTypeDef rylr998_setCPIN(UART_HandleTypeDef *puartHandle, const char *p
 
 /**
  * @brief  Sets the CRFOP (Coding Rate and Frequency Offset) value for the RYLR998 module using the AT command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @param  CRFOP: The CRFOP value to be set (must be between 0 and 22).
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if the CRFOP value is invalid or memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_setCRFOP(UART_HandleTypeDef *puartHandle, uint8_t CRFOP){ //TODO check if it works
+HAL_StatusTypeDef rylr998_setCRFOP(rylr998_t *hrylr, uint8_t CRFOP){ //TODO check if it works
 	    HAL_StatusTypeDef ret = HAL_ERROR;
 	    char uartTxBuffer[14] = {0};
 	    if(CRFOP>22){
@@ -440,18 +1380,22 @@ HAL_StatusTypeDef rylr998_setCRFOP(UART_HandleTypeDef *puartHandle, uint8_t CRFO
 	  		return HAL_ERROR;  // snprintf error or overflow prevention
 	  	}
 
-	  	ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+	  	ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
+
+	  	if (ret == HAL_OK) {
+	  		rylr998_phy_edit(hrylr, RYLR_PHY_CRFOP)->CRFOP = CRFOP;
+	  	}
 
 	  	return ret;
 }
 
 /**
  * @brief  Resets the RYLR998 module to its factory default settings using the AT command.
- * @param  puartHandle: Pointer to the UART handle used for communication.
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @retval HAL_StatusTypeDef: HAL_OK if the command is successfully transmitted, HAL_ERROR if memory allocation fails.
  *
  */
-HAL_StatusTypeDef rylr998_FACTORY(UART_HandleTypeDef *puartHandle) {
+HAL_StatusTypeDef rylr998_FACTORY(rylr998_t *hrylr) {
     HAL_StatusTypeDef ret = HAL_ERROR;
 
     char uartTxBuffer[12] = {0};
@@ -465,41 +1409,165 @@ HAL_StatusTypeDef rylr998_FACTORY(UART_HandleTypeDef *puartHandle) {
 	}
 
 
-	ret = HAL_UART_Transmit(puartHandle, (uint8_t*)uartTxBuffer, packetSize, 10);
+	ret = rylr998_transmit(hrylr, (uint8_t*)uartTxBuffer, packetSize, 0);
+
+	if (ret == HAL_OK) {
+		*rylr998_phy_edit(hrylr, RYLR_PHY_PARAMETER | RYLR_PHY_CRFOP) = rylr998_factory_phy;
+	}
 
 	return ret;
 }
 
 
-uint8_t rylr998_interrupt_flag;
+/**
+ * @brief  Advances the line framing by one received byte. A +RCV line is delimited by its
+ *         length field rather than by the first '\n', so binary payloads are framed correctly.
+ * @param  framer: framing state
+ * @param  c: received byte
+ * @retval 1 when c ends a line
+ */
+static uint8_t rylr998_frame_step(RYLR_framer_t *framer, uint8_t c){
+
+	static const char rcv_head[] = "+RCV=";
+
+	switch(framer->state){
+		case RYLR_FRAME_IDLE:			//responses start with '+', anything else is noise
+			if(c == '+'){
+				framer->state = RYLR_FRAME_HEAD;
+				framer->count = 1;
+			}
+			return 0;
+
+		case RYLR_FRAME_HEAD:
+			if(c == (uint8_t)rcv_head[framer->count]){
+				if(++framer->count == sizeof(rcv_head) - 1){
+					framer->state = RYLR_FRAME_ADDRESS;
+				}
+				return 0;
+			}
+			framer->state = RYLR_FRAME_LINE;
+			break;
+
+		case RYLR_FRAME_ADDRESS:
+			if(c == ','){
+				framer->state = RYLR_FRAME_LENGTH;
+				framer->count = 0;
+				return 0;
+			}
+			break;
+
+		case RYLR_FRAME_LENGTH:
+			if(c >= '0' && c <= '9'){
+				framer->count = framer->count * 10 + (c - '0');
+				return 0;
+			}
+			if(c == ','){
+				framer->state = framer->count ? RYLR_FRAME_DATA : RYLR_FRAME_LINE;
+				return 0;
+			}
+			break;
+
+		case RYLR_FRAME_DATA:			//payload bytes are never delimiters
+			if(--framer->count == 0){
+				framer->state = RYLR_FRAME_LINE;
+			}
+			return 0;
+
+		default:
+			break;
+	}
+
+	if(c == '\n'){
+		framer->state = RYLR_FRAME_IDLE;
+		return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief  Feeds a HAL_UARTEx_RxEventCallback into the handle, call it for the UART of this handle.
+ *         Counts the complete lines the DMA wrote since the previous event.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  Size: position of the DMA in the reception buffer, as given by the HAL
+ */
+void rylr998_RxEventCallback(rylr998_t *hrylr, uint16_t Size){
+
+	uint16_t dma_pos = (Size >= hrylr->rx_size) ? 0 : Size;
+
+	while(hrylr->dma_index != dma_pos){
+		if(rylr998_frame_step(&hrylr->rx_framer, hrylr->rx_buff[hrylr->dma_index])){
+			hrylr->rx_ticks[hrylr->rx_lines % RYLR_LINE_TICKS] = hrylr->tick();
+			rylr998_SetInterruptFlag(hrylr);
+		}
+		hrylr->dma_index = (hrylr->dma_index + 1) % hrylr->rx_size;
+	}
+
+	// Circular DMA keeps running, only restart it if the HAL stopped it
+	if(hrylr->huart->RxState == HAL_UART_STATE_READY){
+		HAL_UARTEx_ReceiveToIdle_DMA(hrylr->huart, hrylr->rx_buff, hrylr->rx_size);
+	}
+}
 
 
 /**
- * @brief  Sets IRQ flag whenever new data gets into gets recived in the Rx buffer
+ * @brief  Installs a payload filter between the application and the air, e.g. encryption.
+ *         rylr998_sendData passes every payload through tx and sends length + overhead bytes,
+ *         the parser passes every +RCV through rx before the receive callback.
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  tx: writes length + overhead bytes to out, returns 0 to refuse the frame; NULL to remove
+ * @param  rx: rewrites the packet in place, returns 0 to drop it
+ * @param  overhead: bytes tx adds to every payload
+ * @param  ctx: passed to both
+ */
+void rylr998_SetPayloadFilter(rylr998_t *hrylr, RYLR_tx_filter_t tx, RYLR_rx_filter_t rx, uint8_t overhead, void *ctx){
+
+	hrylr->tx_filter = tx;
+	hrylr->rx_filter = rx;
+	hrylr->filter_overhead = (tx != NULL) ? overhead : 0;
+	hrylr->filter_ctx = ctx;
+}
+
+
+/**
+ * @brief  Registers a function called by the parser on every +RCV, with the packet already decoded
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @param  callback: function to call, NULL to disable
+ */
+void rylr998_SetRxCallback(rylr998_t *hrylr, RYLR_rx_callback_t callback){
+	hrylr->rx_callback = callback;
+}
+
+
+/**
+ * @brief  Signals that a complete line is waiting in the Rx buffer
+ * @param  hrylr: Pointer to the RYLR998 handle.
  *
  */
-void rylr998_SetInterruptFlag(void){
-	rylr998_interrupt_flag =1;
+void rylr998_SetInterruptFlag(rylr998_t *hrylr){
+	hrylr->rx_lines++;
 }
 
 
 
 /**
- * @brief  Returns the value of the flag
+ * @brief  Returns whether lines are waiting to be parsed
+ * @param  hrylr: Pointer to the RYLR998 handle.
  * @retval flag status
  *
  */
-uint8_t rylr998_GetInterruptFlag(void){
-	return rylr998_interrupt_flag;
+uint8_t rylr998_GetInterruptFlag(rylr998_t *hrylr){
+	return hrylr->rx_lines != hrylr->rx_parsed;
 }
 
 
 /**
- * @brief  Clear the IRQ flag
+ * @brief  Drops every line waiting to be parsed
+ * @param  hrylr: Pointer to the RYLR998 handle.
  *
  */
-void rylr998_ClearInterruptFlag(void){
-	rylr998_interrupt_flag =0;
+void rylr998_ClearInterruptFlag(rylr998_t *hrylr){
+	hrylr->rx_parsed = hrylr->rx_lines;
 }
 
 
@@ -543,6 +1611,10 @@ RYLR_RX_command_t rylr998_ResponseFind(uint8_t *rxBuffer)
 	{
 		return ret = RYLR_FACTORY;
 	}
+	else if(!memcmp(rxBuffer, "+RESET\r\n", 8))
+	{
+		return ret = RYLR_RESET;
+	}
 	else if(!memcmp(rxBuffer, "+IPR=", 5))
 	{
 		return ret = RYLR_IPR;
@@ -551,14 +1623,20 @@ RYLR_RX_command_t rylr998_ResponseFind(uint8_t *rxBuffer)
 }
 
 
-RYLR_RX_data_t rx_packet;
-
-RYLR_RX_command_t rylr998_prase_reciver(uint8_t *pBuff, uint8_t RX_BUFFER_SIZE)
+/**
+ * @brief Parses the next complete line of the handle's DMA buffer
+ * @param  hrylr: Pointer to the RYLR998 handle.
+ * @retval command found on the line, the +RCV content is left in hrylr->rx_packet
+ *
+ */
+RYLR_RX_command_t rylr998_prase_reciver(rylr998_t *hrylr)
 {
 
-	static uint8_t aux_buff[255];  //it must match with RX_BUFFER_SIZE
-	static uint8_t start_indx=0;
-	static uint8_t i;
+	uint8_t *pBuff = hrylr->rx_buff;
+	uint8_t *aux_buff = hrylr->aux_buff;
+	uint16_t RX_BUFFER_SIZE = hrylr->rx_size;
+	uint16_t start_indx = hrylr->rx_index;
+	uint16_t i;
 
 	for(i = 0; i <RX_BUFFER_SIZE; i++){   //Looks for the index of the starting char
 
@@ -568,18 +1646,31 @@ RYLR_RX_command_t rylr998_prase_reciver(uint8_t *pBuff, uint8_t RX_BUFFER_SIZE)
 		}
 	}
 
-	for (i = 0; i <RX_BUFFER_SIZE; i++){
+	RYLR_framer_t framer = {0};
+	uint8_t framed = 0;
+	for (i = 0; i < RYLR_LINE_BUFFER_SIZE - 1; i++){
 
 		aux_buff[i] = pBuff[(start_indx + i) % RX_BUFFER_SIZE];
 
-		if(aux_buff[i]=='\n'){
+		if(rylr998_frame_step(&framer, aux_buff[i])){
+			framed = 1;
 			break;
 		}
 	}
-	rylr998_ClearInterruptFlag();
-	start_indx=(start_indx + i+1) % RX_BUFFER_SIZE;
+	// Lines are parsed in the order the RX event completed them, each one takes its own arrival tick
+	uint32_t line_tick = hrylr->rx_ticks[hrylr->rx_parsed % RYLR_LINE_TICKS];
+	hrylr->rx_parsed++;
+	if(!framed){
+		// No line end within the longest line: leave rx_index where it is, the bytes may still be arriving.
+		// The notification is consumed so waits do not spin, the next line end parses from the same place.
+		aux_buff[RYLR_LINE_BUFFER_SIZE - 1] = '\0';
+		return RYLR_NOT_FOUND;
+	}
+	aux_buff[i + 1] = '\0';
+	hrylr->rx_index=(start_indx + i+1) % RX_BUFFER_SIZE;
 
             RYLR_RX_command_t cmd = rylr998_ResponseFind(aux_buff);
+            RYLR_RX_data_t *rx_packet = &hrylr->rx_packet;
 
             // Handle different cases
             switch (cmd)
@@ -594,31 +1685,37 @@ RYLR_RX_command_t rylr998_prase_reciver(uint8_t *pBuff, uint8_t RX_BUFFER_SIZE)
                 	 *  +RCV=50,5,HELLO,-99,40\r\n
                 	 */
 
-            	    char *token;
-
-
-            	    // Parse ID address
-            	    token = strtok(aux_buff, "=");  // Remove "+RCV="
-            	    token = strtok(NULL, ",");      // Get ID address
-            	    rx_packet.id = atoi(token);
-
-            	    // Parse byte count
-            	    token = strtok(NULL, ",");      // Get byte count
-            	    rx_packet.byte_count = atoi(token);
-
-            	    // Parse actual data
-            	    token = strtok(NULL, ",");
-            	    strncpy(rx_packet.data, token, rx_packet.byte_count);  // Copy up to byte_count
-            	    rx_packet.data[rx_packet.byte_count] = '\0';  // Ensure null termination
+            	    // The data is copied by length, it may contain ',' or any binary byte
+            	    char *field;
+            	    char *end = (char*)&aux_buff[i];
+
+            	    rx_packet->id = strtoul((char*)&aux_buff[5], &field, 10);  // Skip "+RCV=", get ID address
+            	    rx_packet->byte_count = strtoul(field + 1, &field, 10);   // Get byte count
+            	    field++;                                                  // Start of the data
+            	    if (*(field - 1) != ',' || rx_packet->byte_count >= sizeof(rx_packet->data) ||
+            	        field + rx_packet->byte_count >= end) {
+            	        cmd = RYLR_NOT_FOUND;                                 // Truncated or malformed line
+            	        break;
+            	    }
+            	    memcpy(rx_packet->data, field, rx_packet->byte_count);
+            	    rx_packet->data[rx_packet->byte_count] = '\0';  // Ensure null termination
+            	    field += rx_packet->byte_count;
 
             	    // Parse RSSI
-            	    token = strtok(NULL, ",");      // Get RSSI
-            	    rx_packet.rssi = atoi(token);
+            	    rx_packet->rssi = strtol(field + 1, &field, 10);
 
             	    // Parse SNR
-            	    token = strtok(NULL, ",");      // Get SNR
-            	    rx_packet.snr = atoi(token);
-
+            	    rx_packet->snr = strtol(field + 1, &field, 10);
+            	    rx_packet->tick = line_tick;
+
+            	    // Payload filter first, e.g. decryption: a rejected packet never reaches the callback
+            	    rylr998_ClockFast(hrylr);
+            	    if(hrylr->rx_filter != NULL && !hrylr->rx_filter(hrylr->filter_ctx, rx_packet)){
+            	        hrylr->metrics.rejected++;
+            	    }else if(hrylr->rx_callback != NULL){
+            	    	hrylr->rx_callback(hrylr, rx_packet);
+            	    }
+            	    rylr998_ClockRelease(hrylr);
                     break;
                 case RYLR_OK:
                     // Handle OK response
@@ -627,9 +1724,10 @@ RYLR_RX_command_t rylr998_prase_reciver(uint8_t *pBuff, uint8_t RX_BUFFER_SIZE)
                     // Handle READY response
                     break;
                 case RYLR_ERR:
-
-                	while(1){  //TODO  for now, if something went wrong, the code gets stuck here.
-                		Error_Handler();
+                	// +ERR=<code>\r\n, the caller decides how to recover
+                	hrylr->last_error = (RYLR_ERR_code_t)atoi((char*)&aux_buff[5]);
+                	if(hrylr->last_error == RYLR_ERR_NONE){
+                		hrylr->last_error = RYLR_ERR_UNKNOWN_FAILURE;
                 	}
                 	break;
                 default:
@@ -639,4 +1737,3 @@ RYLR_RX_command_t rylr998_prase_reciver(uint8_t *pBuff, uint8_t RX_BUFFER_SIZE)
 
             return cmd;
 }
-
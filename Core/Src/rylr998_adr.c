@@ -0,0 +1,196 @@
+/*
+ * rylr998_adr.c
+ *
+ *  Adaptive data rate controller.
+ */
+#include "rylr998_adr.h"
+#include <string.h>
+
+
+/*
+ * Highest SF the module accepts at each BW (7: 125 kHz, 8: 250 kHz, 9: 500 kHz)
+ */
+static const uint8_t rylr998_adr_max_sf[3] = { 9, 10, 11 };
+
+
+/**
+ * @brief  Demodulation floor of a spreading factor in 1/16 dB: -7.5 dB at SF7, 2.5 dB lower per step
+ * @param  SF: spreading factor, 7 to 12
+ */
+int16_t rylr998_adrFloorQ4(uint8_t SF){
+	return -120 - 40 * (SF - 7);
+}
+
+
+/**
+ * @brief  Initializes the controller, no peer known.
+ * @param  adr: controller
+ * @param  hrylr: Pointer to the RYLR998 handle whose settings are adapted
+ * @param  margin_db: SNR kept above the demodulation floor, RYLR_ADR_MARGIN_DB if negative
+ * @param  auto_apply: 1 to let rylr998_adrProcess change the settings, 0 to only recommend
+ */
+void rylr998_adrInit(rylr998_adr_t *adr, rylr998_t *hrylr, int8_t margin_db, uint8_t auto_apply){
+
+	memset(adr, 0, sizeof(*adr));
+	adr->hrylr = hrylr;
+	adr->margin_db = (margin_db < 0) ? RYLR_ADR_MARGIN_DB : margin_db;
+	adr->auto_apply = auto_apply;
+	adr->last_change = hrylr->tick() - RYLR_ADR_HOLD_MS;
+}
+
+
+/**
+ * @brief  Records the link quality of a received packet, call it from the +RCV callback.
+ *         The packet is not consumed, pass it on to the other layers.
+ * @param  adr: controller
+ * @param  packet: packet decoded by the parser
+ */
+void rylr998_adrInput(rylr998_adr_t *adr, const RYLR_RX_data_t *packet){
+
+	rylr998_t *hrylr = adr->hrylr;
+	RYLR_adr_peer_t *peer = NULL;
+	RYLR_adr_peer_t *oldest = &adr->peer[0];
+	uint32_t now = hrylr->tick();
+
+	if(!(hrylr->phy_valid & RYLR_PHY_PARAMETER)){
+		return;		//the BW the packet was received with is not known
+	}
+
+	for(uint8_t i = 0; i < RYLR_ADR_PEERS; i++){
+		if(adr->peer[i].samples != 0 && adr->peer[i].id == packet->id){
+			peer = &adr->peer[i];
+			break;
+		}
+		if(adr->peer[i].samples == 0 ||
+		   (oldest->samples != 0 && (int32_t)(adr->peer[i].last - oldest->last) < 0)){
+			oldest = &adr->peer[i];
+		}
+	}
+	if(peer == NULL){
+		peer = oldest;
+		peer->id = packet->id;
+		peer->samples = 0;
+	}
+
+	int16_t snr_q4 = (int16_t)(packet->snr + 3 * (rylr998_activePhy(hrylr)->BW - 7)) * 16;
+
+	// Exponential average, 1/4 weight to the new sample
+	if(peer->samples == 0){
+		peer->snr_q4 = snr_q4;
+	}else{
+		peer->snr_q4 += (snr_q4 - peer->snr_q4) / 4;
+	}
+	if(peer->samples < UINT8_MAX){
+		peer->samples++;
+	}
+	peer->rssi = packet->rssi;
+	peer->last = now;
+	adr->stats.samples++;
+}
+
+
+/**
+ * @brief  Computes the fastest settings that keep the margin on the weakest peer.
+ *         CR, preamble and power are kept as they are.
+ * @param  adr: controller
+ * @param  phy: filled with the recommendation
+ * @retval 1 if the recommendation differs from the current settings, 0 if nothing to change or no peer known
+ */
+uint8_t rylr998_adrRecommend(rylr998_adr_t *adr, RYLR_phy_t *phy){
+
+	rylr998_t *hrylr = adr->hrylr;
+	uint32_t now = hrylr->tick();
+	int16_t worst_q4 = INT16_MAX;
+	uint32_t best_toa = UINT32_MAX;
+	const RYLR_phy_t *active = rylr998_activePhy(hrylr);
+
+	*phy = *active;
+	if(!(hrylr->phy_valid & RYLR_PHY_PARAMETER)){
+		return 0;
+	}
+
+	for(uint8_t i = 0; i < RYLR_ADR_PEERS; i++){
+		RYLR_adr_peer_t *peer = &adr->peer[i];
+		if(peer->samples >= RYLR_ADR_MIN_SAMPLES && (now - peer->last) < RYLR_ADR_MAX_AGE_MS &&
+		   peer->snr_q4 < worst_q4){
+			worst_q4 = peer->snr_q4;
+		}
+	}
+	if(worst_q4 == INT16_MAX){
+		return 0;
+	}
+
+	for(uint8_t BW = 7; BW <= 9; BW++){
+		int16_t snr_q4 = worst_q4 - 3 * 16 * (BW - 7);
+
+		for(uint8_t SF = 7; SF <= rylr998_adr_max_sf[BW - 7]; SF++){
+			if(snr_q4 - rylr998_adrFloorQ4(SF) < adr->margin_db * 16){
+				continue;
+			}
+			RYLR_phy_t candidate = *active;
+			candidate.SF = SF;
+			candidate.BW = BW;
+			uint32_t toa = rylr998_timeOnAir(&candidate, RYLR_ADR_REF_LENGTH);
+			if(toa < best_toa){
+				best_toa = toa;
+				*phy = candidate;
+			}
+			break;		//higher SF at this BW is only slower
+		}
+	}
+
+	// No setting keeps the margin: fall back to the most robust one
+	if(best_toa == UINT32_MAX){
+		phy->SF = rylr998_adr_max_sf[0];
+		phy->BW = 7;
+	}
+
+	return (phy->SF != active->SF || phy->BW != active->BW) ? 1 : 0;
+}
+
+
+/**
+ * @brief  Applies the recommendation when auto apply is on and RYLR_ADR_HOLD_MS passed since the last change.
+ *         Call it from the main loop, it blocks for the AT+PARAMETER exchange.
+ * @param  adr: controller
+ * @retval RYLR_status_t: RYLR_STATUS_OK if nothing to do or the settings were applied
+ */
+RYLR_status_t rylr998_adrProcess(rylr998_adr_t *adr){
+
+	rylr998_t *hrylr = adr->hrylr;
+	RYLR_phy_t phy;
+	RYLR_status_t status = RYLR_STATUS_TX_ERROR;
+
+	if(!adr->auto_apply || (hrylr->tick() - adr->last_change) < RYLR_ADR_HOLD_MS ||
+	   !rylr998_adrRecommend(adr, &phy)){
+		return RYLR_STATUS_OK;
+	}
+
+	if(rylr998_setParameter(hrylr, phy.SF, phy.BW, phy.CR, phy.ProgramedPreamble) == HAL_OK){
+		status = rylr998_AwaitResponse(hrylr, RYLR_OK, NULL);
+	}
+	adr->last_change = hrylr->tick();
+	if(status == RYLR_STATUS_OK){
+		adr->stats.changes++;
+	}else{
+		adr->stats.failures++;
+	}
+	return status;
+}
+
+
+/**
+ * @brief  Returns the link quality recorded for a peer.
+ * @param  adr: controller
+ * @param  id: address of the peer
+ * @retval Pointer to the peer, NULL if never heard or evicted
+ */
+const RYLR_adr_peer_t *rylr998_adrPeer(rylr998_adr_t *adr, uint16_t id){
+
+	for(uint8_t i = 0; i < RYLR_ADR_PEERS; i++){
+		if(adr->peer[i].samples != 0 && adr->peer[i].id == id){
+			return &adr->peer[i];
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,489 @@
+/*
+ * rylr998_bulk.c
+ *
+ *  Bulk transfer with block bitmaps and page batched flash writes.
+ */
+#include "rylr998_bulk.h"
+#include <string.h>
+
+
+#define RYLR_BULK_BLOCKS_PER_PAGE	(FLASH_PAGE_SIZE / RYLR_BULK_BLOCK_SIZE)
+
+
+static inline uint8_t rylr998_bit_get(const uint8_t *map, uint16_t i){
+	return (map[i >> 3] >> (i & 7U)) & 1U;
+}
+
+static inline void rylr998_bit_set(uint8_t *map, uint16_t i){
+	map[i >> 3] |= (uint8_t)(1U << (i & 7U));
+}
+
+static inline void rylr998_bit_clear(uint8_t *map, uint16_t i){
+	map[i >> 3] &= (uint8_t)~(1U << (i & 7U));
+}
+
+
+/**
+ * @brief  Time on air with the handle's current settings, rounded up to ms
+ */
+static uint32_t rylr998_bulk_airtime(const RYLR_phy_t *phy, uint8_t length){
+	return (rylr998_timeOnAir(phy, length) + 999U) / 1000U;
+}
+
+
+/**
+ * @brief  Sends one frame and waits for the module's +OK, then marks the radio busy for its airtime
+ */
+static HAL_StatusTypeDef rylr998_bulk_transmit(rylr998_t *hrylr, uint16_t dest, uint8_t *frame, uint8_t length,
+											   uint32_t *radio_free){
+
+	if(rylr998_sendData(hrylr, dest, frame, length) != HAL_OK ||
+	   rylr998_AwaitResponse(hrylr, RYLR_OK, NULL) != RYLR_STATUS_OK){
+		return HAL_ERROR;
+	}
+	if(radio_free != NULL){
+		*radio_free = hrylr->tick() + rylr998_bulk_airtime(rylr998_activePhy(hrylr), length);
+	}
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Initializes an idle sender.
+ * @param  tx: sender
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  request: called when a peer asks for a transfer (pull), may be NULL
+ */
+void rylr998_bulkTxInit(rylr998_bulk_tx_t *tx, rylr998_t *hrylr, RYLR_bulk_request_t request){
+
+	memset(tx, 0, sizeof(*tx));
+	tx->hrylr = hrylr;
+	tx->request = request;
+	tx->radio_free = hrylr->tick();
+}
+
+
+/**
+ * @brief  Starts sending an image, rylr998_bulkTxProcess does the work.
+ * @param  tx: sender
+ * @param  peer: receiver address
+ * @param  xfer: transfer number, tells this transfer from the previous one
+ * @param  image: data to send, memory mapped (RAM or flash), must stay valid until done
+ * @param  size: bytes, up to RYLR_BULK_BLOCKS_MAX * RYLR_BULK_BLOCK_SIZE
+ * @retval HAL_StatusTypeDef: HAL_BUSY if a transfer is running, HAL_ERROR if too large
+ */
+HAL_StatusTypeDef rylr998_bulkTxStart(rylr998_bulk_tx_t *tx, uint16_t peer, uint8_t xfer, const uint8_t *image, uint32_t size){
+
+	if(tx->state != RYLR_BULK_IDLE && tx->state != RYLR_BULK_DONE && tx->state != RYLR_BULK_FAILED){
+		return HAL_BUSY;
+	}
+	if(size == 0 || size > (uint32_t)RYLR_BULK_BLOCKS_MAX * RYLR_BULK_BLOCK_SIZE){
+		return HAL_ERROR;
+	}
+
+	tx->peer = peer;
+	tx->xfer = xfer;
+	tx->image = image;
+	tx->size = size;
+	tx->blocks = (uint16_t)((size + RYLR_BULK_BLOCK_SIZE - 1U) / RYLR_BULK_BLOCK_SIZE);
+	tx->high = 0;
+	tx->since_poll = 0;
+	tx->polls_left = RYLR_BULK_MAX_POLLS;
+	memset(tx->pending, 0, sizeof(tx->pending));
+	for(uint16_t i = 0; i < tx->blocks; i++){
+		rylr998_bit_set(tx->pending, i);
+	}
+	memset(&tx->stats, 0, sizeof(tx->stats));
+	tx->start = tx->hrylr->tick();
+	tx->state = RYLR_BULK_SEND_START;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Takes the STATUS and REQUEST frames, call it from the +RCV callback.
+ * @param  tx: sender
+ * @param  packet: packet decoded by the parser
+ * @retval 1 if the packet was for the sender, 0 to let other layers look at it
+ */
+uint8_t rylr998_bulkTxInput(rylr998_bulk_tx_t *tx, const RYLR_RX_data_t *packet){
+
+	const uint8_t *frame = packet->data;
+
+	if(packet->byte_count >= 2 && frame[0] == RYLR_BULK_REQUEST){
+		if(tx->request != NULL){
+			tx->request(tx, packet->id, frame[1]);
+		}
+		return 1;
+	}
+	if(packet->byte_count < 3 || frame[0] != RYLR_BULK_STATUS){
+		return 0;
+	}
+	if(packet->id != tx->peer || frame[1] != tx->xfer || tx->state != RYLR_BULK_WAIT_STATUS){
+		return 1;
+	}
+
+	if(frame[2]){
+		tx->stats.elapsed_ms = tx->hrylr->tick() - tx->start;
+		tx->state = RYLR_BULK_DONE;
+		return 1;
+	}
+
+	// Holes go back in the pending map, the lowest pending block is sent first
+	for(uint8_t r = 3; r + 3 <= packet->byte_count; r += 3){
+		uint16_t first = (uint16_t)(frame[r] | (frame[r + 1] << 8));
+		for(uint16_t i = first; i < first + frame[r + 2] && i < tx->blocks; i++){
+			rylr998_bit_set(tx->pending, i);
+		}
+	}
+	tx->polls_left = RYLR_BULK_MAX_POLLS;
+	tx->since_poll = 0;
+	tx->state = RYLR_BULK_STREAM;
+	return 1;
+}
+
+
+/**
+ * @brief  Sends the next frame of the transfer. Call it from the main loop,
+ *         it sends at most one frame per call and never while the previous one is still on air.
+ * @param  tx: sender
+ */
+void rylr998_bulkTxProcess(rylr998_bulk_tx_t *tx){
+
+	rylr998_t *hrylr = tx->hrylr;
+	uint32_t now = hrylr->tick();
+	uint8_t frame[RYLR_BULK_BLOCK_HEADER + RYLR_BULK_BLOCK_SIZE];
+
+	if((int32_t)(now - tx->radio_free) < 0){
+		return;
+	}
+
+	switch(tx->state){
+		case RYLR_BULK_SEND_START:
+			frame[0] = RYLR_BULK_START;
+			frame[1] = tx->xfer;
+			frame[2] = (uint8_t)tx->size;
+			frame[3] = (uint8_t)(tx->size >> 8);
+			frame[4] = (uint8_t)(tx->size >> 16);
+			frame[5] = (uint8_t)(tx->size >> 24);
+			if(rylr998_bulk_transmit(hrylr, tx->peer, frame, 6, &tx->radio_free) == HAL_OK){
+				tx->deadline = tx->radio_free + RYLR_BULK_POLL_TIMEOUT_MS;
+				tx->state = RYLR_BULK_WAIT_STATUS;
+			}
+			break;
+
+		case RYLR_BULK_STREAM: {
+			uint16_t index = 0;
+			while(index < tx->blocks && !rylr998_bit_get(tx->pending, index)){
+				index++;
+			}
+			if(index == tx->blocks || tx->since_poll >= RYLR_BULK_WINDOW){
+				tx->state = RYLR_BULK_SEND_POLL;
+				break;
+			}
+
+			uint32_t offset = (uint32_t)index * RYLR_BULK_BLOCK_SIZE;
+			uint8_t length = (tx->size - offset < RYLR_BULK_BLOCK_SIZE) ? (uint8_t)(tx->size - offset) : RYLR_BULK_BLOCK_SIZE;
+
+			frame[0] = RYLR_BULK_BLOCK;
+			frame[1] = tx->xfer;
+			frame[2] = (uint8_t)index;
+			frame[3] = (uint8_t)(index >> 8);
+			memcpy(&frame[RYLR_BULK_BLOCK_HEADER], &tx->image[offset], length);
+			if(rylr998_bulk_transmit(hrylr, tx->peer, frame, RYLR_BULK_BLOCK_HEADER + length, &tx->radio_free) != HAL_OK){
+				break;		//module busy or duty cycle spent, try again on the next call
+			}
+			rylr998_bit_clear(tx->pending, index);
+			if(index < tx->high){
+				tx->stats.retransmissions++;
+			}else{
+				tx->stats.blocks_sent++;
+				tx->high = index + 1U;
+			}
+			tx->since_poll++;
+			break;
+		}
+
+		case RYLR_BULK_SEND_POLL:
+			frame[0] = RYLR_BULK_POLL;
+			frame[1] = tx->xfer;
+			frame[2] = (uint8_t)tx->high;
+			frame[3] = (uint8_t)(tx->high >> 8);
+			if(rylr998_bulk_transmit(hrylr, tx->peer, frame, 4, &tx->radio_free) == HAL_OK){
+				tx->stats.polls++;
+				tx->deadline = tx->radio_free + RYLR_BULK_POLL_TIMEOUT_MS;
+				tx->state = RYLR_BULK_WAIT_STATUS;
+			}
+			break;
+
+		case RYLR_BULK_WAIT_STATUS:
+			if((int32_t)(now - tx->deadline) < 0){
+				break;
+			}
+			if(tx->polls_left-- == 0){
+				tx->state = RYLR_BULK_FAILED;
+			}else{
+				tx->state = (tx->high == 0) ? RYLR_BULK_SEND_START : RYLR_BULK_SEND_POLL;
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+/**
+ * @brief  Estimates the duration of a loss free transfer: the blocks, one poll and STATUS
+ *         per RYLR_BULK_WINDOW blocks, RYLR_BULK_TURNAROUND_MS after each frame.
+ * @param  phy: radio settings, e.g. rylr998_activePhy(hrylr)
+ * @param  size: image size in bytes
+ * @retval milliseconds
+ */
+uint32_t rylr998_bulkEstimateMs(const RYLR_phy_t *phy, uint32_t size){
+
+	uint32_t blocks = (size + RYLR_BULK_BLOCK_SIZE - 1U) / RYLR_BULK_BLOCK_SIZE;
+	uint32_t polls = (blocks + RYLR_BULK_WINDOW - 1U) / RYLR_BULK_WINDOW;
+	uint32_t block_ms = rylr998_bulk_airtime(phy, RYLR_BULK_BLOCK_HEADER + RYLR_BULK_BLOCK_SIZE) + RYLR_BULK_TURNAROUND_MS;
+	uint32_t poll_ms = rylr998_bulk_airtime(phy, 4) + rylr998_bulk_airtime(phy, 3) + 2U * RYLR_BULK_TURNAROUND_MS;
+
+	return blocks * block_ms + (polls + 1U) * poll_ms;		//+1: START and its STATUS
+}
+
+
+/**
+ * @brief  Initializes a receiver writing to a flash region.
+ * @param  rx: receiver
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  peer: sender address
+ * @param  base: flash address of the region, FLASH_PAGE_SIZE aligned, not used by the program
+ * @param  capacity: bytes in the region
+ * @param  done: called once the whole image is in flash, may be NULL
+ */
+void rylr998_bulkRxInit(rylr998_bulk_rx_t *rx, rylr998_t *hrylr, uint16_t peer, uint32_t base, uint32_t capacity,
+						RYLR_bulk_done_t done){
+
+	memset(rx, 0, sizeof(*rx));
+	rx->hrylr = hrylr;
+	rx->peer = peer;
+	rx->base = base;
+	rx->capacity = capacity;
+	rx->done = done;
+	rx->page = -1;
+}
+
+
+/**
+ * @brief  Asks the peer to send its image (pull), its request callback starts the transfer.
+ * @param  rx: receiver
+ * @param  xfer: transfer number to use
+ * @retval HAL_StatusTypeDef: result of the transmission
+ */
+HAL_StatusTypeDef rylr998_bulkRequest(rylr998_bulk_rx_t *rx, uint8_t xfer){
+
+	uint8_t frame[2] = { RYLR_BULK_REQUEST, xfer };
+
+	return rylr998_bulk_transmit(rx->hrylr, rx->peer, frame, sizeof(frame), NULL);
+}
+
+
+/**
+ * @brief  Programs the blocks held in the page buffer, word by word with one unlock per page
+ */
+static void rylr998_bulk_flush(rylr998_bulk_rx_t *rx){
+
+	if(rx->page < 0 || rx->page_mask == 0){
+		rx->page = -1;
+		return;
+	}
+
+	uint32_t page_addr = rx->base + (uint32_t)rx->page * FLASH_PAGE_SIZE;
+
+	HAL_FLASH_Unlock();
+	for(uint8_t b = 0; b < RYLR_BULK_BLOCKS_PER_PAGE; b++){
+		if(!(rx->page_mask & (1U << b))){
+			continue;		//not received yet, the erased words are programmed when it comes
+		}
+		for(uint32_t w = 0; w < RYLR_BULK_BLOCK_SIZE; w += 4U){
+			uint32_t offset = b * RYLR_BULK_BLOCK_SIZE + w;
+			uint32_t word;
+			memcpy(&word, &rx->page_buff[offset], sizeof(word));
+			if(word != 0U && HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, page_addr + offset, word) != HAL_OK){
+				rx->stats.flash_errors++;
+			}
+		}
+	}
+	HAL_FLASH_Lock();
+
+	rx->stats.page_writes++;
+	rx->page = -1;
+	rx->page_mask = 0;
+}
+
+
+/**
+ * @brief  Takes the START, BLOCK and POLL frames of the peer, call it from the +RCV callback.
+ *         Flash is erased and programmed, and answers are sent, from rylr998_bulkRxProcess.
+ * @param  rx: receiver
+ * @param  packet: packet decoded by the parser
+ * @retval 1 if the packet was for the receiver, 0 to let other layers look at it
+ */
+uint8_t rylr998_bulkRxInput(rylr998_bulk_rx_t *rx, const RYLR_RX_data_t *packet){
+
+	const uint8_t *frame = packet->data;
+
+	if(packet->id != rx->peer || packet->byte_count < 2 ||
+	   (frame[0] != RYLR_BULK_START && frame[0] != RYLR_BULK_BLOCK && frame[0] != RYLR_BULK_POLL)){
+		return 0;
+	}
+
+	if(frame[0] == RYLR_BULK_START && packet->byte_count >= 6){
+		uint32_t size = frame[2] | (frame[3] << 8) | ((uint32_t)frame[4] << 16) | ((uint32_t)frame[5] << 24);
+
+		if(rx->active && frame[1] == rx->xfer && size == rx->size){
+			rx->reply_pending = 1;		//START repeated, our STATUS was lost
+			return 1;
+		}
+		if(size == 0 || size > rx->capacity || size > (uint32_t)RYLR_BULK_BLOCKS_MAX * RYLR_BULK_BLOCK_SIZE){
+			return 1;
+		}
+		rx->xfer = frame[1];
+		rx->size = size;
+		rx->blocks = (uint16_t)((size + RYLR_BULK_BLOCK_SIZE - 1U) / RYLR_BULK_BLOCK_SIZE);
+		rx->poll_high = 0;
+		rx->complete = 0;
+		rx->page = -1;
+		rx->page_mask = 0;
+		rx->flush_pending = 0;
+		memset(rx->got, 0, sizeof(rx->got));
+		rx->active = 1;
+		rx->erase_pending = 1;
+		rx->reply_pending = 1;
+		return 1;
+	}
+
+	if(!rx->active || frame[1] != rx->xfer || rx->erase_pending || packet->byte_count < 4){
+		return 1;
+	}
+	uint16_t index = (uint16_t)(frame[2] | (frame[3] << 8));
+
+	if(frame[0] == RYLR_BULK_POLL){
+		rx->poll_high = (index > rx->blocks) ? rx->blocks : index;
+		rx->reply_pending = 1;
+		return 1;
+	}
+
+	if(index >= rx->blocks || packet->byte_count <= RYLR_BULK_BLOCK_HEADER){
+		return 1;
+	}
+	if(rylr998_bit_get(rx->got, index)){
+		rx->stats.duplicates++;
+		return 1;
+	}
+
+	// Batch per page: a block of another page needs the buffer programmed first
+	int16_t page = (int16_t)(index / RYLR_BULK_BLOCKS_PER_PAGE);
+	uint8_t slot = index % RYLR_BULK_BLOCKS_PER_PAGE;
+	uint8_t length = packet->byte_count - RYLR_BULK_BLOCK_HEADER;
+
+	if(length > RYLR_BULK_BLOCK_SIZE){
+		return 1;
+	}
+	if(rx->page != page && rx->page >= 0 && rx->page_mask != 0){
+		rx->flush_pending = 1;
+		rx->stats.deferred++;
+		return 1;		//not marked received, the next STATUS asks for it again
+	}
+	if(rx->page != page){
+		memset(rx->page_buff, 0, sizeof(rx->page_buff));
+		rx->page = page;
+	}
+	memcpy(&rx->page_buff[slot * RYLR_BULK_BLOCK_SIZE], &frame[RYLR_BULK_BLOCK_HEADER], length);
+	rx->page_mask |= (uint8_t)(1U << slot);
+	rylr998_bit_set(rx->got, index);
+	rx->stats.blocks++;
+
+	if(rx->page_mask == (uint8_t)((1U << RYLR_BULK_BLOCKS_PER_PAGE) - 1U)){
+		rx->flush_pending = 1;
+	}
+	return 1;
+}
+
+
+/**
+ * @brief  Erases the flash after a START, programs the page buffer and answers the polls.
+ *         Call it from the main loop.
+ * @param  rx: receiver
+ */
+void rylr998_bulkRxProcess(rylr998_bulk_rx_t *rx){
+
+	uint8_t frame[3 + 3 * RYLR_BULK_STATUS_RUNS];
+	uint8_t length = 3;
+
+	if(rx->erase_pending){
+		FLASH_EraseInitTypeDef erase = {
+			.TypeErase = FLASH_TYPEERASE_PAGES,
+			.PageAddress = rx->base,
+			.NbPages = (rx->size + FLASH_PAGE_SIZE - 1U) / FLASH_PAGE_SIZE,
+		};
+		uint32_t page_error;
+
+		HAL_FLASH_Unlock();
+		if(HAL_FLASHEx_Erase(&erase, &page_error) != HAL_OK){
+			rx->stats.flash_errors++;
+		}
+		HAL_FLASH_Lock();
+		rx->erase_pending = 0;
+	}
+	if(rx->flush_pending){
+		rylr998_bulk_flush(rx);
+		rx->flush_pending = 0;
+	}
+
+	if(!rx->reply_pending){
+		return;
+	}
+
+	// Complete once every block is in flash
+	uint16_t missing = 0;
+	for(uint16_t i = 0; i < rx->blocks; i++){
+		missing += !rylr998_bit_get(rx->got, i);
+	}
+	if(missing == 0){
+		rylr998_bulk_flush(rx);
+	}else if(rx->poll_high > 0){
+		rylr998_bulk_flush(rx);		//the sender may pause here, do not hold a partial page
+	}
+
+	frame[0] = RYLR_BULK_STATUS;
+	frame[1] = rx->xfer;
+	frame[2] = (missing == 0);
+
+	// Holes below the highest block the sender polled with, as (first, count) runs
+	for(uint16_t i = 0; i < rx->poll_high && missing != 0 && length + 3 <= sizeof(frame); ){
+		if(rylr998_bit_get(rx->got, i)){
+			i++;
+			continue;
+		}
+		uint16_t first = i;
+		while(i < rx->poll_high && !rylr998_bit_get(rx->got, i) && i - first < UINT8_MAX){
+			i++;
+		}
+		frame[length++] = (uint8_t)first;
+		frame[length++] = (uint8_t)(first >> 8);
+		frame[length++] = (uint8_t)(i - first);
+	}
+
+	if(rylr998_bulk_transmit(rx->hrylr, rx->peer, frame, length, NULL) != HAL_OK){
+		return;
+	}
+	rx->reply_pending = 0;
+	rx->stats.status_sent++;
+
+	if(missing == 0 && !rx->complete){
+		rx->complete = 1;
+		if(rx->done != NULL){
+			rx->done(rx, rx->xfer, rx->size);
+		}
+	}
+}
@@ -0,0 +1,432 @@
+/*
+ * rylr998_cbor.c
+ *
+ *  CBOR subset encoder and pull decoder.
+ */
+#include "rylr998_cbor.h"
+#include <string.h>
+
+
+#define RYLR_CBOR_MAJOR_UINT		0U
+#define RYLR_CBOR_MAJOR_NEGINT		1U
+#define RYLR_CBOR_MAJOR_BYTES		2U
+#define RYLR_CBOR_MAJOR_TEXT		3U
+#define RYLR_CBOR_MAJOR_ARRAY		4U
+#define RYLR_CBOR_MAJOR_MAP			5U
+#define RYLR_CBOR_MAJOR_SIMPLE		7U
+
+#define RYLR_CBOR_AI_1BYTE			24U		//additional info: the argument follows in 1, 2 or 4 bytes
+#define RYLR_CBOR_AI_2BYTE			25U
+#define RYLR_CBOR_AI_4BYTE			26U
+
+#define RYLR_CBOR_FALSE				20U
+#define RYLR_CBOR_TRUE				21U
+
+
+/**
+ * @brief  Decimal digits of a value, for the ASCII comparison
+ */
+static uint8_t rylr998_cbor_digits(uint32_t value){
+
+	uint8_t n = 1;
+
+	while(value >= 10U){
+		value /= 10U;
+		n++;
+	}
+	return n;
+}
+
+
+/**
+ * @brief  Appends raw bytes, or flags the overflow
+ */
+static void rylr998_cbor_write(RYLR_cbor_enc_t *enc, const uint8_t *data, uint8_t length){
+
+	if(enc->overflow || length > enc->size - enc->length){
+		enc->overflow = 1;
+		return;
+	}
+	memcpy(enc->buffer + enc->length, data, length);
+	enc->length += length;
+}
+
+
+/**
+ * @brief  Writes an item head: major type and its argument in the shortest form
+ */
+static void rylr998_cbor_head(RYLR_cbor_enc_t *enc, uint8_t major, uint32_t value){
+
+	uint8_t head[5];
+	uint8_t n;
+
+	major <<= 5;
+	if(value < RYLR_CBOR_AI_1BYTE){
+		head[0] = major | (uint8_t)value;
+		n = 1;
+	}else if(value <= 0xFFU){
+		head[0] = major | RYLR_CBOR_AI_1BYTE;
+		head[1] = (uint8_t)value;
+		n = 2;
+	}else if(value <= 0xFFFFU){
+		head[0] = major | RYLR_CBOR_AI_2BYTE;
+		head[1] = (uint8_t)(value >> 8);
+		head[2] = (uint8_t)value;
+		n = 3;
+	}else{
+		head[0] = major | RYLR_CBOR_AI_4BYTE;
+		head[1] = (uint8_t)(value >> 24);
+		head[2] = (uint8_t)(value >> 16);
+		head[3] = (uint8_t)(value >> 8);
+		head[4] = (uint8_t)value;
+		n = 5;
+	}
+	rylr998_cbor_write(enc, head, n);
+}
+
+
+/**
+ * @brief  Starts a message in the caller's buffer.
+ * @param  enc: encoder
+ * @param  buffer: frame buffer, later passed to rylr998_sendData
+ * @param  size: buffer size, at most the payload left by the layers below
+ */
+void rylr998_cborEncInit(RYLR_cbor_enc_t *enc, uint8_t *buffer, uint8_t size){
+
+	memset(enc, 0, sizeof(*enc));
+	enc->buffer = buffer;
+	enc->size = size;
+}
+
+
+/**
+ * @brief  Appends an unsigned integer, 1 to 5 bytes
+ */
+void rylr998_cborPutUint(RYLR_cbor_enc_t *enc, uint32_t value){
+
+	rylr998_cbor_head(enc, RYLR_CBOR_MAJOR_UINT, value);
+	enc->ascii_length += rylr998_cbor_digits(value) + 1U;
+}
+
+
+/**
+ * @brief  Appends a signed integer, 1 to 5 bytes
+ */
+void rylr998_cborPutInt(RYLR_cbor_enc_t *enc, int32_t value){
+
+	if(value >= 0){
+		rylr998_cborPutUint(enc, (uint32_t)value);
+		return;
+	}
+	// Negative integers carry -1 - value
+	rylr998_cbor_head(enc, RYLR_CBOR_MAJOR_NEGINT, (uint32_t)(-1 - value));
+	enc->ascii_length += rylr998_cbor_digits((uint32_t)(-1 - value) + 1U) + 2U;
+}
+
+
+/**
+ * @brief  Appends a float: 3 bytes if half precision holds it exactly, 5 bytes otherwise
+ */
+void rylr998_cborPutFloat(RYLR_cbor_enc_t *enc, float value){
+
+	uint32_t bits;
+	uint8_t item[5];
+
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = bits >> 31;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xFFU) - 127;
+	uint32_t mantissa = bits & 0x7FFFFFU;
+
+	// Half precision: 5 bit exponent (-14..15 for normal numbers) and 10 bit mantissa
+	if((bits & 0x7FFFFFFFU) == 0 || (exponent >= -14 && exponent <= 15 && (mantissa & 0x1FFFU) == 0)){
+		uint16_t half = (uint16_t)(sign << 15);
+		if((bits & 0x7FFFFFFFU) != 0){
+			half |= (uint16_t)(((uint32_t)(exponent + 15) << 10) | (mantissa >> 13));
+		}
+		item[0] = (RYLR_CBOR_MAJOR_SIMPLE << 5) | RYLR_CBOR_AI_2BYTE;
+		item[1] = (uint8_t)(half >> 8);
+		item[2] = (uint8_t)half;
+		rylr998_cbor_write(enc, item, 3);
+	}else{
+		item[0] = (RYLR_CBOR_MAJOR_SIMPLE << 5) | RYLR_CBOR_AI_4BYTE;
+		item[1] = (uint8_t)(bits >> 24);
+		item[2] = (uint8_t)(bits >> 16);
+		item[3] = (uint8_t)(bits >> 8);
+		item[4] = (uint8_t)bits;
+		rylr998_cbor_write(enc, item, 5);
+	}
+
+	// "-123.45,"
+	float magnitude = sign ? -value : value;
+	uint32_t whole = (magnitude < 4294967040.0f) ? (uint32_t)magnitude : 0xFFFFFFFFU;
+	enc->ascii_length += sign + rylr998_cbor_digits(whole) + 4U;
+}
+
+
+/**
+ * @brief  Appends a byte string
+ */
+void rylr998_cborPutBytes(RYLR_cbor_enc_t *enc, const uint8_t *data, uint8_t length){
+
+	rylr998_cbor_head(enc, RYLR_CBOR_MAJOR_BYTES, length);
+	rylr998_cbor_write(enc, data, length);
+	enc->ascii_length += 2U * length + 1U;
+}
+
+
+/**
+ * @brief  Appends a NUL terminated text string, without the terminator
+ */
+void rylr998_cborPutText(RYLR_cbor_enc_t *enc, const char *text){
+
+	size_t length = strlen(text);
+
+	if(length > 0xFFU){
+		enc->overflow = 1;
+		return;
+	}
+	rylr998_cbor_head(enc, RYLR_CBOR_MAJOR_TEXT, (uint32_t)length);
+	rylr998_cbor_write(enc, (const uint8_t*)text, (uint8_t)length);
+	enc->ascii_length += (uint16_t)length + 1U;
+}
+
+
+/**
+ * @brief  Appends true or false, 1 byte
+ */
+void rylr998_cborPutBool(RYLR_cbor_enc_t *enc, uint8_t value){
+
+	rylr998_cbor_head(enc, RYLR_CBOR_MAJOR_SIMPLE, value ? RYLR_CBOR_TRUE : RYLR_CBOR_FALSE);
+	enc->ascii_length += 2U;
+}
+
+
+/**
+ * @brief  Starts an array, the next count items are its elements
+ */
+void rylr998_cborPutArray(RYLR_cbor_enc_t *enc, uint8_t count){
+	rylr998_cbor_head(enc, RYLR_CBOR_MAJOR_ARRAY, count);
+}
+
+
+/**
+ * @brief  Starts a map, the next 2 * pairs items are its keys and values (usually rylr998_cborPutUint keys)
+ */
+void rylr998_cborPutMap(RYLR_cbor_enc_t *enc, uint8_t pairs){
+	rylr998_cbor_head(enc, RYLR_CBOR_MAJOR_MAP, pairs);
+}
+
+
+/**
+ * @brief  Finishes a message.
+ * @param  enc: encoder
+ * @param  length: bytes to pass to rylr998_sendData
+ * @retval HAL_StatusTypeDef: HAL_ERROR if the items did not fit in the buffer
+ */
+HAL_StatusTypeDef rylr998_cborEncEnd(RYLR_cbor_enc_t *enc, uint8_t *length){
+
+	*length = enc->length;
+	return enc->overflow ? HAL_ERROR : HAL_OK;
+}
+
+
+/**
+ * @brief  Starts decoding a received payload, e.g. packet->data and packet->byte_count.
+ */
+void rylr998_cborDecInit(RYLR_cbor_dec_t *dec, const uint8_t *buffer, uint8_t length){
+
+	dec->buffer = buffer;
+	dec->length = length;
+	dec->pos = 0;
+}
+
+
+/**
+ * @brief  Reads the big endian argument of an item head
+ * @retval 0 if truncated or not a supported length
+ */
+static uint8_t rylr998_cbor_argument(RYLR_cbor_dec_t *dec, uint8_t info, uint32_t *value){
+
+	uint8_t n;
+
+	if(info < RYLR_CBOR_AI_1BYTE){
+		*value = info;
+		return 1;
+	}
+	switch(info){
+		case RYLR_CBOR_AI_1BYTE:	n = 1; break;
+		case RYLR_CBOR_AI_2BYTE:	n = 2; break;
+		case RYLR_CBOR_AI_4BYTE:	n = 4; break;
+		default:					return 0;	//64 bit arguments and indefinite lengths
+	}
+	if(n > dec->length - dec->pos){
+		return 0;
+	}
+	*value = 0;
+	while(n--){
+		*value = (*value << 8) | dec->buffer[dec->pos++];
+	}
+	return 1;
+}
+
+
+/**
+ * @brief  Converts a half precision float
+ */
+static float rylr998_cbor_half(uint16_t half){
+
+	uint32_t sign = (uint32_t)(half >> 15) << 31;
+	uint32_t exponent = (half >> 10) & 0x1FU;
+	uint32_t mantissa = half & 0x3FFU;
+	uint32_t bits;
+	float value;
+
+	if(exponent == 0){
+		value = (float)mantissa * 5.9604645e-8f;	//subnormal: mantissa * 2^-24
+		return sign ? -value : value;
+	}
+	if(exponent == 0x1FU){
+		bits = sign | 0x7F800000U | (mantissa << 13);	//infinity, NaN
+	}else{
+		bits = sign | ((exponent + 127U - 15U) << 23) | (mantissa << 13);
+	}
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+
+/**
+ * @brief  Decodes the next item. Containers only give their count, their items follow.
+ * @param  dec: decoder
+ * @param  item: decoded item, strings point into the decoded buffer
+ * @retval RYLR_cbor_type_t: type of the item, RYLR_CBOR_END after the last one
+ */
+RYLR_cbor_type_t rylr998_cborNext(RYLR_cbor_dec_t *dec, RYLR_cbor_item_t *item){
+
+	uint32_t value;
+
+	if(dec->pos >= dec->length){
+		item->type = RYLR_CBOR_END;
+		return item->type;
+	}
+
+	uint8_t initial = dec->buffer[dec->pos++];
+	uint8_t major = initial >> 5;
+	uint8_t info = initial & 0x1FU;
+
+	item->type = RYLR_CBOR_ERROR;
+
+	// Floats carry the bits, not a number
+	if(major == RYLR_CBOR_MAJOR_SIMPLE && (info == RYLR_CBOR_AI_2BYTE || info == RYLR_CBOR_AI_4BYTE)){
+		if(!rylr998_cbor_argument(dec, info, &value)){
+			return item->type;
+		}
+		if(info == RYLR_CBOR_AI_2BYTE){
+			item->f = rylr998_cbor_half((uint16_t)value);
+		}else{
+			memcpy(&item->f, &value, sizeof(item->f));
+		}
+		item->type = RYLR_CBOR_FLOAT;
+		return item->type;
+	}
+
+	if(!rylr998_cbor_argument(dec, info, &value)){
+		return item->type;
+	}
+
+	switch(major){
+		case RYLR_CBOR_MAJOR_UINT:
+			item->u = value;
+			item->type = RYLR_CBOR_UINT;
+			break;
+
+		case RYLR_CBOR_MAJOR_NEGINT:
+			if(value <= 0x7FFFFFFFU){
+				item->i = -1 - (int32_t)value;
+				item->type = RYLR_CBOR_NEGINT;
+			}
+			break;
+
+		case RYLR_CBOR_MAJOR_BYTES:
+		case RYLR_CBOR_MAJOR_TEXT:
+			if(value <= (uint32_t)(dec->length - dec->pos)){
+				item->str.ptr = &dec->buffer[dec->pos];
+				item->str.length = (uint8_t)value;
+				dec->pos += (uint8_t)value;
+				item->type = (major == RYLR_CBOR_MAJOR_BYTES) ? RYLR_CBOR_BYTES : RYLR_CBOR_TEXT;
+			}
+			break;
+
+		case RYLR_CBOR_MAJOR_ARRAY:
+			item->u = value;
+			item->type = RYLR_CBOR_ARRAY;
+			break;
+
+		case RYLR_CBOR_MAJOR_MAP:
+			item->u = value;
+			item->type = RYLR_CBOR_MAP;
+			break;
+
+		case RYLR_CBOR_MAJOR_SIMPLE:
+			item->u = value;
+			item->type = RYLR_CBOR_SIMPLE;
+			break;
+
+		default:
+			break;		//tags
+	}
+	if(item->type == RYLR_CBOR_ERROR){
+		dec->pos = dec->length;		//nothing after a bad item can be trusted
+	}
+	return item->type;
+}
+
+
+/**
+ * @brief  Looks up an integer key in a message made of one map, skipping the values of the other keys.
+ * @param  buffer: received payload
+ * @param  length: payload length
+ * @param  key: key searched
+ * @param  item: its value
+ * @retval HAL_StatusTypeDef: HAL_ERROR if the key is missing or the message is malformed
+ */
+HAL_StatusTypeDef rylr998_cborFind(const uint8_t *buffer, uint8_t length, uint32_t key, RYLR_cbor_item_t *item){
+
+	RYLR_cbor_dec_t dec;
+	uint32_t pairs;
+
+	rylr998_cborDecInit(&dec, buffer, length);
+	if(rylr998_cborNext(&dec, item) != RYLR_CBOR_MAP){
+		return HAL_ERROR;
+	}
+
+	for(pairs = item->u; pairs > 0; pairs--){
+		RYLR_cbor_type_t type = rylr998_cborNext(&dec, item);
+		uint8_t match = (type == RYLR_CBOR_UINT && item->u == key);
+
+		if(type == RYLR_CBOR_ERROR || type == RYLR_CBOR_END){
+			return HAL_ERROR;
+		}
+		// Value: one item, or a container and everything in it
+		uint32_t pending = 1;
+		uint8_t first = 1;
+		while(pending > 0){
+			type = rylr998_cborNext(&dec, item);
+			if(type == RYLR_CBOR_ERROR || type == RYLR_CBOR_END){
+				return HAL_ERROR;
+			}
+			if(match && first){
+				return HAL_OK;
+			}
+			first = 0;
+			pending--;
+			if(type == RYLR_CBOR_ARRAY){
+				pending += item->u;
+			}else if(type == RYLR_CBOR_MAP){
+				pending += 2U * item->u;
+			}
+		}
+	}
+	return HAL_ERROR;
+}
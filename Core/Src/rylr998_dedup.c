@@ -0,0 +1,90 @@
+/*
+ * rylr998_dedup.c
+ *
+ *  Duplicate suppression keyed by sender address and sequence number.
+ */
+#include "rylr998_dedup.h"
+#include <string.h>
+
+
+/**
+ * @brief  Slot of a key, consecutive sequences of one sender land on consecutive slots
+ */
+static uint8_t rylr998_dedup_slot(uint16_t id, uint8_t seq){
+	return (uint8_t)((id * 7U + (id >> 8) + seq) & (RYLR_DEDUP_ENTRIES - 1U));
+}
+
+
+/**
+ * @brief  Initializes an empty table.
+ * @param  dedup: table
+ * @param  tick: millisecond tick, e.g. HAL_GetTick or the handle's tick
+ * @param  max_age_ms: entries older than this never match, 0 for RYLR_DEDUP_MAX_AGE_MS
+ */
+void rylr998_dedupInit(rylr998_dedup_t *dedup, RYLR_tick_fn_t tick, uint32_t max_age_ms){
+
+	memset(dedup, 0, sizeof(*dedup));
+	dedup->tick = (tick != NULL) ? tick : HAL_GetTick;
+	dedup->max_age_ms = (max_age_ms != 0) ? max_age_ms : RYLR_DEDUP_MAX_AGE_MS;
+}
+
+
+/**
+ * @brief  Looks a packet up and records it. Call it from the +RCV callback before the application.
+ * @param  dedup: table
+ * @param  id: address of the sender (+RCV id)
+ * @param  seq: sequence number carried in the payload
+ * @retval 1 if the packet was already received within max_age_ms and should be dropped, 0 otherwise
+ */
+uint8_t rylr998_dedupCheck(rylr998_dedup_t *dedup, uint16_t id, uint8_t seq){
+
+	uint32_t now = dedup->tick();
+	RYLR_dedup_entry_t *entry = &dedup->entry[rylr998_dedup_slot(id, seq)];
+	uint8_t live = entry->valid && (now - entry->stamp) < dedup->max_age_ms;
+
+	dedup->stats.lookups++;
+
+	if(live && entry->id == id && entry->seq == seq){
+		dedup->stats.hits++;
+		return 1;		//keep the first stamp, the age counts from the original
+	}
+	if(live){
+		dedup->stats.evictions++;
+	}
+
+	entry->id = id;
+	entry->seq = seq;
+	entry->valid = 1;
+	entry->stamp = now;
+	return 0;
+}
+
+
+/**
+ * @brief  Forgets every packet, e.g. after the network was re-keyed.
+ * @param  dedup: table
+ */
+void rylr998_dedupClear(rylr998_dedup_t *dedup){
+	memset(dedup->entry, 0, sizeof(dedup->entry));
+}
+
+
+/**
+ * @brief  Returns the share of lookups that were duplicates, in percent.
+ * @param  dedup: table
+ */
+uint8_t rylr998_dedupHitRate(const rylr998_dedup_t *dedup){
+
+	uint32_t lookups = dedup->stats.lookups;
+	uint32_t hits = dedup->stats.hits;
+
+	// Stay in 32 bits, the M0+ has no 64 bit divide
+	while(hits > UINT32_MAX / 100U){
+		hits >>= 1;
+		lookups >>= 1;
+	}
+	if(lookups == 0){
+		return 0;
+	}
+	return (uint8_t)((hits * 100U) / lookups);
+}
@@ -0,0 +1,214 @@
+/*
+ * rylr998_energy.c
+ *
+ *  Charge accounting from airtime, module mode and MCU Stop time.
+ */
+#include "rylr998_energy.h"
+#include <string.h>
+
+
+#define RYLR_ENERGY_NAS_STEP		600000000UL	//largest charge added at once, nas + step stays below 2^32
+
+
+static const uint8_t rylr998_energy_tx_ma[] = RYLR_ENERGY_TX_TABLE;
+
+
+/**
+ * @brief  Adds ms at ua to a counter
+ */
+static void rylr998_energy_charge(RYLR_charge_t *c, uint32_t ms, uint32_t ua){
+
+	uint32_t step;
+
+	if(ms == 0 || ua == 0){
+		return;
+	}
+	step = RYLR_ENERGY_NAS_STEP / ua;
+	if(step == 0){
+		step = 1;
+	}
+	while(ms > 0){
+		uint32_t n = (ms < step) ? ms : step;
+		c->nas += n * ua;
+		ms -= n;
+		if(c->nas >= RYLR_ENERGY_NAS_PER_UAH){
+			c->uah += c->nas / RYLR_ENERGY_NAS_PER_UAH;
+			c->nas %= RYLR_ENERGY_NAS_PER_UAH;
+		}
+	}
+}
+
+
+/**
+ * @brief  Returns the modeled TX current of the module.
+ * @param  crfop: RF output power, dBm (0 to 22)
+ * @retval uA
+ */
+uint32_t rylr998_energyTxCurrent(uint8_t crfop){
+
+	uint8_t last = sizeof(rylr998_energy_tx_ma) - 1U;
+	uint8_t i = crfop / 2U;
+
+	if(i >= last){
+		return rylr998_energy_tx_ma[last] * 1000U;
+	}
+	// Odd dBm: halfway between the two even ones
+	return (rylr998_energy_tx_ma[i] * 1000U) +
+		   (crfop & 1U) * ((rylr998_energy_tx_ma[i + 1] - rylr998_energy_tx_ma[i]) * 1000U / 2U);
+}
+
+
+/**
+ * @brief  Returns the modeled module current when it is not transmitting, from the last AT+MODE.
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @retval uA
+ */
+uint32_t rylr998_energyModuleCurrent(rylr998_t *hrylr){
+
+	switch(hrylr->mode){
+		case 1:
+			return RYLR_I_SLEEP_UA;
+		case 2:
+			if(hrylr->mode_rx_ms + hrylr->mode_sleep_ms != 0){
+				return (hrylr->mode_rx_ms * RYLR_I_RX_UA + hrylr->mode_sleep_ms * RYLR_I_SLEEP_UA) /
+					   (hrylr->mode_rx_ms + hrylr->mode_sleep_ms);
+			}
+			return RYLR_I_RX_UA;
+		default:
+			return RYLR_I_RX_UA;
+	}
+}
+
+
+/**
+ * @brief  Starts the accounting from now, counters at zero.
+ * @param  en: accounting state
+ * @param  hrylr: Pointer to the RYLR998 handle
+ */
+void rylr998_energyInit(rylr998_energy_t *en, rylr998_t *hrylr){
+
+	memset(en, 0, sizeof(*en));
+	en->hrylr = hrylr;
+	en->last_tick = hrylr->tick();
+	en->last_air_us = hrylr->tx_air_us;
+	en->last_stop_ms = hrylr->stop.stop_ms;
+}
+
+
+/**
+ * @brief  Charges a received frame, call it from the receive callback. In AT+MODE=0 receiving costs
+ *         what listening costs and nothing is added; asleep, the module stays awake for the frame.
+ * @param  en: accounting state
+ * @param  packet: packet decoded by the parser
+ */
+void rylr998_energyInput(rylr998_energy_t *en, const RYLR_RX_data_t *packet){
+
+	rylr998_t *hrylr = en->hrylr;
+
+	if(hrylr->mode != 0){
+		uint32_t ms = (rylr998_timeOnAir(rylr998_activePhy(hrylr), packet->byte_count) + 999U) / 1000U;
+		rylr998_energy_charge(&en->rx, ms, RYLR_I_RX_UA - RYLR_I_SLEEP_UA);
+	}
+}
+
+
+/**
+ * @brief  Charges the time since the last call to the states it was spent in. Call it from the main loop
+ *         and before reading the counters, at least once per hour of airtime (tx_air_us wraps).
+ * @param  en: accounting state
+ */
+void rylr998_energyProcess(rylr998_energy_t *en){
+
+	rylr998_t *hrylr = en->hrylr;
+	uint32_t now = hrylr->tick();
+	uint32_t elapsed = now - en->last_tick;
+	uint32_t air_us = hrylr->tx_air_us - en->last_air_us;
+	uint32_t stop_ms = hrylr->stop.stop_ms - en->last_stop_ms;
+	uint32_t tx_ms = air_us / 1000U;
+	uint32_t idle_ms;
+
+	// Whole ms only, the rest of the airtime is charged on the next call
+	en->last_tick = now;
+	en->last_air_us += tx_ms * 1000U;
+	en->last_stop_ms = hrylr->stop.stop_ms;
+
+	rylr998_energy_charge(&en->tx, tx_ms, rylr998_energyTxCurrent(rylr998_activePhy(hrylr)->CRFOP));
+
+	idle_ms = (elapsed > tx_ms) ? elapsed - tx_ms : 0;
+	if(hrylr->mode == 1){
+		rylr998_energy_charge(&en->sleep, idle_ms, RYLR_I_SLEEP_UA);
+	}else if(hrylr->mode == 2 && hrylr->mode_rx_ms + hrylr->mode_sleep_ms != 0){
+		// Share of the windows, the cycle halved if needed so that remainder * window fits 32 bits
+		uint32_t cycle = hrylr->mode_rx_ms + hrylr->mode_sleep_ms;
+		uint32_t window = hrylr->mode_rx_ms;
+		if(cycle > 0xFFFFU){
+			cycle >>= 1;
+			window >>= 1;
+		}
+		uint32_t rx_ms = (idle_ms / cycle) * window + ((idle_ms % cycle) * window) / cycle;
+		rylr998_energy_charge(&en->rx, rx_ms, RYLR_I_RX_UA);
+		rylr998_energy_charge(&en->sleep, idle_ms - rx_ms, RYLR_I_SLEEP_UA);
+	}else{
+		rylr998_energy_charge(&en->rx, idle_ms, RYLR_I_RX_UA);
+	}
+
+	if(stop_ms > elapsed){
+		stop_ms = elapsed;
+	}
+	rylr998_energy_charge(&en->mcu, elapsed - stop_ms, RYLR_ENERGY_I_MCU_RUN_UA);
+	rylr998_energy_charge(&en->mcu, stop_ms, RYLR_ENERGY_I_MCU_STOP_UA);
+}
+
+
+/**
+ * @brief  Returns the charge drawn since rylr998_energyInit, all states, in uAh
+ */
+uint32_t rylr998_energyTotalUah(const rylr998_energy_t *en){
+
+	uint32_t nas = en->tx.nas + en->rx.nas + en->sleep.nas + en->mcu.nas;
+
+	return en->tx.uah + en->rx.uah + en->sleep.uah + en->mcu.uah + nas / RYLR_ENERGY_NAS_PER_UAH;
+}
+
+
+/**
+ * @brief  Returns the charge one more frame costs with the current settings: its time on air at the
+ *         TX current, minus what the module would have drawn anyway.
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  data_length: bytes that will be given to rylr998_sendData
+ * @retval uAs (uC)
+ */
+uint32_t rylr998_energyFrameCost(rylr998_t *hrylr, uint8_t data_length){
+
+	const RYLR_phy_t *phy = rylr998_activePhy(hrylr);
+	uint32_t air_us = rylr998_timeOnAir(phy, data_length + hrylr->filter_overhead);
+	uint32_t tx_ua = rylr998_energyTxCurrent(phy->CRFOP);
+	uint32_t idle_ua = rylr998_energyModuleCurrent(hrylr);
+	uint32_t extra_ua = (tx_ua > idle_ua) ? tx_ua - idle_ua : 0;
+
+	// (100 us) * (10 uA) = 1 nAs, keeps both factors well inside 32 bits
+	return ((air_us + 50U) / 100U) * (extra_ua / 10U) / 1000U;
+}
+
+
+/**
+ * @brief  Returns the average module current when sending one frame every period_ms with the current
+ *         settings, to trade the report rate against the battery life.
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  data_length: bytes given to rylr998_sendData per frame
+ * @param  period_ms: time between two frames
+ * @retval uA, the MCU not included
+ */
+uint32_t rylr998_energyAverageUa(rylr998_t *hrylr, uint8_t data_length, uint32_t period_ms){
+
+	uint32_t cost_uas = rylr998_energyFrameCost(hrylr, data_length);
+
+	if(period_ms == 0){
+		return UINT32_MAX;
+	}
+	// uAs per ms is mA: scale the cost to uA first, in two steps to stay in 32 bits
+	if(cost_uas <= UINT32_MAX / 1000U){
+		return rylr998_energyModuleCurrent(hrylr) + (cost_uas * 1000U) / period_ms;
+	}
+	return rylr998_energyModuleCurrent(hrylr) + (cost_uas / period_ms) * 1000U;
+}
@@ -0,0 +1,274 @@
+/*
+ * rylr998_fec.c
+ *
+ *  Systematic Reed-Solomon erasure code over GF(2^8), Cauchy generator matrix.
+ */
+#include "rylr998_fec.h"
+#include <string.h>
+
+
+/**
+ * @brief  Product in GF(2^8), polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D)
+ */
+static uint8_t rylr998_gf_mul(uint8_t a, uint8_t b){
+
+	uint8_t p = 0;
+
+	while(b){
+		if(b & 1U){
+			p ^= a;
+		}
+		a = (uint8_t)((a << 1) ^ ((a & 0x80U) ? 0x1DU : 0U));
+		b >>= 1;
+	}
+	return p;
+}
+
+
+/**
+ * @brief  Inverse in GF(2^8): a^254
+ */
+static uint8_t rylr998_gf_inv(uint8_t a){
+
+	uint8_t r = 1;
+
+	for(uint8_t e = 254; e; e >>= 1){
+		if(e & 1U){
+			r = rylr998_gf_mul(r, a);
+		}
+		a = rylr998_gf_mul(a, a);
+	}
+	return r;
+}
+
+
+/**
+ * @brief  Generator coefficient of parity row for data fragment i: 1 / (x_row + y_i),
+ *         with x_row = 0x80 + row and y_i = i, two disjoint sets so every k x k submatrix is invertible
+ */
+static uint8_t rylr998_fec_coef(uint8_t row, uint8_t i){
+	return rylr998_gf_inv((uint8_t)((0x80U + row) ^ i));
+}
+
+
+/**
+ * @brief  Computes one parity fragment of a group.
+ * @param  data: k data fragments of length bytes, contiguous
+ * @param  k: data fragments in the group
+ * @param  length: bytes per fragment
+ * @param  row: parity row, 0 to m - 1
+ * @param  parity: length bytes written
+ */
+void rylr998_fecEncode(const uint8_t *data, uint8_t k, uint8_t length, uint8_t row, uint8_t *parity){
+
+	memset(parity, 0, length);
+	for(uint8_t i = 0; i < k; i++){
+		uint8_t c = rylr998_fec_coef(row, i);
+		const uint8_t *fragment = &data[i * length];
+
+		for(uint8_t b = 0; b < length; b++){
+			parity[b] ^= rylr998_gf_mul(c, fragment[b]);
+		}
+	}
+}
+
+
+/**
+ * @brief  Sends a group: the k data fragments, then m parity fragments computed one at a time.
+ *         Blocks until the module acknowledged every frame.
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  dest: destination address
+ * @param  group: group number, the receiver starts over when it changes
+ * @param  data: k fragments of length bytes, contiguous (pad the last one)
+ * @param  k: 1 to RYLR_FEC_K_MAX
+ * @param  m: 0 to RYLR_FEC_M_MAX
+ * @param  length: 1 to RYLR_FEC_FRAGMENT_MAX
+ * @retval HAL_StatusTypeDef: HAL_ERROR on invalid sizes or a frame the module did not accept
+ */
+HAL_StatusTypeDef rylr998_fecSendGroup(rylr998_t *hrylr, uint16_t dest, uint8_t group,
+									   const uint8_t *data, uint8_t k, uint8_t m, uint8_t length){
+
+	uint8_t frame[RYLR_FEC_HEADER_SIZE + RYLR_FEC_FRAGMENT_MAX];
+
+	if(k == 0 || k > RYLR_FEC_K_MAX || m > RYLR_FEC_M_MAX || length == 0 || length > RYLR_FEC_FRAGMENT_MAX){
+		return HAL_ERROR;
+	}
+
+	frame[0] = RYLR_FEC_FRAME;
+	frame[1] = group;
+	frame[3] = k;
+	frame[4] = m;
+
+	for(uint8_t index = 0; index < k + m; index++){
+		frame[2] = index;
+		if(index < k){
+			memcpy(&frame[RYLR_FEC_HEADER_SIZE], &data[index * length], length);
+		}else{
+			rylr998_fecEncode(data, k, length, index - k, &frame[RYLR_FEC_HEADER_SIZE]);
+		}
+		if(rylr998_sendData(hrylr, dest, frame, RYLR_FEC_HEADER_SIZE + length) != HAL_OK ||
+		   rylr998_AwaitResponse(hrylr, RYLR_OK, NULL) != RYLR_STATUS_OK){
+			return HAL_ERROR;
+		}
+	}
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Initializes the receiver of one peer.
+ * @param  rx: receiver
+ * @param  peer: address of the sender
+ * @param  deliver: called with the k data fragments of every complete or repaired group
+ */
+void rylr998_fecInit(rylr998_fec_rx_t *rx, uint16_t peer, RYLR_fec_deliver_t deliver){
+
+	memset(rx, 0, sizeof(*rx));
+	rx->peer = peer;
+	rx->deliver = deliver;
+}
+
+
+/**
+ * @brief  Rebuilds the missing data fragments from k received ones (Gauss-Jordan on the k x k matrix)
+ * @retval HAL_ERROR if the matrix is singular, which the Cauchy construction rules out
+ */
+static HAL_StatusTypeDef rylr998_fec_repair(rylr998_fec_rx_t *rx){
+
+	uint8_t k = rx->k;
+	uint8_t a[RYLR_FEC_K_MAX][RYLR_FEC_K_MAX];
+	uint8_t inv[RYLR_FEC_K_MAX][RYLR_FEC_K_MAX];
+	const uint8_t *source[RYLR_FEC_K_MAX];
+	uint8_t rows = 0;
+
+	// Received data fragments first, then as many parity rows as needed
+	for(uint8_t index = 0; index < k + rx->m && rows < k; index++){
+		if(!(rx->have & (1U << index))){
+			continue;
+		}
+		for(uint8_t i = 0; i < k; i++){
+			a[rows][i] = (index < k) ? (i == index) : rylr998_fec_coef(index - k, i);
+			inv[rows][i] = (i == rows);
+		}
+		source[rows++] = (index < k) ? &rx->data[index * rx->length] : &rx->parity[(index - k) * rx->length];
+	}
+
+	for(uint8_t col = 0; col < k; col++){
+		uint8_t pivot = col;
+		while(pivot < k && a[pivot][col] == 0){
+			pivot++;
+		}
+		if(pivot == k){
+			return HAL_ERROR;
+		}
+		if(pivot != col){
+			for(uint8_t i = 0; i < k; i++){
+				uint8_t t = a[col][i]; a[col][i] = a[pivot][i]; a[pivot][i] = t;
+				t = inv[col][i]; inv[col][i] = inv[pivot][i]; inv[pivot][i] = t;
+			}
+		}
+		uint8_t scale = rylr998_gf_inv(a[col][col]);
+		for(uint8_t i = 0; i < k; i++){
+			a[col][i] = rylr998_gf_mul(a[col][i], scale);
+			inv[col][i] = rylr998_gf_mul(inv[col][i], scale);
+		}
+		for(uint8_t r = 0; r < k; r++){
+			uint8_t f = a[r][col];
+			if(r == col || f == 0){
+				continue;
+			}
+			for(uint8_t i = 0; i < k; i++){
+				a[r][i] ^= rylr998_gf_mul(f, a[col][i]);
+				inv[r][i] ^= rylr998_gf_mul(f, inv[col][i]);
+			}
+		}
+	}
+
+	// Missing fragment l = row l of the inverse applied to the received fragments
+	for(uint8_t l = 0; l < k; l++){
+		if(rx->have & (1U << l)){
+			continue;
+		}
+		uint8_t *out = &rx->data[l * rx->length];
+		memset(out, 0, rx->length);
+		for(uint8_t r = 0; r < k; r++){
+			if(inv[l][r] == 0){
+				continue;
+			}
+			for(uint8_t b = 0; b < rx->length; b++){
+				out[b] ^= rylr998_gf_mul(inv[l][r], source[r][b]);
+			}
+		}
+		rx->stats.fragments_rebuilt++;
+	}
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Collects the fragments of the peer, call it from the +RCV callback.
+ *         The group is delivered as soon as any k of its fragments arrived.
+ * @param  rx: receiver
+ * @param  packet: packet decoded by the parser
+ * @retval 1 if the packet was a fragment of the peer, 0 to let other layers look at it
+ */
+uint8_t rylr998_fecInput(rylr998_fec_rx_t *rx, const RYLR_RX_data_t *packet){
+
+	const uint8_t *frame = packet->data;
+
+	if(packet->id != rx->peer || packet->byte_count <= RYLR_FEC_HEADER_SIZE || frame[0] != RYLR_FEC_FRAME){
+		return 0;
+	}
+
+	uint8_t group = frame[1];
+	uint8_t index = frame[2];
+	uint8_t k = frame[3];
+	uint8_t m = frame[4];
+	uint8_t length = packet->byte_count - RYLR_FEC_HEADER_SIZE;
+
+	if(k == 0 || k > RYLR_FEC_K_MAX || m > RYLR_FEC_M_MAX || index >= k + m || length > RYLR_FEC_FRAGMENT_MAX){
+		return 1;
+	}
+
+	// New group: the previous one is complete or lost for good
+	if(!rx->active || group != rx->group){
+		if(rx->active && !rx->done){
+			rx->stats.groups_lost++;
+		}
+		rx->active = 1;
+		rx->done = 0;
+		rx->group = group;
+		rx->k = k;
+		rx->m = m;
+		rx->length = length;
+		rx->have = 0;
+	}
+	if(rx->done || k != rx->k || m != rx->m || length != rx->length || (rx->have & (1U << index))){
+		return 1;
+	}
+
+	memcpy((index < k) ? &rx->data[index * length] : &rx->parity[(index - k) * length], &frame[RYLR_FEC_HEADER_SIZE], length);
+	rx->have |= (uint16_t)(1U << index);
+
+	uint8_t count = 0;
+	for(uint8_t i = 0; i < k + m; i++){
+		count += (rx->have >> i) & 1U;
+	}
+	if(count < k){
+		return 1;
+	}
+
+	uint16_t data_mask = (uint16_t)((1U << k) - 1U);
+	if((rx->have & data_mask) != data_mask){
+		if(rylr998_fec_repair(rx) != HAL_OK){
+			return 1;
+		}
+		rx->stats.groups_repaired++;
+	}
+	rx->done = 1;
+	rx->stats.groups++;
+	if(rx->deliver != NULL){
+		rx->deliver(rx, group, rx->data, k, length);
+	}
+	return 1;
+}
@@ -0,0 +1,160 @@
+/*
+ * rylr998_link.c
+ *
+ *  Per-peer link quality table.
+ */
+#include "rylr998_link.h"
+#include <string.h>
+
+
+/**
+ * @brief  Home slot of an address (multiplicative hash, top bits of the 16 bit product)
+ */
+static uint8_t rylr998_link_hash(uint16_t address){
+	return (uint8_t)(((uint16_t)(address * 40503U) >> 8) & (RYLR_LINK_CAPACITY - 1U));
+}
+
+
+/**
+ * @brief  Moves a delivery ratio 1/8 of the way toward 0 or 255
+ */
+static uint8_t rylr998_link_pdr(uint8_t pdr, uint8_t delivered){
+	return delivered ? (uint8_t)(pdr + (255U - pdr + 7U) / 8U) : (uint8_t)(pdr - (pdr + 7U) / 8U);
+}
+
+
+/**
+ * @brief  Looks an address up within the probe window
+ * @param  insert: 1 to take a free slot or evict the stalest one when not found
+ */
+static RYLR_link_entry_t *rylr998_link_slot(rylr998_link_t *links, uint16_t address, uint8_t insert){
+
+	uint8_t home = rylr998_link_hash(address);
+	RYLR_link_entry_t *stalest = NULL;
+
+	for(uint8_t i = 0; i < RYLR_LINK_PROBE && i < RYLR_LINK_CAPACITY; i++){
+		RYLR_link_entry_t *entry = &links->entry[(home + i) & (RYLR_LINK_CAPACITY - 1U)];
+
+		if(entry->used && entry->address == address){
+			return entry;
+		}
+		if(!entry->used){
+			if(!insert){
+				return NULL;	//never replaced by a hole, the address is not further on
+			}
+			stalest = entry;
+			break;
+		}
+		if(stalest == NULL || (int32_t)(entry->last_seen - stalest->last_seen) < 0){
+			stalest = entry;
+		}
+	}
+
+	if(!insert){
+		return NULL;
+	}
+	if(stalest->used){
+		links->evictions++;
+	}
+	memset(stalest, 0, sizeof(*stalest));
+	stalest->used = 1;
+	stalest->address = address;
+	stalest->pdr = 255U;
+	stalest->last_seen = links->tick();
+	return stalest;
+}
+
+
+/**
+ * @brief  Initializes an empty table.
+ * @param  links: table
+ * @param  tick: millisecond tick, e.g. HAL_GetTick or the handle's tick
+ */
+void rylr998_linkInit(rylr998_link_t *links, RYLR_tick_fn_t tick){
+
+	memset(links, 0, sizeof(*links));
+	links->tick = (tick != NULL) ? tick : HAL_GetTick;
+}
+
+
+/**
+ * @brief  Records the RSSI and SNR of a received packet, call it from the +RCV callback.
+ *         The packet is not consumed, pass it on to the other layers.
+ * @param  links: table
+ * @param  packet: packet decoded by the parser
+ * @retval Pointer to the entry of the sender
+ */
+RYLR_link_entry_t *rylr998_linkInput(rylr998_link_t *links, const RYLR_RX_data_t *packet){
+
+	RYLR_link_entry_t *entry = rylr998_link_slot(links, packet->id, 1);
+	int16_t rssi_q4 = (int16_t)(packet->rssi * 16);
+	int16_t snr_q4 = (int16_t)(packet->snr * 16);
+
+	if(entry->rx_frames == 0){
+		entry->rssi_q4 = rssi_q4;
+		entry->snr_q4 = snr_q4;
+	}else{
+		entry->rssi_q4 += (rssi_q4 - entry->rssi_q4) / 8;
+		entry->snr_q4 += (snr_q4 - entry->snr_q4) / 8;
+	}
+	entry->rx_frames++;
+	entry->last_seen = links->tick();
+	return entry;
+}
+
+
+/**
+ * @brief  Counts the frames lost since the previous sequence number of a peer into its delivery ratio.
+ *         Call it after rylr998_linkInput with the sequence number carried in the payload.
+ * @param  links: table
+ * @param  address: sender (+RCV id)
+ * @param  seq: sequence number of the frame, incremented by 1 per frame by the sender
+ */
+void rylr998_linkSeq(rylr998_link_t *links, uint16_t address, uint8_t seq){
+
+	RYLR_link_entry_t *entry = rylr998_link_slot(links, address, 1);
+
+	if(entry->seq_valid){
+		uint8_t gap = (uint8_t)(seq - entry->last_seq - 1U);
+
+		if(gap >= 128U){
+			return;		//older than the last one: a duplicate, nothing lost
+		}
+		entry->rx_lost += gap;
+		for(uint8_t i = 0; i < gap && i < RYLR_LINK_MAX_GAP; i++){
+			entry->pdr = rylr998_link_pdr(entry->pdr, 0);
+		}
+	}
+	entry->pdr = rylr998_link_pdr(entry->pdr, 1);
+	entry->last_seq = seq;
+	entry->seq_valid = 1;
+}
+
+
+/**
+ * @brief  Counts a frame sent to a peer into its delivery ratio, call it when its ACK arrives or times out.
+ * @param  links: table
+ * @param  address: destination
+ * @param  acked: 1 if acknowledged
+ */
+void rylr998_linkTxResult(rylr998_link_t *links, uint16_t address, uint8_t acked){
+
+	RYLR_link_entry_t *entry = rylr998_link_slot(links, address, 1);
+
+	entry->tx_frames++;
+	if(acked){
+		entry->tx_acked++;
+	}
+	entry->pdr = rylr998_link_pdr(entry->pdr, acked);
+}
+
+
+/**
+ * @brief  Returns the statistics of a peer.
+ * @param  links: table
+ * @param  address: peer
+ * @retval Pointer to the entry, NULL if never heard or evicted
+ */
+const RYLR_link_entry_t *rylr998_linkFind(const rylr998_link_t *links, uint16_t address){
+	return rylr998_link_slot((rylr998_link_t *)links, address, 0);
+}
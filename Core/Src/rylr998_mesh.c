@@ -0,0 +1,309 @@
+/*
+ * rylr998_mesh.c
+ *
+ *  Multi-hop forwarding toward a gateway.
+ */
+#include "rylr998_mesh.h"
+#include <string.h>
+
+
+/**
+ * @brief  Cost of a link from the SNR it was heard with: 1, plus 1 per dB below RYLR_MESH_GOOD_SNR
+ */
+static uint8_t rylr998_mesh_link_cost(int8_t snr){
+	return (snr >= RYLR_MESH_GOOD_SNR) ? 1U : (uint8_t)(1 + RYLR_MESH_GOOD_SNR - snr);
+}
+
+
+/**
+ * @brief  Neighbor entry of an address, NULL if unknown or not heard for RYLR_MESH_ROUTE_AGE_MS
+ */
+static RYLR_mesh_neighbor_t *rylr998_mesh_neighbor(rylr998_mesh_t *mesh, uint16_t address, uint32_t now){
+
+	for(uint8_t i = 0; i < RYLR_MESH_NEIGHBORS; i++){
+		RYLR_mesh_neighbor_t *n = &mesh->neighbor[i];
+		if(n->link_cost != 0 && n->address == address && (now - n->last) < RYLR_MESH_ROUTE_AGE_MS){
+			return n;
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief  Records the neighbor a frame was heard from, the stalest entry is recycled
+ */
+static void rylr998_mesh_learn(rylr998_mesh_t *mesh, uint16_t address, uint8_t advertised, int8_t snr, uint32_t now){
+
+	RYLR_mesh_neighbor_t *n = NULL;
+	RYLR_mesh_neighbor_t *oldest = &mesh->neighbor[0];
+	uint8_t link = rylr998_mesh_link_cost(snr);
+
+	for(uint8_t i = 0; i < RYLR_MESH_NEIGHBORS; i++){
+		if(mesh->neighbor[i].link_cost != 0 && mesh->neighbor[i].address == address){
+			n = &mesh->neighbor[i];
+			break;
+		}
+		if(mesh->neighbor[i].link_cost == 0 ||
+		   (oldest->link_cost != 0 && (int32_t)(mesh->neighbor[i].last - oldest->last) < 0)){
+			oldest = &mesh->neighbor[i];
+		}
+	}
+	if(n == NULL){
+		n = oldest;
+		n->address = address;
+		n->link_cost = link;
+	}else{
+		n->link_cost = (uint8_t)((3U * n->link_cost + link + 3U) / 4U);	//smoothed, never rounds to 0
+	}
+
+	if(advertised >= RYLR_MESH_NO_ROUTE - n->link_cost){
+		n->cost = RYLR_MESH_NO_ROUTE;
+	}else{
+		n->cost = advertised + n->link_cost;
+	}
+	n->last = now;
+}
+
+
+/**
+ * @brief  Returns the neighbor with the cheapest route to the gateway.
+ * @param  mesh: mesh state
+ * @retval Pointer to the neighbor, NULL on the gateway or while no route is known
+ */
+const RYLR_mesh_neighbor_t *rylr998_meshParent(rylr998_mesh_t *mesh){
+
+	const RYLR_mesh_neighbor_t *parent = NULL;
+	uint32_t now = mesh->hrylr->tick();
+
+	if(mesh->address == mesh->gateway){
+		return NULL;
+	}
+	for(uint8_t i = 0; i < RYLR_MESH_NEIGHBORS; i++){
+		const RYLR_mesh_neighbor_t *n = &mesh->neighbor[i];
+		if(n->link_cost != 0 && n->cost != RYLR_MESH_NO_ROUTE && (now - n->last) < RYLR_MESH_ROUTE_AGE_MS &&
+		   (parent == NULL || n->cost < parent->cost)){
+			parent = n;
+		}
+	}
+	return parent;
+}
+
+
+/**
+ * @brief  Returns the cost to the gateway advertised by this node.
+ * @param  mesh: mesh state
+ * @retval 0 on the gateway, RYLR_MESH_NO_ROUTE without a parent
+ */
+uint8_t rylr998_meshCost(rylr998_mesh_t *mesh){
+
+	const RYLR_mesh_neighbor_t *parent;
+
+	if(mesh->address == mesh->gateway){
+		return 0;
+	}
+	parent = rylr998_meshParent(mesh);
+	return (parent != NULL) ? parent->cost : RYLR_MESH_NO_ROUTE;
+}
+
+
+/**
+ * @brief  Next hop toward a destination: the destination itself if it is a neighbor, the parent otherwise
+ * @retval HAL_ERROR if no route
+ */
+static HAL_StatusTypeDef rylr998_mesh_route(rylr998_mesh_t *mesh, uint16_t dest, uint16_t *next_hop){
+
+	const RYLR_mesh_neighbor_t *n = rylr998_mesh_neighbor(mesh, dest, mesh->hrylr->tick());
+
+	if(n == NULL){
+		n = rylr998_meshParent(mesh);
+	}
+	if(n == NULL){
+		return HAL_ERROR;
+	}
+	*next_hop = n->address;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Sends one frame to the next hop and waits for the module's +OK
+ */
+static HAL_StatusTypeDef rylr998_mesh_transmit(rylr998_mesh_t *mesh, uint16_t next_hop, uint8_t *frame, uint8_t length){
+
+	rylr998_t *hrylr = mesh->hrylr;
+
+	if(rylr998_sendData(hrylr, next_hop, frame, length) != HAL_OK ||
+	   rylr998_AwaitResponse(hrylr, RYLR_OK, NULL) != RYLR_STATUS_OK){
+		return HAL_ERROR;
+	}
+	mesh->radio_free = hrylr->tick() + (rylr998_timeOnAir(rylr998_activePhy(hrylr), length) + 999U) / 1000U;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Writes a frame header
+ */
+static void rylr998_mesh_header(uint8_t *frame, uint8_t ttl, uint8_t seq, uint16_t origin, uint16_t dest, uint8_t cost){
+
+	frame[0] = RYLR_MESH_FRAME;
+	frame[1] = ttl;
+	frame[2] = seq;
+	frame[3] = (uint8_t)origin;
+	frame[4] = (uint8_t)(origin >> 8);
+	frame[5] = (uint8_t)dest;
+	frame[6] = (uint8_t)(dest >> 8);
+	frame[7] = cost;
+}
+
+
+/**
+ * @brief  Initializes the mesh state, no neighbor known.
+ * @param  mesh: mesh state
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  address: address of this module (AT+ADDRESS)
+ * @param  gateway: address the routes lead to, equal to address on the gateway itself
+ * @param  deliver: called for every frame addressed to this node
+ */
+void rylr998_meshInit(rylr998_mesh_t *mesh, rylr998_t *hrylr, uint16_t address, uint16_t gateway,
+					  RYLR_mesh_deliver_t deliver){
+
+	memset(mesh, 0, sizeof(*mesh));
+	mesh->hrylr = hrylr;
+	mesh->address = address;
+	mesh->gateway = gateway;
+	mesh->deliver = deliver;
+	mesh->radio_free = hrylr->tick();
+	mesh->last_hello = mesh->radio_free - RYLR_MESH_HELLO_MS;
+	rylr998_dedupInit(&mesh->dedup, hrylr->tick, 0);
+}
+
+
+/**
+ * @brief  Sends a frame of this node, right away and ahead of the frames waiting to be forwarded.
+ * @param  mesh: mesh state
+ * @param  dest: final destination, usually the gateway
+ * @param  data: payload
+ * @param  length: up to RYLR_MESH_PAYLOAD_MAX bytes
+ * @retval HAL_StatusTypeDef: HAL_ERROR if too long, no route or the module did not accept it
+ */
+HAL_StatusTypeDef rylr998_meshSend(rylr998_mesh_t *mesh, uint16_t dest, const uint8_t *data, uint8_t length){
+
+	uint8_t frame[RYLR_MESH_HEADER_SIZE + RYLR_MESH_PAYLOAD_MAX];
+	uint16_t next_hop;
+
+	if(length > RYLR_MESH_PAYLOAD_MAX){
+		return HAL_ERROR;
+	}
+	if(rylr998_mesh_route(mesh, dest, &next_hop) != HAL_OK){
+		mesh->stats.no_route++;
+		return HAL_ERROR;
+	}
+
+	rylr998_mesh_header(frame, RYLR_MESH_TTL, mesh->seq, mesh->address, dest, rylr998_meshCost(mesh));
+	memcpy(&frame[RYLR_MESH_HEADER_SIZE], data, length);
+	rylr998_dedupCheck(&mesh->dedup, mesh->address, mesh->seq);		//drop it if a loop brings it back
+	mesh->seq++;
+
+	if(rylr998_mesh_transmit(mesh, next_hop, frame, RYLR_MESH_HEADER_SIZE + length) != HAL_OK){
+		return HAL_ERROR;
+	}
+	mesh->stats.sent++;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Learns the route from a received frame, delivers or queues it for forwarding.
+ *         Call it from the +RCV callback, it never transmits.
+ * @param  mesh: mesh state
+ * @param  packet: packet decoded by the parser
+ * @retval 1 if the packet was a mesh frame, 0 to let other layers look at it
+ */
+uint8_t rylr998_meshInput(rylr998_mesh_t *mesh, const RYLR_RX_data_t *packet){
+
+	const uint8_t *frame = packet->data;
+	uint32_t now = mesh->hrylr->tick();
+
+	if(packet->byte_count < RYLR_MESH_HEADER_SIZE || frame[0] != RYLR_MESH_FRAME){
+		return 0;
+	}
+
+	uint8_t ttl = frame[1];
+	uint8_t seq = frame[2];
+	uint16_t origin = (uint16_t)(frame[3] | (frame[4] << 8));
+	uint16_t dest = (uint16_t)(frame[5] | (frame[6] << 8));
+
+	rylr998_mesh_learn(mesh, packet->id, frame[7], packet->snr, now);
+
+	if(rylr998_dedupCheck(&mesh->dedup, origin, seq)){
+		mesh->stats.duplicates++;
+		return 1;
+	}
+
+	// Addressed to this node, or a broadcast (hellos included): not forwarded
+	if(dest == mesh->address || dest == RYLR_BROADCAST_ADDRESS){
+		if(packet->byte_count > RYLR_MESH_HEADER_SIZE && mesh->deliver != NULL){
+			mesh->stats.delivered++;
+			mesh->deliver(mesh, origin, &frame[RYLR_MESH_HEADER_SIZE], packet->byte_count - RYLR_MESH_HEADER_SIZE);
+		}
+		return 1;
+	}
+
+	if(ttl == 0){
+		mesh->stats.ttl_expired++;
+		return 1;
+	}
+	if(mesh->fwd_count >= RYLR_MESH_FWD_DEPTH || packet->byte_count > sizeof(mesh->fwd[0].frame)){
+		mesh->stats.queue_full++;
+		return 1;
+	}
+
+	RYLR_mesh_fwd_t *fwd = &mesh->fwd[(mesh->fwd_head + mesh->fwd_count) % RYLR_MESH_FWD_DEPTH];
+	if(rylr998_mesh_route(mesh, dest, &fwd->next_hop) != HAL_OK || fwd->next_hop == packet->id){
+		mesh->stats.no_route++;		//no route, or it would bounce straight back
+		return 1;
+	}
+	memcpy(fwd->frame, frame, packet->byte_count);
+	fwd->frame[1] = ttl - 1;
+	fwd->length = packet->byte_count;
+	mesh->fwd_count++;
+	return 1;
+}
+
+
+/**
+ * @brief  Forwards one queued frame, or sends the hello when due. Call it from the main loop.
+ * @param  mesh: mesh state
+ */
+void rylr998_meshProcess(rylr998_mesh_t *mesh){
+
+	uint32_t now = mesh->hrylr->tick();
+
+	if((int32_t)(now - mesh->radio_free) < 0){
+		return;
+	}
+
+	if(mesh->fwd_count > 0){
+		RYLR_mesh_fwd_t *fwd = &mesh->fwd[mesh->fwd_head];
+
+		fwd->frame[7] = rylr998_meshCost(mesh);		//advertise our own route, not the origin's
+		if(rylr998_mesh_transmit(mesh, fwd->next_hop, fwd->frame, fwd->length) != HAL_OK){
+			return;		//module busy or duty cycle spent, try again on the next call
+		}
+		mesh->fwd_head = (mesh->fwd_head + 1) % RYLR_MESH_FWD_DEPTH;
+		mesh->fwd_count--;
+		mesh->stats.forwarded++;
+		return;
+	}
+
+	if(RYLR_MESH_HELLO_MS != 0 && (now - mesh->last_hello) >= RYLR_MESH_HELLO_MS){
+		uint8_t hello[RYLR_MESH_HEADER_SIZE];
+
+		rylr998_mesh_header(hello, 0, mesh->seq++, mesh->address, RYLR_BROADCAST_ADDRESS, rylr998_meshCost(mesh));
+		if(rylr998_mesh_transmit(mesh, RYLR_BROADCAST_ADDRESS, hello, sizeof(hello)) == HAL_OK){
+			mesh->last_hello = now;
+		}
+	}
+}
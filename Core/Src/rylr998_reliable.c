@@ -0,0 +1,323 @@
+/*
+ * rylr998_reliable.c
+ *
+ *  Sliding window ARQ with cumulative and selective ACKs.
+ */
+#include "rylr998_reliable.h"
+#include <string.h>
+
+
+/**
+ * @brief  Time on air of a frame with the handle's current settings, rounded up to ms
+ */
+static uint32_t rylr998_rel_airtime(rylr998_rel_t *rel, uint8_t length){
+	return (rylr998_timeOnAir(rylr998_activePhy(rel->hrylr), length) + 999U) / 1000U;
+}
+
+
+/**
+ * @brief  Retransmission timeout of a frame: the rest of the window may still go out after it,
+ *         then the receiver waits one frame gap before acknowledging, then the ACK comes back.
+ */
+static uint32_t rylr998_rel_rto(rylr998_rel_t *rel, uint8_t length){
+
+	uint32_t frame = rylr998_rel_airtime(rel, length + RYLR_REL_HEADER_SIZE) + RYLR_REL_TURNAROUND_MS;
+	uint32_t ack = rylr998_rel_airtime(rel, RYLR_REL_ACK_SIZE) + RYLR_REL_TURNAROUND_MS;
+
+	return frame * rel->window + (frame + RYLR_REL_TURNAROUND_MS) + ack;
+}
+
+
+/**
+ * @brief  Sends one frame and waits for the module's +OK, then marks the radio busy for its airtime.
+ */
+static HAL_StatusTypeDef rylr998_rel_transmit(rylr998_rel_t *rel, uint8_t *frame, uint8_t length){
+
+	rylr998_t *hrylr = rel->hrylr;
+
+	if(rylr998_sendData(hrylr, rel->peer, frame, length) != HAL_OK ||
+	   rylr998_AwaitResponse(hrylr, RYLR_OK, NULL) != RYLR_STATUS_OK){
+		return HAL_ERROR;
+	}
+	rel->radio_free = hrylr->tick() + rylr998_rel_airtime(rel, length);
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Initializes a reliable link with one peer.
+ * @param  rel: link state
+ * @param  hrylr: Pointer to the RYLR998 handle used to send
+ * @param  peer: address of the other end
+ * @param  window: frames in flight, 1 (stop-and-wait) to RYLR_REL_WINDOW_MAX
+ * @param  deliver: called once for every new frame received from the peer
+ * @param  sent: called when a frame is acknowledged or dropped after RYLR_REL_MAX_RETRIES, may be NULL
+ */
+void rylr998_relInit(rylr998_rel_t *rel, rylr998_t *hrylr, uint16_t peer, uint8_t window,
+					 RYLR_rel_deliver_t deliver, RYLR_rel_sent_t sent){
+
+	memset(rel, 0, sizeof(*rel));
+	rel->hrylr = hrylr;
+	rel->peer = peer;
+	rel->window = (window == 0) ? 1 : (window > RYLR_REL_WINDOW_MAX ? RYLR_REL_WINDOW_MAX : window);
+	rel->max_retries = RYLR_REL_MAX_RETRIES;
+	rel->deliver = deliver;
+	rel->sent = sent;
+	rel->radio_free = hrylr->tick();
+}
+
+
+/**
+ * @brief  Queues a frame, it is sent by rylr998_relProcess as soon as the radio is free.
+ * @param  rel: link state
+ * @param  data: payload, copied
+ * @param  length: up to RYLR_REL_PAYLOAD_MAX bytes
+ * @param  seq: if not NULL, sequence number given to the frame
+ * @retval HAL_StatusTypeDef: HAL_BUSY if the window is full, HAL_ERROR if the payload is too long
+ */
+HAL_StatusTypeDef rylr998_relSend(rylr998_rel_t *rel, const uint8_t *data, uint8_t length, uint8_t *seq){
+
+	if(length > RYLR_REL_PAYLOAD_MAX){
+		return HAL_ERROR;
+	}
+	if((uint8_t)(rel->snd_nxt - rel->snd_una) >= rel->window){
+		return HAL_BUSY;
+	}
+
+	RYLR_rel_slot_t *slot = &rel->slot[rel->snd_nxt % RYLR_REL_WINDOW_MAX];
+	memcpy(slot->data, data, length);
+	slot->length = length;
+	slot->retries = 0;
+	slot->state = RYLR_REL_SLOT_QUEUED;
+
+	if(seq != NULL){
+		*seq = rel->snd_nxt;
+	}
+	rel->snd_nxt++;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Slides the send window over the frames already acknowledged or dropped
+ */
+static void rylr998_rel_advance(rylr998_rel_t *rel){
+	while(rel->snd_una != rel->snd_nxt && rel->slot[rel->snd_una % RYLR_REL_WINDOW_MAX].state == RYLR_REL_SLOT_FREE){
+		rel->snd_una++;
+	}
+}
+
+
+/**
+ * @brief  Releases the frames covered by an ACK
+ */
+static void rylr998_rel_ack(rylr998_rel_t *rel, uint8_t next, uint8_t sack){
+
+	uint8_t outstanding = rel->snd_nxt - rel->snd_una;
+	uint8_t cumulative = next - rel->snd_una;
+
+	if(cumulative > outstanding){
+		return;		//stale, or not for this window
+	}
+	rel->stats.acks_received++;
+
+	for(uint8_t k = 0; k < outstanding; k++){
+		uint8_t seq = rel->snd_una + k;
+		uint8_t offset = seq - next;
+		RYLR_rel_slot_t *slot = &rel->slot[seq % RYLR_REL_WINDOW_MAX];
+
+		if(slot->state != RYLR_REL_SLOT_INFLIGHT){
+			continue;
+		}
+		if(k < cumulative || (offset >= 1 && offset <= 8 && ((sack >> (offset - 1)) & 1U))){
+			slot->state = RYLR_REL_SLOT_FREE;
+			rel->stats.frames_acked++;
+			rel->stats.bytes_acked += slot->length;
+			if(rel->sent != NULL){
+				rel->sent(rel, seq, 1);
+			}
+		}
+	}
+	rylr998_rel_advance(rel);
+}
+
+
+/**
+ * @brief  Skips the frames the sender gave up on: everything before its window base will never come
+ */
+static void rylr998_rel_skip(rylr998_rel_t *rel, uint8_t base){
+
+	int8_t ahead = (int8_t)(base - rel->rcv_nxt);
+
+	if(ahead <= 0){
+		return;
+	}
+	for(uint8_t k = 0; k < (uint8_t)ahead; k++){
+		if(!((rel->rcv_mask >> k) & 1U)){
+			rel->stats.frames_skipped++;
+		}
+	}
+	rel->rcv_mask = ((uint8_t)ahead >= 8U) ? 0 : (uint8_t)(rel->rcv_mask >> ahead);
+	rel->rcv_nxt = base;
+	while(rel->rcv_mask & 1U){
+		rel->rcv_mask >>= 1;
+		rel->rcv_nxt++;
+	}
+}
+
+
+/**
+ * @brief  Accepts a DATA frame, delivers it if new and schedules the ACK
+ */
+static void rylr998_rel_data(rylr998_rel_t *rel, uint8_t seq, uint8_t base, const uint8_t *data, uint8_t length){
+
+	rylr998_rel_skip(rel, base);
+
+	uint8_t offset = seq - rel->rcv_nxt;
+
+	if(offset < RYLR_REL_WINDOW_MAX && !((rel->rcv_mask >> offset) & 1U)){
+		rel->rcv_mask |= (uint8_t)(1U << offset);
+		rel->stats.frames_delivered++;
+		if(rel->deliver != NULL){
+			rel->deliver(rel, seq, data, length);
+		}
+		// Keep bit 0 for the first hole
+		while(rel->rcv_mask & 1U){
+			rel->rcv_mask >>= 1;
+			rel->rcv_nxt++;
+		}
+	}else{
+		rel->stats.duplicates++;	//already delivered, the ACK was lost
+	}
+
+	// Wait one frame gap for the rest of the window, then acknowledge
+	rel->ack_pending++;
+	rel->ack_deadline = rel->hrylr->tick() + rylr998_rel_airtime(rel, length + RYLR_REL_HEADER_SIZE) +
+						2 * RYLR_REL_TURNAROUND_MS;
+}
+
+
+/**
+ * @brief  Hands a received packet to the link, call it from the +RCV callback.
+ * @param  rel: link state
+ * @param  packet: packet decoded by the parser
+ * @retval 1 if the packet belonged to this link, 0 to let other layers look at it
+ */
+uint8_t rylr998_relInput(rylr998_rel_t *rel, const RYLR_RX_data_t *packet){
+
+	if(packet->id != rel->peer || packet->byte_count < RYLR_REL_HEADER_SIZE){
+		return 0;
+	}
+
+	switch(packet->data[0]){
+		case RYLR_REL_DATA:
+			rel->rcv_snr = packet->snr;
+			rylr998_rel_data(rel, packet->data[1], packet->data[2], &packet->data[RYLR_REL_HEADER_SIZE],
+							 packet->byte_count - RYLR_REL_HEADER_SIZE);
+			return 1;
+
+		case RYLR_REL_ACK:
+			if(packet->byte_count >= RYLR_REL_ACK_MIN_SIZE){
+				rylr998_rel_ack(rel, packet->data[1], packet->data[2]);
+			}
+			if(packet->byte_count >= RYLR_REL_ACK_SIZE && rel->feedback != NULL){
+				rel->feedback(rel, (int8_t)packet->data[3]);
+			}
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+
+/**
+ * @brief  Sends the pending ACK, then the next queued or timed out frame. Call it from the main loop,
+ *         it sends at most one frame per call and never while the previous one is still on air.
+ * @param  rel: link state
+ */
+void rylr998_relProcess(rylr998_rel_t *rel){
+
+	uint32_t now = rel->hrylr->tick();
+
+	if((int32_t)(now - rel->radio_free) < 0){
+		return;
+	}
+
+	// ACK first, it is what frees the peer's window
+	if(rel->ack_pending && (rel->ack_pending >= rel->window || (int32_t)(now - rel->ack_deadline) >= 0)){
+		uint8_t ack[RYLR_REL_ACK_SIZE] = { RYLR_REL_ACK, rel->rcv_nxt, (uint8_t)(rel->rcv_mask >> 1), (uint8_t)rel->rcv_snr };
+
+		if(rylr998_rel_transmit(rel, ack, sizeof(ack)) == HAL_OK){
+			rel->ack_pending = 0;
+			rel->stats.acks_sent++;
+		}
+		return;
+	}
+
+	uint8_t una = rel->snd_una;		//moves when a frame is dropped
+	uint8_t outstanding = rel->snd_nxt - una;
+
+	for(uint8_t k = 0; k < outstanding; k++){
+		uint8_t seq = una + k;
+		RYLR_rel_slot_t *slot = &rel->slot[seq % RYLR_REL_WINDOW_MAX];
+
+		if(slot->state == RYLR_REL_SLOT_FREE ||
+		   (slot->state == RYLR_REL_SLOT_INFLIGHT && (int32_t)(now - slot->deadline) < 0)){
+			continue;
+		}
+		if(slot->state == RYLR_REL_SLOT_INFLIGHT && slot->retries >= rel->max_retries){
+			slot->state = RYLR_REL_SLOT_FREE;
+			rel->stats.frames_failed++;
+			if(rel->sent != NULL){
+				rel->sent(rel, seq, 0);
+			}
+			rylr998_rel_advance(rel);	//the next frame sent carries the new base
+			continue;
+		}
+
+		uint8_t frame[RYLR_REL_HEADER_SIZE + RYLR_REL_PAYLOAD_MAX];
+		frame[0] = RYLR_REL_DATA;
+		frame[1] = seq;
+		frame[2] = rel->snd_una;
+		memcpy(&frame[RYLR_REL_HEADER_SIZE], slot->data, slot->length);
+
+		if(rylr998_rel_transmit(rel, frame, slot->length + RYLR_REL_HEADER_SIZE) != HAL_OK){
+			break;		//module busy or UART failed, try again on the next call
+		}
+		if(slot->state == RYLR_REL_SLOT_FREE){
+			break;		//a late ACK was parsed while waiting for +OK
+		}
+		if(slot->state == RYLR_REL_SLOT_INFLIGHT){
+			slot->retries++;
+			rel->stats.retransmissions++;
+		}else{
+			rel->stats.frames_sent++;
+		}
+		slot->state = RYLR_REL_SLOT_INFLIGHT;
+		// Exponential backoff on every retransmission of the same frame
+		slot->deadline = rel->hrylr->tick() + (rylr998_rel_rto(rel, slot->length) << slot->retries);
+		break;
+	}
+
+	rylr998_rel_advance(rel);
+}
+
+
+/**
+ * @brief  Returns the number of frames queued or waiting for their ACK
+ * @param  rel: link state
+ */
+uint8_t rylr998_relInFlight(const rylr998_rel_t *rel){
+	return rel->snd_nxt - rel->snd_una;
+}
+
+
+/**
+ * @brief  Registers a function called with the SNR the peer reports in each ACK, e.g. rylr998_tpcReport.
+ * @param  rel: link state
+ * @param  feedback: NULL to stop
+ */
+void rylr998_relSetFeedback(rylr998_rel_t *rel, RYLR_rel_feedback_t feedback){
+	rel->feedback = feedback;
+}
@@ -0,0 +1,155 @@
+/*
+ * rylr998_smart.c
+ *
+ *  Smart receiving times from the +RCV inter-arrival statistics.
+ */
+#include "rylr998_smart.h"
+#include <string.h>
+
+
+/**
+ * @brief  Modeled average current of the module in smart receiving
+ */
+static uint32_t rylr998_smart_current(uint32_t rx_ms, uint32_t sleep_ms){
+	return (rx_ms * RYLR_I_RX_UA + sleep_ms * RYLR_I_SLEEP_UA) / (rx_ms + sleep_ms);
+}
+
+
+/**
+ * @brief  Returns whether new differs from old by more than RYLR_SMART_HYSTERESIS percent
+ */
+static uint8_t rylr998_smart_moved(uint32_t old, uint32_t new){
+
+	uint32_t diff = (new > old) ? new - old : old - new;
+
+	return diff * 100U > old * RYLR_SMART_HYSTERESIS;
+}
+
+
+/**
+ * @brief  Initializes the tuner, the module is assumed in continuous receive (AT+MODE=0).
+ * @param  sm: tuner
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  latency_ms: longest a downlink frame may wait for the module to listen
+ */
+void rylr998_smartInit(rylr998_smart_t *sm, rylr998_t *hrylr, uint32_t latency_ms){
+
+	memset(sm, 0, sizeof(*sm));
+	sm->hrylr = hrylr;
+	sm->latency_ms = latency_ms;
+	sm->last_eval = hrylr->tick();
+	sm->applied.mode = 0;
+	sm->applied.current_ua = RYLR_I_RX_UA;
+}
+
+
+/**
+ * @brief  Records the arrival of a packet, call it from the receive callback. Never consumes the packet.
+ * @param  sm: tuner
+ * @param  packet: packet decoded by the parser
+ */
+void rylr998_smartInput(rylr998_smart_t *sm, const RYLR_RX_data_t *packet){
+
+	uint32_t gap = packet->tick - sm->last_arrival;
+
+	sm->stats.arrivals++;
+	sm->last_arrival = packet->tick;
+	if(sm->stats.arrivals == 1){
+		return;
+	}
+
+	// Averages over about 8 gaps, the first one seeds them
+	if(sm->samples == 0){
+		sm->gap_ms = gap;
+	}else{
+		sm->gap_ms = sm->gap_ms - (sm->gap_ms >> 3) + (gap >> 3);
+	}
+	if(gap < sm->gap_ms / 4U){
+		sm->burst_gap_ms = (sm->burst_gap_ms == 0) ? gap : sm->burst_gap_ms - (sm->burst_gap_ms >> 3) + (gap >> 3);
+	}
+	if(sm->samples < UINT16_MAX){
+		sm->samples++;
+	}
+}
+
+
+/**
+ * @brief  Computes the setting with the lowest modeled current that keeps the latency target.
+ * @param  sm: tuner
+ * @param  setting: recommendation
+ */
+void rylr998_smartRecommend(rylr998_smart_t *sm, RYLR_smart_setting_t *setting){
+
+	rylr998_t *hrylr = sm->hrylr;
+	uint32_t rx, sleep;
+
+	// Window: enough to catch a preamble and header, and to span the gaps inside a burst
+	rx = (rylr998_timeOnAir(rylr998_activePhy(hrylr), 0) + 999U) / 1000U;
+	if(sm->samples >= RYLR_SMART_MIN_SAMPLES && sm->burst_gap_ms > rx){
+		rx = sm->burst_gap_ms;
+	}
+	if(rx < RYLR_SMART_TIME_MIN){
+		rx = RYLR_SMART_TIME_MIN;
+	}
+
+	setting->mode = 0;
+	setting->rx_ms = 0;
+	setting->sleep_ms = 0;
+	setting->current_ua = RYLR_I_RX_UA;
+
+	// The rest of the latency target goes to the sleep
+	if(rx > RYLR_SMART_TIME_MAX || sm->latency_ms < rx + RYLR_SMART_TIME_MIN){
+		return;
+	}
+	sleep = sm->latency_ms - rx;
+	if(sleep > RYLR_SMART_TIME_MAX){
+		sleep = RYLR_SMART_TIME_MAX;
+	}
+
+	// Dense traffic: a frame about every cycle, continuous receive costs little more and adds no latency
+	if(sm->samples >= RYLR_SMART_MIN_SAMPLES && sm->gap_ms < rx + sleep){
+		return;
+	}
+
+	setting->mode = 2;
+	setting->rx_ms = (uint16_t)rx;
+	setting->sleep_ms = (uint16_t)sleep;
+	setting->current_ua = rylr998_smart_current(rx, sleep);
+}
+
+
+/**
+ * @brief  Re-evaluates the traffic every RYLR_SMART_EVAL_MS and sends AT+MODE when the recommendation
+ *         moved. Call it from the main loop, it blocks for the AT+MODE exchange.
+ * @param  sm: tuner
+ * @retval RYLR_status_t: RYLR_STATUS_OK if nothing to do or the mode was applied
+ */
+RYLR_status_t rylr998_smartProcess(rylr998_smart_t *sm){
+
+	rylr998_t *hrylr = sm->hrylr;
+	RYLR_smart_setting_t setting;
+	RYLR_status_t status = RYLR_STATUS_TX_ERROR;
+
+	if((hrylr->tick() - sm->last_eval) < RYLR_SMART_EVAL_MS){
+		return RYLR_STATUS_OK;
+	}
+	sm->last_eval = hrylr->tick();
+
+	rylr998_smartRecommend(sm, &setting);
+	if(setting.mode == sm->applied.mode &&
+	   (setting.mode == 0 || (!rylr998_smart_moved(sm->applied.rx_ms, setting.rx_ms) &&
+							  !rylr998_smart_moved(sm->applied.sleep_ms, setting.sleep_ms)))){
+		return RYLR_STATUS_OK;
+	}
+
+	if(rylr998_mode(hrylr, setting.mode, setting.rx_ms, setting.sleep_ms) == HAL_OK){
+		status = rylr998_AwaitResponse(hrylr, RYLR_OK, NULL);
+	}
+	if(status == RYLR_STATUS_OK){
+		sm->applied = setting;
+		sm->stats.changes++;
+	}else{
+		sm->stats.failures++;
+	}
+	return status;
+}
@@ -0,0 +1,272 @@
+/*
+ * rylr998_tdma.c
+ *
+ *  TDMA slot scheduler synchronized by gateway beacons.
+ */
+#include "rylr998_tdma.h"
+#include <string.h>
+
+
+/**
+ * @brief  Time on air with the handle's current settings, rounded up to ms
+ */
+static uint32_t rylr998_tdma_airtime(rylr998_tdma_t *tdma, uint8_t length){
+	return (rylr998_timeOnAir(rylr998_activePhy(tdma->hrylr), length) + 999U) / 1000U;
+}
+
+
+/**
+ * @brief  Superframe length: the beacon slot plus one slot per node
+ */
+static uint32_t rylr998_tdma_period(rylr998_tdma_t *tdma){
+	return (uint32_t)(tdma->slots + 1U) * tdma->slot_ms;
+}
+
+
+/**
+ * @brief  Averages a new AT+SEND to air measurement. The delay to +OK includes the time on air
+ *         when the module answers after transmitting, that part is removed.
+ */
+static void rylr998_tdma_latency(rylr998_tdma_t *tdma, uint32_t ok_delay, uint8_t length){
+
+	uint32_t airtime = rylr998_tdma_airtime(tdma, length);
+	uint32_t measured = (ok_delay > airtime) ? ok_delay - airtime : ok_delay;
+
+	tdma->tx_latency_ms = (uint16_t)((3U * tdma->tx_latency_ms + measured) / 4U);
+}
+
+
+/**
+ * @brief  Initializes the scheduler, as gateway if address == gateway, as node otherwise.
+ * @param  tdma: scheduler
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  gateway: address of the node sending the beacons
+ * @param  address: address of this module (AT+ADDRESS)
+ * @param  arm: starts a one-shot timer calling rylr998_tdmaTimerElapsed after delay_us, NULL to poll
+ */
+void rylr998_tdmaInit(rylr998_tdma_t *tdma, rylr998_t *hrylr, uint16_t gateway, uint16_t address, RYLR_tdma_arm_fn_t arm){
+
+	memset(tdma, 0, sizeof(*tdma));
+	tdma->hrylr = hrylr;
+	tdma->gateway = gateway;
+	tdma->address = address;
+	tdma->arm = arm;
+	tdma->tx_latency_ms = RYLR_TDMA_TX_LATENCY_MS;
+}
+
+
+/**
+ * @brief  Computes the slot length for frames up to max_payload bytes: time on air plus RYLR_TDMA_GUARD_MS.
+ * @param  phy: radio settings, e.g. rylr998_activePhy(hrylr)
+ * @param  max_payload: largest frame sent in a slot
+ * @retval slot length in ms
+ */
+uint16_t rylr998_tdmaSlotMs(const RYLR_phy_t *phy, uint8_t max_payload){
+	return (uint16_t)((rylr998_timeOnAir(phy, max_payload) + 999U) / 1000U + RYLR_TDMA_GUARD_MS);
+}
+
+
+/**
+ * @brief  Gateway only: sets the number of node slots and starts sending beacons.
+ *         The slot is sized for RYLR_TDMA_PAYLOAD_MAX with the current settings.
+ * @param  tdma: scheduler
+ * @param  slots: node slots per superframe, 1 to 255
+ * @retval HAL_StatusTypeDef: HAL_ERROR if not the gateway or the settings are unknown
+ */
+HAL_StatusTypeDef rylr998_tdmaSetFrame(rylr998_tdma_t *tdma, uint8_t slots){
+
+	if(tdma->address != tdma->gateway || slots == 0 || !(tdma->hrylr->phy_valid & RYLR_PHY_PARAMETER)){
+		return HAL_ERROR;
+	}
+	tdma->slots = slots;
+	tdma->slot_ms = rylr998_tdmaSlotMs(rylr998_activePhy(tdma->hrylr), RYLR_TDMA_PAYLOAD_MAX);
+	tdma->synced = 1;
+	tdma->frame_start = tdma->hrylr->tick() - rylr998_tdma_period(tdma);	//first beacon right away
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Takes the beacons from the gateway, call it from the +RCV callback.
+ * @param  tdma: scheduler
+ * @param  packet: packet decoded by the parser
+ * @retval 1 if the packet was a beacon, 0 to let other layers look at it
+ */
+uint8_t rylr998_tdmaInput(rylr998_tdma_t *tdma, const RYLR_RX_data_t *packet){
+
+	if(packet->id != tdma->gateway || packet->byte_count != RYLR_TDMA_BEACON_SIZE ||
+	   packet->data[0] != RYLR_TDMA_BEACON){
+		return 0;
+	}
+	if(tdma->address == tdma->gateway || packet->data[2] == 0){
+		return 1;
+	}
+
+	// The line is complete once the beacon left the air and the +RCV went over the UART
+	uint32_t baud = tdma->hrylr->huart->Init.BaudRate;
+	uint32_t uart_ms = ((24U + packet->byte_count) * 10000U + baud - 1U) / baud;
+
+	tdma->beacon_seq = packet->data[1];
+	tdma->slots = packet->data[2];
+	tdma->slot_ms = (uint16_t)(packet->data[3] | (packet->data[4] << 8));
+	tdma->frame_start = packet->tick - rylr998_tdma_airtime(tdma, RYLR_TDMA_BEACON_SIZE) - uart_ms;
+	tdma->synced = 1;
+	tdma->missed = 0;
+	tdma->stats.beacons++;
+	return 1;
+}
+
+
+/**
+ * @brief  Queues a frame for the next own slot.
+ * @param  tdma: scheduler
+ * @param  dest: destination address
+ * @param  data: payload, copied
+ * @param  length: up to RYLR_TDMA_PAYLOAD_MAX bytes
+ * @retval HAL_StatusTypeDef: HAL_BUSY if a frame is already waiting, HAL_ERROR if too long
+ */
+HAL_StatusTypeDef rylr998_tdmaSend(rylr998_tdma_t *tdma, uint16_t dest, const uint8_t *data, uint8_t length){
+
+	if(length > RYLR_TDMA_PAYLOAD_MAX){
+		return HAL_ERROR;
+	}
+	if(tdma->pending){
+		return HAL_BUSY;
+	}
+	memcpy(tdma->data, data, length);
+	tdma->dest = dest;
+	tdma->length = length;
+	tdma->pending = 1;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Marks the start of the slot, call it from the interrupt of the timer armed by the hook.
+ *         Nothing is sent from here, rylr998_tdmaProcess sends as soon as it sees the flag.
+ * @param  tdma: scheduler
+ */
+void rylr998_tdmaTimerElapsed(rylr998_tdma_t *tdma){
+	if(tdma->armed){
+		tdma->fired = 1;
+	}
+}
+
+
+/**
+ * @brief  Node: waits in Sleep mode for the start of the slot, then sends the frame and waits for +OK.
+ *         The timer interrupt (or SysTick without the hook) ends every Sleep.
+ */
+static void rylr998_tdma_slot(rylr998_tdma_t *tdma){
+
+	rylr998_t *hrylr = tdma->hrylr;
+	const RYLR_retry_policy_t once = {
+		.timeout_ms = rylr998_tdma_airtime(tdma, tdma->length) + RYLR_DEFAULT_TIMEOUT_MS,
+		.max_retries = 0,		//a retransmission would fall outside the slot
+		.backoff_ms = 0,
+	};
+	// Without a timer the tick is the trigger, with one the wait is bounded in case it never fires
+	int32_t limit = (tdma->arm != NULL) ? (int32_t)(RYLR_TDMA_GUARD_MS / 2U) : 0;
+
+	while(!tdma->fired && (int32_t)(hrylr->tick() - tdma->fire_tick) < limit){
+		HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+	}
+
+	uint32_t send_tick = hrylr->tick();
+
+	tdma->armed = 0;
+	tdma->fired = 0;
+
+	// Past the start of the slot by more than the guard can absorb: rylr998_tdmaProcess rearms it for the
+	// next superframe and counts it late there
+	if((int32_t)(send_tick - tdma->fire_tick) > (int32_t)(RYLR_TDMA_GUARD_MS / 2U)){
+		return;
+	}
+	if(rylr998_sendData(hrylr, tdma->dest, tdma->data, tdma->length) == HAL_OK &&
+	   rylr998_AwaitResponse(hrylr, RYLR_OK, &once) == RYLR_STATUS_OK){
+		rylr998_tdma_latency(tdma, hrylr->tick() - send_tick, tdma->length);
+		tdma->pending = 0;
+		tdma->stats.frames_sent++;
+	}else{
+		tdma->stats.failures++;
+	}
+}
+
+
+/**
+ * @brief  Gateway: sends the beacon of every superframe.
+ */
+static void rylr998_tdma_beacon(rylr998_tdma_t *tdma, uint32_t now){
+
+	rylr998_t *hrylr = tdma->hrylr;
+
+	if((now - tdma->frame_start) < rylr998_tdma_period(tdma)){
+		return;
+	}
+
+	uint8_t beacon[RYLR_TDMA_BEACON_SIZE] = {
+		RYLR_TDMA_BEACON, ++tdma->beacon_seq, tdma->slots,
+		(uint8_t)tdma->slot_ms, (uint8_t)(tdma->slot_ms >> 8)
+	};
+	if(rylr998_sendData(hrylr, RYLR_BROADCAST_ADDRESS, beacon, sizeof(beacon)) != HAL_OK ||
+	   rylr998_AwaitResponse(hrylr, RYLR_OK, NULL) != RYLR_STATUS_OK){
+		tdma->stats.failures++;
+		return;
+	}
+	tdma->frame_start = now + tdma->tx_latency_ms;
+	rylr998_tdma_latency(tdma, hrylr->tick() - now, sizeof(beacon));
+	tdma->stats.beacons++;
+}
+
+
+/**
+ * @brief  Runs the scheduler, call it from the main loop: sends the beacons on the gateway, follows
+ *         the superframe, arms the timer for the next own slot and sends in it. Blocks from up to
+ *         RYLR_TDMA_WAIT_MS before the slot until the module's answer.
+ * @param  tdma: scheduler
+ */
+void rylr998_tdmaProcess(rylr998_tdma_t *tdma){
+
+	rylr998_t *hrylr = tdma->hrylr;
+	uint32_t now = hrylr->tick();
+
+	if(!tdma->synced){
+		return;
+	}
+	if(tdma->address == tdma->gateway){
+		rylr998_tdma_beacon(tdma, now);
+		return;
+	}
+
+	// Follow the superframe without beacons for a while
+	uint32_t period = rylr998_tdma_period(tdma);
+	while((int32_t)(now - (tdma->frame_start + period + tdma->slot_ms)) >= 0){
+		tdma->frame_start += period;
+		tdma->stats.missed++;
+		if(++tdma->missed > RYLR_TDMA_MAX_MISSED){
+			tdma->synced = 0;
+			return;
+		}
+	}
+
+	if(tdma->pending && !tdma->armed){
+		uint8_t slot = 1U + (uint8_t)(tdma->address % tdma->slots);
+		uint32_t fire = tdma->frame_start + slot * tdma->slot_ms - tdma->tx_latency_ms;
+
+		// Past the start of the slot by more than the guard can absorb: next superframe
+		if((int32_t)(now - fire) > (int32_t)(RYLR_TDMA_GUARD_MS / 2U)){
+			fire += period;
+			tdma->stats.late++;
+		}
+		tdma->fire_tick = fire;
+		tdma->armed = 1;
+		if(tdma->arm != NULL){
+			int32_t delay = (int32_t)(fire - now);
+			tdma->arm((delay > 0) ? (uint32_t)delay * 1000U : 0U);
+		}
+	}
+
+	if(tdma->armed && (tdma->fired || (int32_t)(tdma->fire_tick - now) <= (int32_t)RYLR_TDMA_WAIT_MS)){
+		rylr998_tdma_slot(tdma);
+	}
+}
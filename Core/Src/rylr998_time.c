@@ -0,0 +1,153 @@
+/*
+ * rylr998_time.c
+ *
+ *  Over-the-air time synchronization.
+ */
+#include "rylr998_time.h"
+#include <string.h>
+
+
+/**
+ * @brief  Time on air with the handle's current settings, rounded to the nearest ms
+ */
+static uint32_t rylr998_time_airtime(rylr998_time_t *ts, uint8_t length){
+	return (rylr998_timeOnAir(rylr998_activePhy(ts->hrylr), length) + 500U) / 1000U;
+}
+
+
+/**
+ * @brief  Drift correction of an interval: elapsed * drift_ppm / 10^6, kept in 32 bits
+ */
+static int32_t rylr998_time_drift(int32_t drift_ppm, uint32_t elapsed){
+	return (int32_t)(elapsed / 1000U) * drift_ppm / 1000 + (int32_t)(elapsed % 1000U) * drift_ppm / 1000000;
+}
+
+
+/**
+ * @brief  Initializes the service, as master if address == master, as node otherwise.
+ * @param  ts: time service
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  master: address of the node sending the SYNC frames
+ * @param  address: address of this module (AT+ADDRESS)
+ */
+void rylr998_timeInit(rylr998_time_t *ts, rylr998_t *hrylr, uint16_t master, uint16_t address){
+
+	memset(ts, 0, sizeof(*ts));
+	ts->hrylr = hrylr;
+	ts->master = master;
+	ts->address = address;
+	ts->tx_latency_ms = RYLR_TIME_TX_LATENCY_MS;
+	ts->last_sync = hrylr->tick() - RYLR_TIME_SYNC_MS;
+}
+
+
+/**
+ * @brief  Returns the network time: the master's tick.
+ * @param  ts: time service
+ * @param  network_ms: written with the network time in ms
+ * @retval HAL_StatusTypeDef: HAL_ERROR on a node never synced or past RYLR_TIME_HOLDOVER_MS
+ */
+HAL_StatusTypeDef rylr998_timeNow(rylr998_time_t *ts, uint32_t *network_ms){
+
+	uint32_t now = ts->hrylr->tick();
+
+	if(ts->address == ts->master){
+		*network_ms = now;
+		return HAL_OK;
+	}
+	if(!ts->synced || (now - ts->ref_local) > RYLR_TIME_HOLDOVER_MS){
+		ts->synced = 0;
+		return HAL_ERROR;
+	}
+	*network_ms = ts->ref_remote + (now - ts->ref_local) + rylr998_time_drift(ts->drift_ppm, now - ts->ref_local);
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Takes the SYNC frames of the master, call it from the +RCV callback.
+ * @param  ts: time service
+ * @param  packet: packet decoded by the parser
+ * @retval 1 if the packet was a SYNC, 0 to let other layers look at it
+ */
+uint8_t rylr998_timeInput(rylr998_time_t *ts, const RYLR_RX_data_t *packet){
+
+	const uint8_t *frame = packet->data;
+
+	if(packet->id != ts->master || packet->byte_count != RYLR_TIME_SYNC_SIZE || frame[0] != RYLR_TIME_SYNC){
+		return 0;
+	}
+	if(ts->address == ts->master){
+		return 1;
+	}
+
+	// Local tick when the frame went on air: +RCV line complete, minus its UART time, minus the airtime
+	uint32_t baud = ts->hrylr->huart->Init.BaudRate;
+	uint32_t uart_ms = ((24U + packet->byte_count) * 10000U + baud / 2U) / baud;
+	uint32_t local = packet->tick - uart_ms - rylr998_time_airtime(ts, RYLR_TIME_SYNC_SIZE);
+	uint32_t remote = frame[2] | (frame[3] << 8) | ((uint32_t)frame[4] << 16) | ((uint32_t)frame[5] << 24);
+	uint32_t predicted;
+
+	ts->stats.syncs++;
+
+	if(rylr998_timeNow(ts, &predicted) == HAL_OK){
+		// Error of the clock kept since the previous SYNC, then the drift it reveals
+		predicted -= ts->hrylr->tick() - local;
+		ts->stats.last_error_ms = (int32_t)(predicted - remote);
+		uint32_t error = (ts->stats.last_error_ms < 0) ? -ts->stats.last_error_ms : ts->stats.last_error_ms;
+		if(error > ts->stats.max_error_ms){
+			ts->stats.max_error_ms = error;
+		}
+
+		uint32_t d_local = local - ts->ref_local;
+		int32_t diff = (int32_t)((remote - ts->ref_remote) - d_local);
+		if(d_local >= 1000U && diff < RYLR_TIME_MAX_PPM && diff > -RYLR_TIME_MAX_PPM){
+			int32_t ppm = diff * 1000 / (int32_t)(d_local / 1000U);
+			if(ppm < RYLR_TIME_MAX_PPM && ppm > -RYLR_TIME_MAX_PPM){
+				// Averaged, a 1 ms tick gives a coarse estimate per interval
+				ts->drift_ppm = (ts->samples++ == 0) ? ppm : (3 * ts->drift_ppm + ppm) / 4;
+			}
+		}
+	}
+
+	ts->ref_local = local;
+	ts->ref_remote = remote;
+	ts->offset_ms = (int32_t)(remote - local);
+	ts->synced = 1;
+	return 1;
+}
+
+
+/**
+ * @brief  Master: sends a SYNC every RYLR_TIME_SYNC_MS. Call it from the main loop.
+ * @param  ts: time service
+ */
+void rylr998_timeProcess(rylr998_time_t *ts){
+
+	rylr998_t *hrylr = ts->hrylr;
+	uint32_t now = hrylr->tick();
+
+	if(ts->address != ts->master || (now - ts->last_sync) < RYLR_TIME_SYNC_MS){
+		return;
+	}
+
+	uint32_t on_air = now + ts->tx_latency_ms;
+	uint8_t frame[RYLR_TIME_SYNC_SIZE] = {
+		RYLR_TIME_SYNC, ts->seq++,
+		(uint8_t)on_air, (uint8_t)(on_air >> 8), (uint8_t)(on_air >> 16), (uint8_t)(on_air >> 24)
+	};
+
+	if(rylr998_sendData(hrylr, RYLR_BROADCAST_ADDRESS, frame, sizeof(frame)) != HAL_OK ||
+	   rylr998_AwaitResponse(hrylr, RYLR_OK, NULL) != RYLR_STATUS_OK){
+		return;
+	}
+
+	// +OK delay, without the airtime when the module answers after transmitting
+	uint32_t ok_delay = hrylr->tick() - now;
+	uint32_t airtime = rylr998_time_airtime(ts, sizeof(frame));
+	uint32_t measured = (ok_delay > airtime) ? ok_delay - airtime : ok_delay;
+
+	ts->tx_latency_ms = (uint16_t)((3U * ts->tx_latency_ms + measured) / 4U);
+	ts->last_sync = now;
+	ts->stats.syncs++;
+}
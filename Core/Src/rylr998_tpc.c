@@ -0,0 +1,143 @@
+/*
+ * rylr998_tpc.c
+ *
+ *  Transmit power controller.
+ */
+#include "rylr998_tpc.h"
+#include "rylr998_adr.h"
+#include <string.h>
+
+
+/**
+ * @brief  Power the module transmits with, max_dbm while it is not known
+ */
+static uint8_t rylr998_tpc_current(rylr998_tpc_t *tpc){
+
+	rylr998_t *hrylr = tpc->hrylr;
+
+	if(!(hrylr->phy_valid & RYLR_PHY_CRFOP) || hrylr->phy.CRFOP > tpc->max_dbm){
+		return tpc->max_dbm;
+	}
+	return hrylr->phy.CRFOP;
+}
+
+
+/**
+ * @brief  Initializes the controller, no report received.
+ * @param  tpc: controller
+ * @param  hrylr: Pointer to the RYLR998 handle whose power is adapted
+ * @param  margin_db: SNR kept above the demodulation floor, RYLR_TPC_MARGIN_DB if negative
+ * @param  max_dbm: highest power used, RYLR_TPC_MAX_DBM if 0 or above it
+ */
+void rylr998_tpcInit(rylr998_tpc_t *tpc, rylr998_t *hrylr, int8_t margin_db, uint8_t max_dbm){
+
+	memset(tpc, 0, sizeof(*tpc));
+	tpc->hrylr = hrylr;
+	tpc->margin_db = (margin_db < 0) ? RYLR_TPC_MARGIN_DB : margin_db;
+	tpc->max_dbm = (max_dbm == 0 || max_dbm > RYLR_TPC_MAX_DBM) ? RYLR_TPC_MAX_DBM : max_dbm;
+	tpc->last_decrease = hrylr->tick() - RYLR_TPC_HOLD_MS;
+}
+
+
+/**
+ * @brief  Records the SNR the peer measured on one of our frames, e.g. from the reliable layer's feedback.
+ * @param  tpc: controller
+ * @param  snr: dB
+ */
+void rylr998_tpcReport(rylr998_tpc_t *tpc, int8_t snr){
+
+	int16_t snr_q4 = (int16_t)snr * 16;
+
+	// Exponential average, 1/4 weight to the new sample
+	if(tpc->stats.reports == 0){
+		tpc->snr_q4 = snr_q4;
+	}else{
+		tpc->snr_q4 += (snr_q4 - tpc->snr_q4) / 4;
+	}
+	if(tpc->samples < UINT8_MAX){
+		tpc->samples++;
+	}
+	tpc->stats.reports++;
+}
+
+
+/**
+ * @brief  Reports a frame the peer never acknowledged, the next rylr998_tpcProcess goes to the maximum power.
+ * @param  tpc: controller
+ */
+void rylr998_tpcLoss(rylr998_tpc_t *tpc){
+	tpc->loss = 1;
+	tpc->stats.losses++;
+}
+
+
+/**
+ * @brief  Computes the power for the SNR reported so far.
+ * @param  tpc: controller
+ * @retval Power in dBm, the current one if no change is needed
+ */
+uint8_t rylr998_tpcRecommend(rylr998_tpc_t *tpc){
+
+	rylr998_t *hrylr = tpc->hrylr;
+	uint8_t current = rylr998_tpc_current(tpc);
+
+	if(tpc->loss){
+		return tpc->max_dbm;
+	}
+	if(tpc->stats.reports == 0 || !(hrylr->phy_valid & RYLR_PHY_PARAMETER)){
+		return current;		//nothing heard yet, or the floor is not known
+	}
+
+	int16_t excess_q4 = tpc->snr_q4 - rylr998_adrFloorQ4(hrylr->phy.SF) - tpc->margin_db * 16;
+
+	if(excess_q4 < 0){
+		uint8_t up = (uint8_t)((-excess_q4 + 15) / 16);
+		return (current + up > tpc->max_dbm) ? tpc->max_dbm : current + up;
+	}
+	if(excess_q4 > RYLR_TPC_HYSTERESIS_DB * 16 && tpc->samples >= RYLR_TPC_MIN_SAMPLES &&
+	   (hrylr->tick() - tpc->last_decrease) >= RYLR_TPC_HOLD_MS){
+		// Land in the middle of the band, a dip of half of it does not raise the power again
+		uint8_t down = (uint8_t)((excess_q4 - RYLR_TPC_HYSTERESIS_DB * 8) / 16);
+		return (current < RYLR_TPC_MIN_DBM + down) ? RYLR_TPC_MIN_DBM : current - down;
+	}
+	return current;
+}
+
+
+/**
+ * @brief  Applies the recommended power, call it from the main loop. Blocks for the AT+CRFOP exchange.
+ * @param  tpc: controller
+ * @retval RYLR_status_t: RYLR_STATUS_OK if nothing changed or the new power was accepted
+ */
+RYLR_status_t rylr998_tpcProcess(rylr998_tpc_t *tpc){
+
+	rylr998_t *hrylr = tpc->hrylr;
+	uint8_t current = rylr998_tpc_current(tpc);
+	uint8_t power = rylr998_tpcRecommend(tpc);
+	RYLR_status_t status = RYLR_STATUS_TX_ERROR;
+
+	if(power == hrylr->phy.CRFOP && (hrylr->phy_valid & RYLR_PHY_CRFOP)){
+		tpc->loss = 0;
+		return RYLR_STATUS_OK;
+	}
+
+	if(rylr998_setCRFOP(hrylr, power) == HAL_OK){
+		status = rylr998_AwaitResponse(hrylr, RYLR_OK, NULL);
+	}
+	if(status != RYLR_STATUS_OK){
+		tpc->stats.failures++;
+		return status;
+	}
+
+	// The peer will see the SNR move by the same amount
+	tpc->snr_q4 += ((int16_t)power - current) * 16;
+	tpc->samples = 0;
+	tpc->loss = 0;
+	if(power < current){
+		tpc->last_decrease = hrylr->tick();
+		tpc->stats.decreases++;
+	}else if(power > current){
+		tpc->stats.increases++;
+	}
+	return status;
+}
@@ -0,0 +1,346 @@
+/*
+ * rylr998_ts.c
+ *
+ *  Delta of delta timestamps, XOR floats and zigzag integers, bit packed.
+ */
+#include "rylr998_ts.h"
+#include <string.h>
+
+
+#define RYLR_TS_NO_WINDOW			0xFFU	//no XOR window yet, the next one is written in full
+
+
+/**
+ * @brief  Writes the n low bits of value, MSB first. Bits are set and cleared,
+ *         so a rolled back position can be written over.
+ */
+static void rylr998_ts_put(RYLR_ts_bits_t *bits, uint32_t value, uint8_t n){
+
+	while(n--){
+		if(bits->pos >= bits->size_bits){
+			bits->overflow = 1;
+			return;
+		}
+		uint8_t mask = (uint8_t)(0x80U >> (bits->pos & 7U));
+		if((value >> n) & 1U){
+			bits->buffer[bits->pos >> 3] |= mask;
+		}else{
+			bits->buffer[bits->pos >> 3] &= (uint8_t)~mask;
+		}
+		bits->pos++;
+	}
+}
+
+
+/**
+ * @brief  Reads n bits, MSB first
+ */
+static uint32_t rylr998_ts_get(RYLR_ts_bits_t *bits, uint8_t n){
+
+	uint32_t value = 0;
+
+	while(n--){
+		if(bits->pos >= bits->size_bits){
+			bits->overflow = 1;
+			return 0;
+		}
+		value = (value << 1) | ((bits->buffer[bits->pos >> 3] >> (7U - (bits->pos & 7U))) & 1U);
+		bits->pos++;
+	}
+	return value;
+}
+
+
+/**
+ * @brief  Counts the ones before the first zero, up to max: the prefix of a bucket
+ */
+static uint8_t rylr998_ts_prefix(RYLR_ts_bits_t *bits, uint8_t max){
+
+	uint8_t n = 0;
+
+	while(n < max && rylr998_ts_get(bits, 1)){
+		n++;
+	}
+	return n;
+}
+
+
+static inline uint32_t rylr998_ts_le32(const uint8_t *p){
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void rylr998_ts_put_le32(uint8_t *p, uint32_t v){
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+
+/**
+ * @brief  Leading and trailing zero bits of a non zero word (no CLZ instruction on the M0+)
+ */
+static void rylr998_ts_zeros(uint32_t x, uint8_t *leading, uint8_t *trailing){
+
+	uint8_t n;
+	uint32_t y;
+
+	for(n = 0, y = x; !(y & 0x80000000U); y <<= 1){
+		n++;
+	}
+	*leading = n;
+	for(n = 0, y = x; !(y & 1U); y >>= 1){
+		n++;
+	}
+	*trailing = n;
+}
+
+
+// Bucket prefixes '10', '110', '1110', '1111'
+static const uint8_t rylr998_ts_prefix_code[4] = { 0x2, 0x6, 0xE, 0xF };
+static const uint8_t rylr998_ts_prefix_bits[4] = { 2, 3, 4, 4 };
+
+// Timestamp buckets: field bits, offset making the field unsigned
+static const uint8_t rylr998_ts_time_bits[4] = { 7, 9, 12, 32 };
+static const int32_t rylr998_ts_time_bias[4] = { 63, 255, 2047, 0 };
+
+// Integer buckets
+static const uint8_t rylr998_ts_int_bits[4] = { 4, 8, 16, 32 };
+
+
+/**
+ * @brief  Starts a frame in the caller's buffer.
+ * @param  enc: encoder
+ * @param  buffer: frame buffer, later passed to rylr998_sendData
+ * @param  size: buffer size, at least RYLR_TS_HEADER_SIZE
+ * @param  mode: RYLR_TS_FLOAT or RYLR_TS_INT values
+ */
+void rylr998_tsEncInit(RYLR_ts_enc_t *enc, uint8_t *buffer, uint8_t size, RYLR_ts_mode_t mode){
+
+	memset(enc, 0, sizeof(*enc));
+	enc->bits.buffer = buffer;
+	enc->bits.size_bits = (uint16_t)size * 8U;
+	enc->bits.pos = RYLR_TS_HEADER_SIZE * 8U;
+	enc->bits.overflow = (size < RYLR_TS_HEADER_SIZE);
+	enc->mode = mode;
+	enc->leading = RYLR_TS_NO_WINDOW;
+}
+
+
+/**
+ * @brief  Adds a sample to the frame.
+ * @param  enc: encoder
+ * @param  time_ms: sample time, any ms clock that does not go back
+ * @param  value: .f in RYLR_TS_FLOAT mode, .i in RYLR_TS_INT mode
+ * @retval HAL_StatusTypeDef: HAL_BUSY if it does not fit, send the frame and add it to the next one.
+ *         HAL_ERROR if the buffer cannot even hold the header
+ */
+HAL_StatusTypeDef rylr998_tsAppend(RYLR_ts_enc_t *enc, uint32_t time_ms, RYLR_ts_value_t value){
+
+	RYLR_ts_bits_t *bits = &enc->bits;
+	uint32_t raw = (enc->mode == RYLR_TS_FLOAT) ? 0 : (uint32_t)value.i;
+	uint8_t leading = enc->leading;
+	uint8_t trailing = enc->trailing;
+
+	if(enc->mode == RYLR_TS_FLOAT){
+		memcpy(&raw, &value.f, sizeof(raw));
+	}
+
+	if(enc->count == 0){
+		if(bits->overflow){
+			return HAL_ERROR;
+		}
+		bits->buffer[0] = RYLR_TS_FRAME;
+		bits->buffer[1] = (uint8_t)enc->mode;
+		rylr998_ts_put_le32(&bits->buffer[4], time_ms);
+		rylr998_ts_put_le32(&bits->buffer[8], raw);
+		enc->last_time = time_ms;
+		enc->last_delta = 0;
+		enc->last_value = raw;
+		enc->count = 1;
+		return HAL_OK;
+	}
+	if(enc->count == 0xFFFFU){
+		return HAL_BUSY;
+	}
+
+	uint16_t start = bits->pos;
+	int32_t delta = (int32_t)(time_ms - enc->last_time);
+	int32_t dod = delta - enc->last_delta;
+
+	// Timestamp
+	if(dod == 0){
+		rylr998_ts_put(bits, 0, 1);
+	}else{
+		uint8_t b = 0;
+		while(b < 3 && (dod < -rylr998_ts_time_bias[b] || dod > rylr998_ts_time_bias[b] + 1)){
+			b++;
+		}
+		rylr998_ts_put(bits, rylr998_ts_prefix_code[b], rylr998_ts_prefix_bits[b]);
+		rylr998_ts_put(bits, (uint32_t)(dod + rylr998_ts_time_bias[b]), rylr998_ts_time_bits[b]);
+	}
+
+	// Value
+	if(enc->mode == RYLR_TS_FLOAT){
+		uint32_t x = raw ^ enc->last_value;
+
+		if(x == 0){
+			rylr998_ts_put(bits, 0, 1);
+		}else{
+			uint8_t lead, trail;
+			rylr998_ts_zeros(x, &lead, &trail);
+
+			if(leading != RYLR_TS_NO_WINDOW && lead >= leading && trail >= trailing){
+				rylr998_ts_put(bits, 0x2U, 2);
+				rylr998_ts_put(bits, x >> trailing, 32U - leading - trailing);
+			}else{
+				uint8_t length = 32U - lead - trail;
+				rylr998_ts_put(bits, 0x3U, 2);
+				rylr998_ts_put(bits, lead, 5);
+				rylr998_ts_put(bits, length - 1U, 5);
+				rylr998_ts_put(bits, x >> trail, length);
+				leading = lead;
+				trailing = trail;
+			}
+		}
+	}else{
+		int32_t d = (int32_t)(raw - enc->last_value);
+		uint32_t zz = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+
+		if(zz == 0){
+			rylr998_ts_put(bits, 0, 1);
+		}else{
+			uint8_t b = 0;
+			while(b < 3 && (zz >> rylr998_ts_int_bits[b]) != 0){
+				b++;
+			}
+			rylr998_ts_put(bits, rylr998_ts_prefix_code[b], rylr998_ts_prefix_bits[b]);
+			rylr998_ts_put(bits, zz, rylr998_ts_int_bits[b]);
+		}
+	}
+
+	if(bits->overflow){
+		bits->pos = start;	//roll back, the frame stays valid without this sample
+		bits->overflow = 0;
+		return HAL_BUSY;
+	}
+
+	enc->last_time = time_ms;
+	enc->last_delta = delta;
+	enc->last_value = raw;
+	enc->leading = leading;
+	enc->trailing = trailing;
+	enc->count++;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Finishes the frame.
+ * @param  enc: encoder
+ * @param  length: bytes to pass to rylr998_sendData
+ * @retval HAL_StatusTypeDef: HAL_ERROR if the frame holds no sample
+ */
+HAL_StatusTypeDef rylr998_tsEncEnd(RYLR_ts_enc_t *enc, uint8_t *length){
+
+	if(enc->count == 0){
+		*length = 0;
+		return HAL_ERROR;
+	}
+	enc->bits.buffer[2] = (uint8_t)enc->count;
+	enc->bits.buffer[3] = (uint8_t)(enc->count >> 8);
+	*length = (uint8_t)((enc->bits.pos + 7U) / 8U);
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Starts decoding a received frame, e.g. packet->data and packet->byte_count.
+ * @retval HAL_StatusTypeDef: HAL_ERROR if it is not a time series frame
+ */
+HAL_StatusTypeDef rylr998_tsDecInit(RYLR_ts_dec_t *dec, const uint8_t *buffer, uint8_t length){
+
+	memset(dec, 0, sizeof(*dec));
+	if(length < RYLR_TS_HEADER_SIZE || buffer[0] != RYLR_TS_FRAME || buffer[1] > RYLR_TS_INT){
+		return HAL_ERROR;
+	}
+	dec->bits.buffer = (uint8_t*)buffer;	//only read
+	dec->bits.size_bits = (uint16_t)length * 8U;
+	dec->bits.pos = RYLR_TS_HEADER_SIZE * 8U;
+	dec->mode = (RYLR_ts_mode_t)buffer[1];
+	dec->count = (uint16_t)buffer[2] | ((uint16_t)buffer[3] << 8);
+	dec->leading = RYLR_TS_NO_WINDOW;
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Returns the next sample of the frame.
+ * @param  dec: decoder
+ * @param  time_ms: sample time
+ * @param  value: sample value, .f or .i depending on dec->mode
+ * @retval HAL_StatusTypeDef: HAL_ERROR after the last sample or on a truncated frame
+ */
+HAL_StatusTypeDef rylr998_tsNext(RYLR_ts_dec_t *dec, uint32_t *time_ms, RYLR_ts_value_t *value){
+
+	RYLR_ts_bits_t *bits = &dec->bits;
+
+	if(dec->index >= dec->count){
+		return HAL_ERROR;
+	}
+
+	if(dec->index == 0){
+		dec->last_time = rylr998_ts_le32(&bits->buffer[4]);
+		dec->last_value = rylr998_ts_le32(&bits->buffer[8]);
+	}else{
+		// Timestamp
+		int32_t dod = 0;
+		uint8_t b = rylr998_ts_prefix(bits, 4);
+		if(b > 0){
+			b--;
+			dod = (int32_t)rylr998_ts_get(bits, rylr998_ts_time_bits[b]) - rylr998_ts_time_bias[b];
+		}
+		dec->last_delta += dod;
+		dec->last_time += (uint32_t)dec->last_delta;
+
+		// Value
+		if(dec->mode == RYLR_TS_FLOAT){
+			if(rylr998_ts_get(bits, 1)){
+				if(rylr998_ts_get(bits, 1)){
+					dec->leading = (uint8_t)rylr998_ts_get(bits, 5);
+					uint8_t length = (uint8_t)rylr998_ts_get(bits, 5) + 1U;
+					if(dec->leading + length > 32U){
+						bits->overflow = 1;
+					}
+					dec->trailing = 32U - dec->leading - length;
+				}else if(dec->leading == RYLR_TS_NO_WINDOW){
+					bits->overflow = 1;
+				}
+				if(!bits->overflow){
+					uint8_t length = 32U - dec->leading - dec->trailing;
+					dec->last_value ^= rylr998_ts_get(bits, length) << dec->trailing;
+				}
+			}
+		}else{
+			b = rylr998_ts_prefix(bits, 4);
+			if(b > 0){
+				uint32_t zz = rylr998_ts_get(bits, rylr998_ts_int_bits[b - 1]);
+				int32_t d = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1U);
+				dec->last_value += (uint32_t)d;
+			}
+		}
+		if(bits->overflow){
+			dec->index = dec->count;
+			return HAL_ERROR;
+		}
+	}
+
+	*time_ms = dec->last_time;
+	if(dec->mode == RYLR_TS_FLOAT){
+		memcpy(&value->f, &dec->last_value, sizeof(value->f));
+	}else{
+		value->i = (int32_t)dec->last_value;
+	}
+	dec->index++;
+	return HAL_OK;
+}
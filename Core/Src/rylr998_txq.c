@@ -0,0 +1,311 @@
+/*
+ * rylr998_txq.c
+ *
+ *  Transmit queue with jitter, binary exponential backoff and per destination rate limit.
+ */
+#include "rylr998_txq.h"
+#include <string.h>
+
+
+static const uint8_t rylr998_txq_weights[RYLR_TXQ_CLASSES] = RYLR_TXQ_WEIGHTS;
+
+// Control frames only spread over a short window, they must not wait
+static const uint32_t rylr998_txq_jitter[RYLR_TXQ_CLASSES] = {
+	RYLR_TXQ_JITTER_MS / 8U, RYLR_TXQ_JITTER_MS, RYLR_TXQ_JITTER_MS
+};
+
+
+/**
+ * @brief  Next pseudo random number (xorshift32)
+ */
+static uint32_t rylr998_txq_rand(rylr998_txq_t *txq){
+
+	uint32_t x = txq->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	txq->rng = x;
+	return x;
+}
+
+
+/**
+ * @brief  Time on air with the handle's current settings, rounded up to ms
+ */
+static uint32_t rylr998_txq_airtime(rylr998_txq_t *txq, uint8_t length){
+	return (rylr998_timeOnAir(rylr998_activePhy(txq->hrylr), length) + 999U) / 1000U;
+}
+
+
+/**
+ * @brief  Rate limit entry of a destination, the least recently used one is recycled
+ */
+static RYLR_txq_dest_t *rylr998_txq_dest(rylr998_txq_t *txq, uint16_t dest){
+
+	RYLR_txq_dest_t *oldest = &txq->dest[0];
+
+	for(uint8_t i = 0; i < RYLR_TXQ_DESTS; i++){
+		if(txq->dest[i].used && txq->dest[i].dest == dest){
+			return &txq->dest[i];
+		}
+		if(!txq->dest[i].used ||
+		   (oldest->used && (int32_t)(txq->dest[i].last_tx - oldest->last_tx) < 0)){
+			oldest = &txq->dest[i];
+		}
+	}
+	return oldest;
+}
+
+
+/**
+ * @brief  Initializes an empty queue, the random generator is seeded from the device UID.
+ * @param  txq: queue
+ * @param  hrylr: Pointer to the RYLR998 handle
+ * @param  done: called when a frame needing an ACK is acknowledged or dropped, may be NULL
+ */
+void rylr998_txqInit(rylr998_txq_t *txq, rylr998_t *hrylr, RYLR_txq_done_t done){
+
+	memset(txq, 0, sizeof(*txq));
+	txq->hrylr = hrylr;
+	txq->done = done;
+	txq->radio_free = hrylr->tick();
+	memcpy(txq->credit, rylr998_txq_weights, sizeof(txq->credit));
+	// Different on every node so their jitter differs too
+	txq->rng = HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2() ^ txq->radio_free;
+	if(txq->rng == 0){
+		txq->rng = 0x2545F491U;
+	}
+}
+
+
+/**
+ * @brief  Selects strict priority or weighted round robin between the classes.
+ * @param  txq: queue
+ * @param  weighted: 0 for strict priority (default), 1 for RYLR_TXQ_WEIGHTS
+ */
+void rylr998_txqSetScheduling(rylr998_txq_t *txq, uint8_t weighted){
+
+	txq->weighted = weighted;
+	memcpy(txq->credit, rylr998_txq_weights, sizeof(txq->credit));
+}
+
+
+/**
+ * @brief  Queues a frame of class RYLR_TXQ_NORMAL, see rylr998_txqSendClass.
+ */
+HAL_StatusTypeDef rylr998_txqSend(rylr998_txq_t *txq, uint16_t dest, const uint8_t *data, uint8_t length,
+								  uint8_t need_ack, uint8_t *token){
+	return rylr998_txqSendClass(txq, RYLR_TXQ_NORMAL, dest, data, length, need_ack, token);
+}
+
+
+/**
+ * @brief  Queues a frame, it is sent after a random jitter (up to RYLR_TXQ_JITTER_MS, 1/8 of it for control).
+ * @param  txq: queue
+ * @param  cls: class of the frame
+ * @param  dest: destination address
+ * @param  data: payload, copied
+ * @param  length: up to RYLR_TXQ_PAYLOAD_MAX bytes
+ * @param  need_ack: 1 to resend with backoff until rylr998_txqAck, 0 to send once
+ * @param  token: if not NULL, identifies the frame for rylr998_txqAck
+ * @retval HAL_StatusTypeDef: HAL_BUSY if the queue is full, HAL_ERROR if the payload is too long
+ */
+HAL_StatusTypeDef rylr998_txqSendClass(rylr998_txq_t *txq, RYLR_txq_class_t cls, uint16_t dest, const uint8_t *data,
+									   uint8_t length, uint8_t need_ack, uint8_t *token){
+
+	RYLR_txq_entry_t *free_entry = NULL;
+	uint8_t used = 0;
+
+	if(length > RYLR_TXQ_PAYLOAD_MAX || cls >= RYLR_TXQ_CLASSES){
+		return HAL_ERROR;
+	}
+
+	for(uint8_t i = 0; i < RYLR_TXQ_DEPTH; i++){
+		if(txq->entry[i].state != RYLR_TXQ_FREE){
+			used++;
+		}else if(free_entry == NULL){
+			free_entry = &txq->entry[i];
+		}
+	}
+	// The last entries are kept for control frames
+	if(free_entry == NULL || (cls != RYLR_TXQ_CONTROL && used + RYLR_TXQ_RESERVED >= RYLR_TXQ_DEPTH)){
+		txq->stats.full++;
+		return HAL_BUSY;
+	}
+
+	RYLR_txq_entry_t *entry = free_entry;
+	uint32_t now = txq->hrylr->tick();
+
+	memcpy(entry->data, data, length);
+	entry->length = length;
+	entry->dest = dest;
+	entry->cls = cls;
+	entry->need_ack = need_ack;
+	entry->attempts = 0;
+	entry->token = txq->next_token++;
+	entry->order = txq->order++;
+	entry->queued = now;
+	entry->not_before = now + rylr998_txq_rand(txq) % (rylr998_txq_jitter[cls] + 1U);
+	entry->state = RYLR_TXQ_READY;
+	if(token != NULL){
+		*token = entry->token;
+	}
+	return HAL_OK;
+}
+
+
+/**
+ * @brief  Releases a frame acknowledged by its destination, call it when the application ACK is received.
+ * @param  txq: queue
+ * @param  token: value given by rylr998_txqSend
+ */
+void rylr998_txqAck(rylr998_txq_t *txq, uint8_t token){
+
+	for(uint8_t i = 0; i < RYLR_TXQ_DEPTH; i++){
+		RYLR_txq_entry_t *entry = &txq->entry[i];
+		if(entry->state != RYLR_TXQ_FREE && entry->need_ack && entry->token == token){
+			entry->state = RYLR_TXQ_FREE;
+			txq->stats.acked++;
+			if(txq->done != NULL){
+				txq->done(txq, token, 1);
+			}
+			return;
+		}
+	}
+}
+
+
+/**
+ * @brief  Chooses the class to serve among those with a frame due
+ */
+static RYLR_txq_entry_t *rylr998_txq_pick(rylr998_txq_t *txq, RYLR_txq_entry_t *due[RYLR_TXQ_CLASSES]){
+
+	if(txq->weighted){
+		for(uint8_t round = 0; round < 2; round++){
+			for(uint8_t c = 0; c < RYLR_TXQ_CLASSES; c++){
+				if(due[c] != NULL && txq->credit[c] > 0){
+					return due[c];
+				}
+			}
+			// Every class with traffic used its share: next round
+			memcpy(txq->credit, rylr998_txq_weights, sizeof(txq->credit));
+		}
+		return NULL;
+	}
+
+	for(uint8_t c = 0; c < RYLR_TXQ_CLASSES; c++){
+		if(due[c] != NULL){
+			return due[c];
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief  Handles ACK timeouts, then sends the oldest frame that is due. Call it from the main loop,
+ *         it sends at most one frame per call and never while the previous one is still on air.
+ * @param  txq: queue
+ */
+void rylr998_txqProcess(rylr998_txq_t *txq){
+
+	rylr998_t *hrylr = txq->hrylr;
+	uint32_t now = hrylr->tick();
+	RYLR_txq_entry_t *due[RYLR_TXQ_CLASSES] = { NULL };
+	RYLR_txq_entry_t *next;
+
+	for(uint8_t i = 0; i < RYLR_TXQ_DEPTH; i++){
+		RYLR_txq_entry_t *entry = &txq->entry[i];
+
+		if(entry->state == RYLR_TXQ_FREE || (int32_t)(now - entry->not_before) < 0){
+			continue;
+		}
+		if(entry->state == RYLR_TXQ_WAIT_ACK){
+			if(entry->attempts >= RYLR_TXQ_MAX_ATTEMPTS){
+				entry->state = RYLR_TXQ_FREE;
+				txq->stats.dropped++;
+				if(txq->done != NULL){
+					txq->done(txq, entry->token, 0);
+				}
+				continue;
+			}
+			// No ACK: back off a random number of frame slots, the window doubles on every attempt
+			uint8_t exp = (entry->attempts < RYLR_TXQ_BACKOFF_MAX_EXP) ? entry->attempts : RYLR_TXQ_BACKOFF_MAX_EXP;
+			uint32_t slot = rylr998_txq_airtime(txq, entry->length);
+			entry->not_before = now + (rylr998_txq_rand(txq) % (1UL << exp)) * slot;
+			entry->state = RYLR_TXQ_READY;
+			continue;
+		}
+		// Oldest frame due in each class
+		if(due[entry->cls] == NULL || (int32_t)(entry->order - due[entry->cls]->order) < 0){
+			due[entry->cls] = entry;
+		}
+	}
+
+	if((int32_t)(now - txq->radio_free) < 0){
+		return;
+	}
+	next = rylr998_txq_pick(txq, due);
+	if(next == NULL){
+		return;
+	}
+
+	RYLR_txq_dest_t *dest = rylr998_txq_dest(txq, next->dest);
+	if(next->cls != RYLR_TXQ_CONTROL && dest->used && dest->dest == next->dest &&
+	   (now - dest->last_tx) < RYLR_TXQ_DEST_INTERVAL_MS){
+		next->not_before = dest->last_tx + RYLR_TXQ_DEST_INTERVAL_MS;
+		txq->stats.rate_limited++;
+		return;
+	}
+
+	if(rylr998_sendData(hrylr, next->dest, next->data, next->length) != HAL_OK ||
+	   rylr998_AwaitResponse(hrylr, RYLR_OK, NULL) != RYLR_STATUS_OK){
+		return;		//module busy or duty cycle spent, try again on the next call
+	}
+
+	uint32_t airtime = rylr998_txq_airtime(txq, next->length);
+	now = hrylr->tick();
+	txq->radio_free = now + airtime;
+	dest->dest = next->dest;
+	dest->used = 1;
+	dest->last_tx = now;
+
+	if(txq->credit[next->cls] > 0){
+		txq->credit[next->cls]--;
+	}
+	if(next->attempts++ == 0){
+		uint32_t delay = now - next->queued;
+
+		txq->stats.frames_sent++;
+		txq->stats.cls[next->cls].frames++;
+		txq->stats.cls[next->cls].delay_ms += delay;
+		if(delay > txq->stats.cls[next->cls].delay_max_ms){
+			txq->stats.cls[next->cls].delay_max_ms = delay;
+		}
+	}else{
+		txq->stats.retries++;
+	}
+	if(next->need_ack){
+		next->state = RYLR_TXQ_WAIT_ACK;
+		next->not_before = txq->radio_free + RYLR_TXQ_ACK_TIMEOUT_MS;
+	}else{
+		next->state = RYLR_TXQ_FREE;
+	}
+}
+
+
+/**
+ * @brief  Returns the number of frames queued or waiting for their ACK
+ * @param  txq: queue
+ */
+uint8_t rylr998_txqPending(const rylr998_txq_t *txq){
+
+	uint8_t count = 0;
+
+	for(uint8_t i = 0; i < RYLR_TXQ_DEPTH; i++){
+		if(txq->entry[i].state != RYLR_TXQ_FREE){
+			count++;
+		}
+	}
+	return count;
+}
@@ -9,6 +9,22 @@ C_SRCS += \
 ../Core/Src/gpio.c \
 ../Core/Src/main.c \
 ../Core/Src/rylr998.c \
+../Core/Src/rylr998_adr.c \
+../Core/Src/rylr998_bulk.c \
+../Core/Src/rylr998_cbor.c \
+../Core/Src/rylr998_dedup.c \
+../Core/Src/rylr998_energy.c \
+../Core/Src/rylr998_fec.c \
+../Core/Src/rylr998_link.c \
+../Core/Src/rylr998_mesh.c \
+../Core/Src/rylr998_reliable.c \
+../Core/Src/rylr998_sec.c \
+../Core/Src/rylr998_smart.c \
+../Core/Src/rylr998_tdma.c \
+../Core/Src/rylr998_time.c \
+../Core/Src/rylr998_tpc.c \
+../Core/Src/rylr998_ts.c \
+../Core/Src/rylr998_txq.c \
 ../Core/Src/stm32l0xx_hal_msp.c \
 ../Core/Src/stm32l0xx_it.c \
 ../Core/Src/syscalls.c \
@@ -21,6 +37,22 @@ OBJS += \
 ./Core/Src/gpio.o \
 ./Core/Src/main.o \
 ./Core/Src/rylr998.o \
+./Core/Src/rylr998_adr.o \
+./Core/Src/rylr998_bulk.o \
+./Core/Src/rylr998_cbor.o \
+./Core/Src/rylr998_dedup.o \
+./Core/Src/rylr998_energy.o \
+./Core/Src/rylr998_fec.o \
+./Core/Src/rylr998_link.o \
+./Core/Src/rylr998_mesh.o \
+./Core/Src/rylr998_reliable.o \
+./Core/Src/rylr998_sec.o \
+./Core/Src/rylr998_smart.o \
+./Core/Src/rylr998_tdma.o \
+./Core/Src/rylr998_time.o \
+./Core/Src/rylr998_tpc.o \
+./Core/Src/rylr998_ts.o \
+./Core/Src/rylr998_txq.o \
 ./Core/Src/stm32l0xx_hal_msp.o \
 ./Core/Src/stm32l0xx_it.o \
 ./Core/Src/syscalls.o \
@@ -33,6 +65,22 @@ C_DEPS += \
 ./Core/Src/gpio.d \
 ./Core/Src/main.d \
 ./Core/Src/rylr998.d \
+./Core/Src/rylr998_adr.d \
+./Core/Src/rylr998_bulk.d \
+./Core/Src/rylr998_cbor.d \
+./Core/Src/rylr998_dedup.d \
+./Core/Src/rylr998_energy.d \
+./Core/Src/rylr998_fec.d \
+./Core/Src/rylr998_link.d \
+./Core/Src/rylr998_mesh.d \
+./Core/Src/rylr998_reliable.d \
+./Core/Src/rylr998_sec.d \
+./Core/Src/rylr998_smart.d \
+./Core/Src/rylr998_tdma.d \
+./Core/Src/rylr998_time.d \
+./Core/Src/rylr998_tpc.d \
+./Core/Src/rylr998_ts.d \
+./Core/Src/rylr998_txq.d \
 ./Core/Src/stm32l0xx_hal_msp.d \
 ./Core/Src/stm32l0xx_it.d \
 ./Core/Src/syscalls.d \
@@ -48,7 +96,7 @@ Core/Src/%.o Core/Src/%.su Core/Src/%.cyclo: ../Core/Src/%.c Core/Src/subdir.mk
 clean: clean-Core-2f-Src
 
 clean-Core-2f-Src:
-	-$(RM) ./Core/Src/dma.cyclo ./Core/Src/dma.d ./Core/Src/dma.o ./Core/Src/dma.su ./Core/Src/gpio.cyclo ./Core/Src/gpio.d ./Core/Src/gpio.o ./Core/Src/gpio.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/rylr998.cyclo ./Core/Src/rylr998.d ./Core/Src/rylr998.o ./Core/Src/rylr998.su ./Core/Src/stm32l0xx_hal_msp.cyclo ./Core/Src/stm32l0xx_hal_msp.d ./Core/Src/stm32l0xx_hal_msp.o ./Core/Src/stm32l0xx_hal_msp.su ./Core/Src/stm32l0xx_it.cyclo ./Core/Src/stm32l0xx_it.d ./Core/Src/stm32l0xx_it.o ./Core/Src/stm32l0xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32l0xx.cyclo ./Core/Src/system_stm32l0xx.d ./Core/Src/system_stm32l0xx.o ./Core/Src/system_stm32l0xx.su ./Core/Src/usart.cyclo ./Core/Src/usart.d ./Core/Src/usart.o ./Core/Src/usart.su
+	-$(RM) ./Core/Src/dma.cyclo ./Core/Src/dma.d ./Core/Src/dma.o ./Core/Src/dma.su ./Core/Src/gpio.cyclo ./Core/Src/gpio.d ./Core/Src/gpio.o ./Core/Src/gpio.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/rylr998.cyclo ./Core/Src/rylr998.d ./Core/Src/rylr998.o ./Core/Src/rylr998.su ./Core/Src/rylr998_adr.cyclo ./Core/Src/rylr998_adr.d ./Core/Src/rylr998_adr.o ./Core/Src/rylr998_adr.su ./Core/Src/rylr998_bulk.cyclo ./Core/Src/rylr998_bulk.d ./Core/Src/rylr998_bulk.o ./Core/Src/rylr998_bulk.su ./Core/Src/rylr998_cbor.cyclo ./Core/Src/rylr998_cbor.d ./Core/Src/rylr998_cbor.o ./Core/Src/rylr998_cbor.su ./Core/Src/rylr998_dedup.cyclo ./Core/Src/rylr998_dedup.d ./Core/Src/rylr998_dedup.o ./Core/Src/rylr998_dedup.su ./Core/Src/rylr998_energy.cyclo ./Core/Src/rylr998_energy.d ./Core/Src/rylr998_energy.o ./Core/Src/rylr998_energy.su ./Core/Src/rylr998_fec.cyclo ./Core/Src/rylr998_fec.d ./Core/Src/rylr998_fec.o ./Core/Src/rylr998_fec.su ./Core/Src/rylr998_link.cyclo ./Core/Src/rylr998_link.d ./Core/Src/rylr998_link.o ./Core/Src/rylr998_link.su ./Core/Src/rylr998_mesh.cyclo ./Core/Src/rylr998_mesh.d ./Core/Src/rylr998_mesh.o ./Core/Src/rylr998_mesh.su ./Core/Src/rylr998_reliable.cyclo ./Core/Src/rylr998_reliable.d ./Core/Src/rylr998_reliable.o ./Core/Src/rylr998_reliable.su ./Core/Src/rylr998_sec.cyclo ./Core/Src/rylr998_sec.d ./Core/Src/rylr998_sec.o ./Core/Src/rylr998_sec.su ./Core/Src/rylr998_smart.cyclo ./Core/Src/rylr998_smart.d ./Core/Src/rylr998_smart.o ./Core/Src/rylr998_smart.su ./Core/Src/rylr998_tdma.cyclo ./Core/Src/rylr998_tdma.d ./Core/Src/rylr998_tdma.o ./Core/Src/rylr998_tdma.su ./Core/Src/rylr998_time.cyclo ./Core/Src/rylr998_time.d ./Core/Src/rylr998_time.o ./Core/Src/rylr998_time.su ./Core/Src/rylr998_tpc.cyclo ./Core/Src/rylr998_tpc.d ./Core/Src/rylr998_tpc.o ./Core/Src/rylr998_tpc.su ./Core/Src/rylr998_ts.cyclo ./Core/Src/rylr998_ts.d ./Core/Src/rylr998_ts.o ./Core/Src/rylr998_ts.su ./Core/Src/rylr998_txq.cyclo ./Core/Src/rylr998_txq.d ./Core/Src/rylr998_txq.o ./Core/Src/rylr998_txq.su ./Core/Src/stm32l0xx_hal_msp.cyclo ./Core/Src/stm32l0xx_hal_msp.d ./Core/Src/stm32l0xx_hal_msp.o ./Core/Src/stm32l0xx_hal_msp.su ./Core/Src/stm32l0xx_it.cyclo ./Core/Src/stm32l0xx_it.d ./Core/Src/stm32l0xx_it.o ./Core/Src/stm32l0xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32l0xx.cyclo ./Core/Src/system_stm32l0xx.d ./Core/Src/system_stm32l0xx.o ./Core/Src/system_stm32l0xx.su ./Core/Src/usart.cyclo ./Core/Src/usart.d ./Core/Src/usart.o ./Core/Src/usart.su
 
 .PHONY: clean-Core-2f-Src
 